@@ -2,16 +2,20 @@
 
 /* Build with: 
 
-"cc -O2 mesh_viewer.c -o mesh_viewer" for normal mode
-"cc -O2 mesh_viewer.c -o mesh_viewer -lncurses -DNCURSES" for NCURSES mode
+"cc -O2 -ffp-contract=off mesh_viewer.c -o mesh_viewer" for normal mode
+"cc -O2 -ffp-contract=off mesh_viewer.c -o mesh_viewer -lncurses -DNCURSES" for NCURSES mode
 
 Add "-DBENCHMARK" flag to build with frame time
 
 */
 
-/* Input-output, memory management and math headers */
+/* Input-output, memory management, string, math and time headers */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <float.h>
+#include <time.h>
 
 /* Math const */
 #define PI 3.14159265358979f
@@ -19,13 +23,50 @@ Add "-DBENCHMARK" flag to build with frame time
 /* Ncurses header */
 #ifdef NCURSES
 #include <curses.h>
+#include <locale.h>
+#endif
+
+/* Threads need the POSIX interface too */
+#if defined(THREADS) && !defined(POSIX)
+#define POSIX
+#endif
+
+/* The real time loop needs a wall clock and a timed wait for input */
+#if defined(NCURSES) || defined(POSIX)
+#define REALTIME
 #endif
 
 /* Benchmark render time */
-#ifdef BENCHMARK
+#if defined(BENCHMARK) || defined(REALTIME)
 #include <sys/time.h>
 #endif
 
+/* POSIX file interface, used by the streaming renderer and to map mesh files */
+#ifdef POSIX
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
+#include <glob.h>
+#endif
+
+/* Background threads */
+#ifdef THREADS
+#include <pthread.h>
+#endif
+
+/* Compressed mesh input */
+#ifdef ZLIB
+#include <zlib.h>
+#endif
+#ifdef ZSTD
+#include <zstd.h>
+#endif
+
 /* Rendering const */
 #define NEAR_PLANE 0.2f
 #define START_Z 5.0f
@@ -36,9 +77,211 @@ Add "-DBENCHMARK" flag to build with frame time
 #define LIGHT_CHAR '#'
 #define COLOR_ALBEDO COLOR_RED
 
+/* Visibility buffer value of a cell with no tris */
+#define ID_EMPTY 0xFFFFFFFFu
+
+/* Output glyphs: a char per cell, or the mask of 1x2 (half block) or 2x4 (Braille) samples per cell */
+#define GLYPH_TEXT 0
+#define GLYPH_HALF 1
+#define GLYPH_BRAILLE 2
+#define GLYPH_MODE_COUNT 3
+
+/* Wireframe: every edge, edges hidden by the filled mesh removed, or only the silhouette */
+#define WIRE_OFF 0
+#define WIRE_EDGES 1
+#define WIRE_HIDDEN 2
+#define WIRE_SILHOUETTE 3
+#define WIRE_MODE_COUNT 4
+
+/* Depth slack of an edge against the faces it lies on */
+#define WIRE_DEPTH_BIAS 0.05f
+
+/* ANSI color output: off, 256 color or 24 bit background per cell */
+#define ANSI_OFF 0
+#define ANSI_256 1
+#define ANSI_TRUECOLOR 2
+#define ANSI_MODE_COUNT 3
+
+/* ANSI colors: default, light, shadow and a material each, and the longest SGR with its terminator */
+#define ANSI_DEFAULT 0
+#define ANSI_LIGHT 1
+#define ANSI_SHADOW 2
+#define ANSI_MATERIAL 3
+#define ANSI_COLORS 19
+#define ANSI_SGR_MAX 20
+
+/* Depth buffer format: 1/z float, or 16 bit fixed point in the mesh range */
+#define DEPTH_FLOAT 0
+#define DEPTH_FIXED16 1
+#define DEPTH_MODE_COUNT 2
+
+/* PLY format, limits of the header, and property types as their index in ply_type_name modulo 8 */
+#define PLY_ASCII 0
+#define PLY_LITTLE_ENDIAN 1
+#define PLY_BIG_ENDIAN 2
+#define PLY_ELEMENT_MAX 16
+#define PLY_PROPERTY_MAX 32
+#define PLY_NAME_MAX 32
+#define PLY_INT8 0
+#define PLY_UINT8 1
+#define PLY_INT16 2
+#define PLY_UINT16 3
+#define PLY_INT32 4
+#define PLY_UINT32 5
+#define PLY_FLOAT32 6
+#define PLY_FLOAT64 7
+
+/* Compression of a mesh file, found by its magic */
+#define CODEC_NONE 0
+#define CODEC_GZIP 1
+#define CODEC_ZSTD 2
+
+/* Decompressed block size, and blocks in flight between the decompressor and the parser */
+#define READ_BLOCK 1048576
+#define READ_BLOCKS 4
+
+/* Binary STL: 80 byte header and tris count, then 50 byte records */
+#define STL_HEADER 84
+#define STL_RECORD 50
+
+/* Max vertex in a PLY face, OBJ faces have no limit */
+#define FACE_MAX 512
+
+/* First size of the OBJ line and face buffers, grown as needed */
+#define LINE_SIZE 1024
+#define FACE_SIZE 64
+
+/* Level of detail: max chain length, grid range of the simplification and max projected error in cells */
+#define LOD_MAX 8
+#define LOD_MAX_GRID 1024
+#define LOD_MIN_GRID 4
+#define LOD_CELL_ERROR 1.0f
+
+/* Chunked mesh file: magic, max tris per chunk, max grid used to split the mesh */
+#define CHUNK_MAGIC "MVCHUNK1"
+#define CHUNK_TRIS 16384
+#define CHUNK_MAX_GRID 128
+
+/* Chunk residency state */
+#define CHUNK_EMPTY 0
+#define CHUNK_LOADING 1
+#define CHUNK_READY 2
+
+/* Default resident budget and the extra screen fraction prefetched around the view */
+#define STREAM_BUDGET_MB 256
+#define STREAM_PREFETCH_MARGIN 0.5f
+
+/* Frames of a sequence decoded ahead, default playback rate, and longest frame path */
+#define SEQUENCE_SLOTS 4
+#define SEQUENCE_FPS 24
+#define SEQUENCE_PATH 1024
+
+/* Render server: workers, sessions open at once, meshes kept loaded, longest request line and path, start and
+   largest frame size */
+#define SERVER_WORKERS 4
+#define SERVER_BACKLOG 16
+#define SERVER_SESSIONS 64
+#define SERVER_CACHE 16
+#define SERVER_LINE 1100
+#define SERVER_PATH 1024
+#define SERVER_WIDTH 80
+#define SERVER_HEIGHT 24
+#define SERVER_MAX_CELLS 1048576
+
+/* Sequence slot state */
+#define SLOT_FREE 0
+#define SLOT_DECODING 1
+#define SLOT_READY 2
+
+/* Slots of the converter vertex table, twice the max vertex of a chunk */
+#define REMAP_SIZE 131072
+
+/* Visible instances of a scene mesh transformed in one pass, then rastered */
+#define SCENE_BATCH 8
+
+/* Alignment of the buffers in the render arena */
+#define ARENA_ALIGN 64
+
+/* Offscreen poster: tile size in cells, its buffers fit in the cache, and tiles rendered at once */
+#define TILE_WIDTH 64
+#define TILE_HEIGHT 32
+#define TILE_WORKERS 4
+
+/* Split screen viewports, at most a 2x2 grid */
+#define SPLIT_MAX 4
+
+/* BVH bins of the SAH build, tris per leaf below which and up to which no split is tried, and the depth limit */
+#define BVH_BINS 16
+#define BVH_LEAF 4
+#define BVH_LEAF_MAX 16
+#define BVH_DEPTH_MAX 48
+#define BVH_STACK 64
+
+/* Subtrees built on their own thread: down to this depth, and only with enough tris */
+#define BVH_THREAD_DEPTH 2
+#define BVH_THREAD_TRIS 65536
+
+/* Depth of the BVH nodes whose boxes bound the mesh when fitting the view, and the border left */
+#define FIT_DEPTH 6
+#define FIT_MARGIN 1.1f
+
+/* Pick report */
+#define PICK_LINE 256
+
+/* Subpixel precision of the rasterizer, and the max screen coordinate kept exact */
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+#define GUARD_BAND 4194304.f
+
+/* Force the raster kernel body inline, so every specialization is constant folded */
+#ifdef __GNUC__
+#define KERNEL_INLINE __inline__ __attribute__((always_inline))
+#else
+#define KERNEL_INLINE
+#endif
+
 /* Font width/height rateo */
 #define FONT_RATEO 0.5f
 
+/* Script frame size and longest line */
+#define SCRIPT_WIDTH 80
+#define SCRIPT_HEIGHT 24
+#define SCRIPT_LINE 1100
+
+/* Frames of the raster benchmark, a full turn */
+#define RASTER_BENCH_FRAMES 360
+
+/* Benchmark suite: default mesh size, timed batches of runs and frame stages */
+#define BENCH_TRIS 100000
+#define BENCH_BATCHES 5
+#define BENCH_RUNS 20
+#define BENCH_SIZES 4
+#define BENCH_TRANSFORM 0
+#define BENCH_CLIP 1
+#define BENCH_RASTER 2
+#define BENCH_CLEAR 3
+#define BENCH_PRESENT 4
+#define BENCH_STAGES 5
+
+/* Golden frame check: views, viewport sizes, timed runs and batches, and the slowdown over the baseline that fails a stage */
+#define CHECK_VIEWS 3
+#define CHECK_SIZES 3
+#define CHECK_MODES 5
+#define CHECK_RUNS 10
+#define CHECK_BATCHES 10
+#define CHECK_SLOWDOWN 1.5
+#define CHECK_NOISE_MS 0.02
+#define CHECK_LINE 256
+
+/* Default target frame rate and turntable speed in degree per second */
+#define LOOP_FPS 30
+#define TURNTABLE_SPEED 45
+
+/* Resolution scaling: levels, frames averaged before a change, and budget fraction needed to go back up */
+#define RESOLUTION_LEVELS 7
+#define RESOLUTION_FRAMES 8
+#define RESOLUTION_HEADROOM 0.75f
+
 /* Ncurses motion step */
 #ifdef NCURSES
 #define TRANSLATE_STEP 0.06f
@@ -63,6 +306,11 @@ static const char* const HELP_MESSAGE =
 									\n\
 	Misc: 		R - reset	C - color	P - ortho view	\n\
 			H - help	Q - quit	T - light  	\n\
+			B - depth format	N - pin level of detail	\n\
+			Y - turntable	G - deferred shading		\n\
+			E - glyphs (text, half block, Braille)		\n\
+			Tab - next split viewport			\n\
+			F - wireframe (edges, hidden, silhouette)	\n\
 									\n\
 Press ANY key to continue";					
 
@@ -76,6 +324,15 @@ static const char* const HELP_MESSAGE0 =
 	s[axis] [ammount] - scale					\n\
 	p - ortho view							\n\
 	l - light mode							\n\
+	d - depth buffer format						\n\
+	g - deferred shading, visibility buffer				\n\
+	e [text|half|braille] - output glyphs, the next if none		\n\
+	f [edges|hidden|silhouette|off] - wireframe, the next if none	\n\
+	c [256|truecolor|off] - ANSI color, the next if none		\n\
+	n [level] - pin level of detail, automatic if none		\n\
+	o [viewport] - focus a split viewport, the next if none		\n\
+	i [col] [row] - pick the tris under a cell			\n\
+	y [speed] - turntable in degree per second, off if none		\n\
 	h - help							\n\
 	m - reset							\n\
 	q - quit							\n\
@@ -100,11 +357,519 @@ Press ENTER to continue							";
 #define SCREEN_HEIGHT 24
 #endif
 
+/* Vertex stuct */
+typedef struct vertex 
+{
+	float x;
+	float y;
+	float z;
+} vertex_t;
+
+/* Node of a tris BVH: a leaf of count tris from first in the leaf order, or if count is 0 an inner node
+   whose children are the nodes first and first+1 */
+typedef struct bvh_node
+{
+	vertex_t min;
+	vertex_t max;
+	int first;
+	int count;
+} bvh_node_t;
+
+/* Mesh struct, holding either full or compact storage */
+typedef struct mesh
+{
+	int vertex_count;
+	int tris_count;
+
+	/* Full storage: float positions and 32 bit indices */
+	vertex_t *vertex_buffer;
+	int *tris_buffer;
+
+	/* Compact storage: positions quantized to 16 bit on the bounding box and 16 bit indices */
+	unsigned short *quant_buffer;
+	unsigned short *tris_buffer16;
+
+	/* Bounding box, quantization step and max position error on any axis */
+	vertex_t bound_min;
+	vertex_t bound_max;
+	vertex_t quant_step;
+	float quant_error;
+
+	/* Simplification error, the cluster cell size for a level of detail */
+	float lod_error;
+
+	/* File the vertex buffer points into when loaded without a copy, NULL if it is owned */
+	char *file_map;
+	unsigned long file_size;
+
+	/* Unique edges as vertex pairs and their two faces, -1 on a border, built on the first wireframe frame */
+	int edge_count;
+	int *edge_buffer;
+	int *edge_face;
+
+	/* OBJ line of every tris, NULL if the mesh is not read from an OBJ */
+	int *tris_line;
+
+	/* Tris BVH in model space and the tris in leaf order, built the first time it is queried */
+	int bvh_count;
+	bvh_node_t *bvh_node;
+	int *bvh_tris;
+} mesh_t;
+
+/* PLY property, count_type is -1 if it is not a list */
+typedef struct ply_property
+{
+	char name[PLY_NAME_MAX];
+	int type;
+	int count_type;
+} ply_property_t;
+
+/* PLY element and its properties */
+typedef struct ply_element
+{
+	char name[PLY_NAME_MAX];
+	int count;
+	int property_count;
+	ply_property_t property[PLY_PROPERTY_MAX];
+} ply_element_t;
+
+/* Line reader over a plain or compressed file, a ring of decompressed blocks */
+typedef struct mesh_reader
+{
+	int codec;
+	FILE* file;
+	#ifdef ZLIB
+	gzFile gz_file;
+	#endif
+	#ifdef ZSTD
+	ZSTD_DStream* zstd;
+	ZSTD_inBuffer zstd_in;
+	char* zstd_buffer;
+	#endif
+
+	/* Blocks, produced and consumed count, end of data and error */
+	char* block[READ_BLOCKS];
+	long block_size[READ_BLOCKS];
+	unsigned long produced;
+	unsigned long consumed;
+	int done;
+	int error;
+
+	/* Block being split in lines, held by the parser */
+	const char* cursor;
+	long left;
+	int held;
+
+	/* Decompressed bytes */
+	unsigned long long total;
+
+	/* Lines read, and the first one of the last line returned, a continued line spans more */
+	int line_count;
+	int line_number;
+
+	#ifdef THREADS
+	int threaded;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	#endif
+} mesh_reader_t;
+
+/* Cursor on the PLY body */
+typedef struct ply_reader
+{
+	const char* cursor;
+	const char* end;
+	int format;
+} ply_reader_t;
+
+/* Vertex cluster of the simplification, quadric stored as the upper triangle of the 4x4 matrix */
+typedef struct cluster
+{
+	int key;
+	int count;
+	double sum[3];
+	double quadric[10];
+} cluster_t;
+
+/* Grow only memory block, every per frame buffer is carved from it */
+typedef struct arena
+{
+	char *block;
+	char *base;
+	unsigned long capacity;
+	unsigned long used;
+	unsigned long alloc_count;
+} arena_t;
+
+/* Chunk of a streamed mesh, as stored in the file table */
+typedef struct chunk_info
+{
+	vertex_t bound_min;
+	vertex_t bound_max;
+	int vertex_count;
+	int tris_count;
+	long long offset;
+} chunk_info_t;
+
+/* Chunk being written by the converter, with its global to local vertex table */
+typedef struct chunk_builder
+{
+	FILE* out_file;
+	chunk_info_t* table;
+	int chunk_count;
+	int chunk_capacity;
+	int max_vertex;
+	int* remap_key;
+	int* remap_value;
+	vertex_t* vertex_buffer;
+	unsigned short* tris_buffer;
+	int vertex_count;
+	int tris_count;
+} chunk_builder_t;
+
+/* Chunk and its resident mesh */
+typedef struct chunk
+{
+	chunk_info_t info;
+	mesh_t mesh;
+	int state;
+	unsigned long last_used;
+} chunk_t;
+
+/* Streamed mesh, chunks are loaded from the file within a memory budget */
+typedef struct stream
+{
+	int file;
+	int chunk_count;
+	int max_vertex;
+	chunk_t* chunk;
+
+	/* Whole mesh bounds, for the depth range */
+	mesh_t bounds;
+
+	/* Chunks to draw, and the ones the loader should bring in, visible first */
+	int* draw_list;
+	int* load_queue;
+	int draw_count;
+	int load_count;
+
+	/* Frame counter for the LRU, memory in use and budget in bytes */
+	unsigned long frame;
+	unsigned long resident;
+	unsigned long budget;
+
+	/* Stats of the last frame */
+	int resident_count;
+	int drawn_tris;
+	int hits;
+	int misses;
+	double stall_ms;
+
+	#ifdef THREADS
+	pthread_t loader;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t loaded;
+	unsigned long idle_frame;
+	int quit;
+	#endif
+} stream_t;
+
+/* Instance of a scene mesh, model matrix in the same row vector layout as transform */
+typedef struct instance
+{
+	int mesh;
+	float matrix[4][4];
+} instance_t;
+
+/* Scene of shared meshes and their instances, grouped by mesh */
+typedef struct scene
+{
+	int mesh_count;
+	int instance_count;
+	mesh_t* mesh;
+	instance_t* instance;
+
+	/* World bounds of every instance, for the depth range */
+	mesh_t bounds;
+	int max_vertex;
+
+	/* Stats of the last frame */
+	int drawn_instances;
+	int drawn_tris;
+} scene_t;
+
+/* Frame slot of a sequence, the buffers are kept for the next frames decoded in it */
+typedef struct sequence_slot
+{
+	mesh_t mesh;
+	int vertex_capacity;
+	int tris_capacity;
+	int state;
+	long position;
+
+	/* Tris equal to the first frame ones, drawn with the shared index buffer */
+	int same_topology;
+	double decode_ms;
+} sequence_slot_t;
+
+/* Mesh sequence played at a target rate, the upcoming frames are decoded ahead in a ring of slots */
+typedef struct sequence
+{
+	char** path;
+	int frame_count;
+	int max_vertex;
+	float fps;
+	sequence_slot_t slot[SEQUENCE_SLOTS];
+
+	/* First frame tris, and its 16 bit copy shared by the frames with the same topology */
+	int* topology;
+	unsigned short* topology16;
+	int topology_count;
+
+	/* Playback start, position on screen and the one due now, counted from the start across loops */
+	double start_ms;
+	int shown;
+	long shown_position;
+	long due_position;
+
+	/* Last position given to the decoder, and the positions never shown between the frames drawn */
+	long decode_position;
+	long dropped;
+	double render_ms;
+
+	#ifdef THREADS
+	pthread_t decoder;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	int quit;
+	#endif
+} sequence_t;
+
+/* Mesh kept loaded by the server, valid while the file has the same time and size */
+typedef struct cached_mesh
+{
+	char path[SERVER_PATH];
+	long mtime;
+	long size;
+	mesh_t mesh;
+	unsigned long last_used;
+} cached_mesh_t;
+
+/* Client of the server and its own view */
+typedef struct session
+{
+	char path[SERVER_PATH];
+	float transform[4][4];
+	int ortho;
+	int do_light;
+	int depth_mode;
+	int width;
+	int height;
+	float ammount;
+
+	/* Last frame rendered */
+	char* frame;
+
+	/* Socket, its output and the request bytes read but not run yet */
+	int client;
+	FILE* output;
+	char input[SERVER_LINE];
+	int input_length;
+
+	/* Taken by a worker, and closed by the client */
+	int busy;
+	int closed;
+} session_t;
+
+/* Render server, the renderer state is global so the workers take turns on it */
+typedef struct server
+{
+	int socket;
+	int running;
+	int max_vertex;
+	cached_mesh_t cache[SERVER_CACHE];
+	int cache_count;
+	unsigned long tick;
+
+	/* Open sessions, watched for requests while no worker has them */
+	session_t* session[SERVER_SESSIONS];
+	int session_count;
+
+	/* Cache hits and misses, requests and their latency */
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long requests;
+	double total_ms;
+	double max_ms;
+
+	/* Sessions with a request waiting for a worker, the pipe a worker wakes the watcher with when it is done,
+	   the renderer lock and the one taken by a file load */
+	#ifdef THREADS
+	pthread_t worker[SERVER_WORKERS];
+	session_t* ready[SERVER_SESSIONS];
+	int ready_count;
+	int wake_pipe[2];
+	pthread_mutex_t queue_lock;
+	pthread_cond_t queue_wake;
+	pthread_mutex_t lock;
+	pthread_mutex_t load_lock;
+	#endif
+} server_t;
+
+/* Tile of a poster or a viewport, rastered on its own buffers and transformed vertex */
+typedef struct tile
+{
+	/* Image projected on, its screen rateo and the distance of the ortho view */
+	int image_width;
+	int image_height;
+	float rateo;
+	float ortho_distance;
+	const vertex_t* view;
+
+	/* Tile position and size in the image, and its buffers */
+	int x;
+	int y;
+	int width;
+	int height;
+	char* screen;
+	float* depth;
+
+	/* Tris binned on the tile, every tris when NULL */
+	const int* tris_list;
+	int tris_count;
+} tile_t;
+
+/* Offscreen poster, rendered a row of tiles at a time with the tris binned on the tiles once */
+typedef struct poster
+{
+	const mesh_t* mesh;
+	int width;
+	int height;
+	int tiles_x;
+	int tiles_y;
+
+	/* Tris of tile k are bin_tris[bin_start[k]] up to bin_tris[bin_start[k+1]] */
+	int* bin_start;
+	int* bin_tris;
+
+	/* Row of tiles in progress, its screen a tile after the other, the next tile to take and the tiles done */
+	int row;
+	char* row_screen;
+	int next_tile;
+	int tiles_done;
+
+	/* Workers live for the whole poster, woken on every row and waited by the main thread when it is done */
+	#ifdef THREADS
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	#endif
+} poster_t;
+
+/* Viewport of the split screen, its own view and buffers in a cell of the frame */
+typedef struct viewport
+{
+	float transform[4][4];
+	int ortho;
+	int level;
+
+	/* Position and size in the frame buffer */
+	int x;
+	int y;
+	int width;
+	int height;
+
+	/* Transformed vertex, screen and depth of the viewport alone */
+	vertex_t* view;
+	char* screen;
+	float* depth;
+} viewport_t;
+
+/* BVH build: box and centroid of every tris, and the nodes taken so far */
+typedef struct bvh_builder
+{
+	mesh_t* mesh;
+	vertex_t* box_min;
+	vertex_t* box_max;
+	vertex_t* centroid;
+	int node_count;
+
+	#ifdef THREADS
+	pthread_mutex_t lock;
+	#endif
+} bvh_builder_t;
+
+/* BVH subtree built on a thread */
+typedef struct bvh_task
+{
+	bvh_builder_t* builder;
+	int node;
+	int depth;
+} bvh_task_t;
+
+/* Raster kernel, one specialization for every mode combination */
+typedef void (*raster_kernel_t)(const mesh_t* mesh);
+
+/* Tile kernel, float depth and text output only */
+typedef void (*tile_kernel_t)(const mesh_t* mesh, const tile_t* tile);
+
 /* Function prototype */
 float normalized_angle(float x);
 float sine(float x);
 float cosine(float x);
-int parse_obj(char* path);
+#if defined(BENCHMARK) || defined(REALTIME)
+double clock_ms(void);
+#endif
+int parse_obj(char* path, mesh_t* mesh);
+int read_obj(mesh_reader_t* reader, mesh_t* mesh, int* vertex_capacity, int* tris_capacity);
+int open_reader(mesh_reader_t* reader, char* path);
+void close_reader(mesh_reader_t* reader);
+long read_block(mesh_reader_t* reader, char* data, long size);
+int next_block(mesh_reader_t* reader);
+int read_line(mesh_reader_t* reader, char** line_buffer, int* size);
+#ifdef THREADS
+void* reader_thread(void* arg);
+#endif
+int line_type(const char* line_buffer);
+void parse_vertex(const char* line_buffer, vertex_t* vertex);
+int parse_face(const char* line_buffer, int** face, int* capacity, int vertex_count);
+#ifdef BENCHMARK
+int parse_face_scanf(char* line_buffer, int* face, int max_count);
+int benchmark_parser(char* path);
+#endif
+int load_mesh(char* path, mesh_t* mesh);
+int generate_mesh(const char* kind, long tris, mesh_t* mesh);
+int grid_mesh(mesh_t* mesh, int columns, int rows);
+float value_noise(float x, float y);
+long parse_count(const char* text);
+char* map_file(char* path, unsigned long* size);
+void unmap_file(char* map, unsigned long size);
+int parse_ply(char* path, mesh_t* mesh);
+int ply_type(const char* name);
+int ply_read(ply_reader_t* reader, int type, double* value);
+int parse_stl(char* path, mesh_t* mesh, int binary);
+int weld_mesh(mesh_t* mesh, const vertex_t* corner, int tris_count);
+int validate_tris(mesh_t* mesh);
+void free_vertex(mesh_t* mesh);
+void free_mesh(mesh_t* mesh);
+void compute_bounds(mesh_t* mesh);
+void compact_mesh(mesh_t* mesh, int quantize);
+int simplify_mesh(const mesh_t* source, mesh_t* target, int grid);
+void build_lod_chain(void);
+int select_lod(void);
+int mesh_index(const mesh_t* mesh, int index);
+void mesh_vertex(const mesh_t* mesh, int index, vertex_t* vertex);
+unsigned long mesh_size(const mesh_t* mesh);
+int build_edges(mesh_t* mesh);
+void transform_vertices(const mesh_t* mesh, float matrix[4][4], vertex_t* view);
+int box_visible(const vertex_t* min, const vertex_t* max, float matrix[4][4], float margin);
+void view_depth_range(const mesh_t* mesh, float* near, float* far);
+void update_depth_range(const mesh_t* mesh);
+int to_fixed(float coordinate);
+unsigned long depth_size(void);
+float depth_step(void);
 void translate(float x, float y, float z);
 void update_transform(float update[3][3]);
 void scale(float x, float y, float z);
@@ -114,30 +879,317 @@ void rotate_z(float z);
 void clear_buffer(void);
 void restore_mesh(void);
 void render_to_buffer(void);
+void draw_mesh(const mesh_t* mesh);
+void resolve_visibility(const mesh_t* mesh);
+char shade_tris(const mesh_t* mesh, unsigned int tris);
+raster_kernel_t forward_kernel(int wide_index);
+int render_poster(char* path, int width, int height);
+int poster_box(int tris, int* box);
+int count_poster_bins(void);
+void bin_poster(int* range);
+void poster_tile(int tile_x, int row, float* depth);
+#ifdef THREADS
+void* poster_worker(void* arg);
+#endif
+void init_split(int count);
+void close_split(void);
+void layout_split(int width, int height);
+void render_split(void);
+void draw_viewport(viewport_t* viewport);
+#ifdef THREADS
+void* viewport_worker(void* arg);
+#endif
+void focus_viewport(int index);
+void use_viewport(const viewport_t* viewport);
+void keep_viewport(viewport_t* viewport);
+int build_bvh(mesh_t* mesh);
+void split_bvh(bvh_builder_t* builder, int node_index, int depth);
+void* bvh_worker(void* arg);
+int intersect_bvh(const mesh_t* mesh, const vertex_t* origin, const vertex_t* direction, float near, float* distance);
+int ray_box(const vertex_t* origin, const vertex_t* inverse, const bvh_node_t* node, float near, float far, float* enter);
+float ray_tris(const vertex_t* origin, const vertex_t* direction, const vertex_t* corner);
+int pick_cell(int col, int row);
+int invert_view(float matrix[4][4], float inverse[3][3]);
+void fit_view(void);
+void view_bounds(mesh_t* mesh, float matrix[4][4], vertex_t* min, vertex_t* max);
+void transform_point(float matrix[4][4], const vertex_t* point, vertex_t* view);
+void grow_box(vertex_t* min, vertex_t* max, const vertex_t* point);
+void merge_box(vertex_t* min, vertex_t* max, const vertex_t* other_min, const vertex_t* other_max);
+float box_area(const vertex_t* min, const vertex_t* max);
+float axis_value(const vertex_t* vertex, int axis);
+void build_glyph_table(void);
+void build_ansi_table(void);
+unsigned long encode_ansi(void);
+void write_cell(int col, int row, FILE* output);
+void draw_wireframe(const mesh_t* mesh);
+int front_face(const mesh_t* mesh, int tris);
+void draw_edge(const vertex_t* from, const vertex_t* to, int depth_test);
+#ifdef BENCHMARK
+void benchmark_raster(void);
+int benchmark_suite(const char* kind, long tris);
+double time_stage(int stage, const mesh_t* mesh, FILE* output, int runs, int batches);
+void bench_step(int stage, const mesh_t* mesh, FILE* output);
+int check_frames(char* golden_path, int update);
+void check_view(int view);
+int check_timing(char* baseline_path, int update);
+#ifdef POSIX
+double benchmark_parse(const mesh_t* mesh);
+#endif
+#endif
+int load_scene(char* path, int quantize);
+int compare_instance(const void* first, const void* second);
+void instance_matrix(float matrix[4][4], const float* value);
+void free_scene(void);
+void render_scene(void);
 void clear_screen(void);
 void draw_screen(void);
 void show_help(void);
-void create_buffer(int width, int height);
+char screen_cell(int col, int row);
+int create_buffer(int width, int height);
+unsigned long arena_align(unsigned long size);
+int arena_reserve(arena_t* arena, unsigned long size);
+void* arena_alloc(arena_t* arena, unsigned long size);
+void arena_free(arena_t* arena);
 void loop_input(void);
+int run_command(const char* command, float* ammount);
+int run_script(char* path);
+void fold_transform(float view[4][4]);
+void write_screen(FILE* output);
+#ifdef REALTIME
+void advance_frame(void);
+int animating(void);
+void adapt_resolution(double render_ms);
+#endif
+#ifdef POSIX
+int convert_obj(char* path, char* out_path);
+int centroid_cell(const vertex_t* vertex_map, const int* tris, const vertex_t* min, float cell_size, int grid);
+void add_chunk_tris(chunk_builder_t* builder, const vertex_t* vertex_map, const int* tris);
+void flush_chunk(chunk_builder_t* builder);
+int open_stream(char* path, unsigned long budget);
+void close_stream(void);
+int load_chunk(chunk_t* chunk);
+unsigned long chunk_size(const chunk_info_t* info);
+int evict_chunk(unsigned long size);
+void render_stream(void);
+int open_sequence(char* pattern, float fps);
+void close_sequence(void);
+void decode_frame(sequence_slot_t* slot);
+sequence_slot_t* next_slot(void);
+void render_sequence(void);
+int serve(char* socket_path);
+#ifdef THREADS
+void* server_worker(void* arg);
+#endif
+void open_session(int client);
+void close_session(session_t* session);
+void serve_requests(session_t* session);
+void serve_request(session_t* session, char* line);
+void lock_server(void);
+void unlock_server(void);
+int use_session(const session_t* session);
+void keep_session(session_t* session);
+int cache_slot(const char* path);
+int find_mesh(const char* path);
+int render_session(session_t* session, const mesh_t* mesh);
+void write_frame(const session_t* session, FILE* output);
+#endif
+#ifdef THREADS
+void* stream_loader(void* arg);
+void* sequence_decoder(void* arg);
+#endif
 
-/* Vertex stuct */
-typedef struct vertex 
-{
-	float x;
-	float y;
-	float z;
-} vertex_t;
+/* Level of detail chain, level 0 is the loaded mesh */
+static mesh_t lod_chain[LOD_MAX];
+static int lod_count = 0;
+
+/* Level used in the last frame, and the pinned one or -1 for automatic */
+static int lod_active = 0;
+static int lod_pin = -1;
+
+/* Mesh vertex after the transform, filled once per frame */
+static vertex_t* view_buffer = NULL;
+
+/* Instanced scene, used when instance_count is not zero */
+static scene_t scene;
+
+/* Streamed mesh, used when chunk is not NULL */
+#ifdef POSIX
+static stream_t stream;
+#endif
+
+/* Mesh sequence, used when frame_count is not zero */
+#ifdef POSIX
+static sequence_t sequence;
+#endif
 
-/* Tris and vertex buffer */
-static int tris_count = 0;
-static int *tris_buffer = NULL;
-static vertex_t* vertex_buffer = NULL;
+/* Render server, used when running */
+#ifdef POSIX
+static server_t server;
+#endif
+
+/* Offscreen poster, used while rendering one */
+static poster_t poster;
+
+/* Split screen viewports, used when split_count is not zero, and the one the input goes to */
+static viewport_t split_view[SPLIT_MAX];
+static int split_count = 0;
+static int split_focus = 0;
+
+/* Viewport workers, started with the split and woken on every frame, the frame asked and the viewports drawn */
+#ifdef THREADS
+static pthread_t split_thread[SPLIT_MAX];
+static pthread_mutex_t split_lock;
+static pthread_cond_t split_wake;
+static pthread_cond_t split_done;
+static int split_workers = 0;
+static int split_stop = 0;
+static unsigned long split_frame = 0;
+static int split_drawn = 0;
+#endif
+
+#ifdef BENCHMARK
+static double split_ms = 0;
+#endif
+
+/* Report of the last pick, and the view fitted on the mesh at every reset */
+static char pick_text[PICK_LINE];
+static int auto_fit = 0;
+
+#ifdef BENCHMARK
+static double bvh_ms = 0;
+#endif
+
+/* Target frame rate, the one measured over the last second, and turntable speed in degree per second */
+#ifdef REALTIME
+static float loop_fps = LOOP_FPS;
+static float measured_fps = 0;
+static float turntable = 0;
+
+/* Start of the last frame, and of the second the frame rate is measured on */
+static double frame_start = 0;
+static double rate_start = 0;
+static int rate_frames = 0;
+
+/* Render time budget, 0 for always full resolution */
+static float frame_budget = 0;
+
+/* Render resolution levels, the one in use, and the render time of the frames seen at it */
+static const float resolution_scale[RESOLUTION_LEVELS] = {1, 0.8f, 0.64f, 0.5f, 0.4f, 0.32f, 0.25f};
+static int resolution_level = 0;
+static double resolution_ms = 0;
+static int resolution_frames = 0;
+
+/* Render time ratio of each level to the next lower one, measured on a step down, and the time before it */
+static double level_gain[RESOLUTION_LEVELS];
+static double step_ms = 0;
+#endif
+
+/* Arena holding view, screen and depth buffer */
+static arena_t render_arena;
+
+/* Arena holding the tile buffers and the bins of a poster, kept from a poster to the next */
+static arena_t poster_arena;
 
 /* Screen and depth buffer */
 static int buffer_width = 0;
 static int buffer_height = 0;
+
+/* Screen size the buffer is shown at */
+static int output_width = 0;
+static int output_height = 0;
 static char *screen_buffer = NULL;
 static float *depth_buffer = NULL;
+static unsigned short *depth_buffer16 = NULL;
+
+/* Visibility buffer: the tris seen in every cell, shaded once after the raster */
+static int deferred = 0;
+static unsigned int *id_buffer = NULL;
+
+#ifdef BENCHMARK
+static double resolve_ms = 0;
+static int resolved_cells = 0;
+#endif
+
+/* Output glyph mode, samples per cell as shifts and the packed coverage of the samples, a byte per cell */
+static int glyph_mode = GLYPH_TEXT;
+static const int glyph_shift_x[GLYPH_MODE_COUNT] = {0, 0, 1};
+static const int glyph_shift_y[GLYPH_MODE_COUNT] = {0, 1, 2};
+static unsigned char *coverage_buffer = NULL;
+
+/* UTF-8 glyph of every coverage mask, in each mode */
+static char glyph_table[GLYPH_MODE_COUNT][256][4];
+
+#ifdef BENCHMARK
+static const char* const glyph_mode_name[] = {"text", "half block", "braille"};
+#endif
+
+/* Benchmark suite viewports and stage names */
+#ifdef BENCHMARK
+static const int bench_size[BENCH_SIZES][2] = {{80, 24}, {160, 48}, {320, 96}, {640, 192}};
+static const char* const bench_stage_name[BENCH_STAGES] = {"transform", "clip", "raster", "clear", "present"};
+#endif
+
+/* Golden frame check viewports, and views as x and y turn in degree and z move */
+#ifdef BENCHMARK
+static const int check_size[CHECK_SIZES][2] = {{40, 12}, {80, 24}, {120, 36}};
+static const float check_turn[CHECK_VIEWS][3] = {{0, 0, 0}, {30, 45, 0}, {-20, 160, -2}};
+#endif
+
+/* ANSI color mode, the SGR of every color in each mode and the color of every cell char */
+static int ansi_mode = ANSI_OFF;
+static char ansi_sgr[ANSI_MODE_COUNT][ANSI_COLORS][ANSI_SGR_MAX];
+static int ansi_length[ANSI_MODE_COUNT][ANSI_COLORS];
+static unsigned char ansi_color[256];
+
+/* Encoded frame, sized for a SGR on every cell */
+static char* ansi_buffer = NULL;
+
+/* Light, shadow and material colors, far apart in hue */
+static const unsigned char ansi_rgb[ANSI_COLORS][3] = 
+{
+	{0, 0, 0}, {240, 220, 160}, {60, 60, 100},
+	{230, 25, 75}, {60, 180, 75}, {255, 225, 25}, {0, 130, 200},
+	{245, 130, 48}, {145, 30, 180}, {70, 240, 240}, {240, 50, 230},
+	{210, 245, 60}, {250, 190, 212}, {0, 128, 128}, {220, 190, 255},
+	{170, 110, 40}, {255, 250, 200}, {128, 0, 0}, {170, 255, 195}
+};
+
+/* Encoder stats, shown by the CLI only as ncurses draws its own colors */
+#ifdef BENCHMARK
+#ifndef NCURSES
+static const char* const ansi_mode_name[] = {"off", "256", "truecolor"};
+#endif
+static unsigned long ansi_bytes = 0;
+static double ansi_ms = 0;
+#endif
+
+/* Wireframe mode, edges drawn in the last frame */
+static int wire_mode = WIRE_OFF;
+
+#ifdef BENCHMARK
+static const char* const wire_mode_name[] = {"off", "edges", "hidden", "silhouette"};
+static int wire_drawn = 0;
+#endif
+
+/* Depth format in use, and the 1/z to [0, 1] mapping of the mesh range, used by the 16 bit format */
+static int depth_mode = DEPTH_FLOAT;
+static float depth_scale = 1;
+static float depth_bias = 0;
+
+#ifdef BENCHMARK
+static const char* const depth_mode_name[] = {"float", "16 bit"};
+#endif
+
+/* Time and decompressed size of the mesh load */
+#ifdef BENCHMARK
+static double load_ms = 0;
+static unsigned long long load_bytes = 0;
+#endif
+
+/* PLY type names, both the old and the sized spelling */
+static const char* const ply_type_name[] = {"char", "uchar", "short", "ushort", "int", "uint", "float", "double",
+	"int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64"};
+static const int ply_type_size[] = {1, 1, 2, 2, 4, 4, 4, 8};
 
 /* Screen rateo based on screen height, width and font rateo */
 static float screen_rateo;
@@ -257,1158 +1309,8816 @@ float cosine(float x)
 	}
 }
 
-/* Read the mesh file */
-int parse_obj(char* path) 
+#if defined(BENCHMARK) || defined(REALTIME)
+/* Wall clock in ms */
+double clock_ms()
 {
-	static unsigned int vertex_count = 0;
-	char line_buffer[1024];
-	FILE* mesh_file = fopen(path, "r");
+	struct timeval now;
+	gettimeofday(&now, NULL);
+
+	return (double)now.tv_sec*1000 + (double)now.tv_usec/1000;
+}
+#endif
+
+/* Read the mesh file, in a single pass so a compressed file is decompressed once */
+int parse_obj(char* path, mesh_t* mesh) 
+{
+	int vertex_capacity = 0;
+	int tris_capacity = 0;
+	int result;
+	mesh_t read;
+	mesh_reader_t reader;
 
 	/* Check the read to be succefull */
-	if (mesh_file == NULL)
+	if (open_reader(&reader, path))
 	{
 		printf("Error reading file %s\n", path);
 		return 1;
-	}	
+	}
 
-	/* Cycle the file once to get the vertex and tris count */
-	while(fgets(line_buffer, 1024, mesh_file)) 
-	{
-		/* Count vertex */
-		if (line_buffer[0] == 'v' && line_buffer[1] == ' ') 
-			vertex_count++;
-		
-		/* Count tris */
-		else if (line_buffer[0] == 'f' && line_buffer[1] == ' ')
-		{
-			int test_vertex;
+	/* Buffers start empty and grow as needed */
+	memset(&read, 0, sizeof(mesh_t));
+	result = read_obj(&reader, &read, &vertex_capacity, &tris_capacity);
 
-			/* Parse the first tris */
-			sscanf(line_buffer, "%*s %*s %*s %*s %[^\n]", line_buffer);
+	/* Close the file */
+	#ifdef BENCHMARK
+	load_bytes = reader.total;
+	#endif
+	close_reader(&reader);
 
-			/* Increase tris count */
-			tris_count++;
-			
-			/* Parse other tris if the face have more vertex */
-			while (sscanf(line_buffer, "%d/", &test_vertex) == 1)
-			{
-				/* Increase tris count */
-				tris_count++;
+	/* Free previous tris and vertex, store in the mesh */
+	free_mesh(mesh);
+	*mesh = read;
 
-				/* Remove already parsed face and keep looping if other are present */
-				if (sscanf(line_buffer, "%*s %[^\n]", line_buffer) != 1)
-					break;
-			}
-		}
-	}
+	/* Drop the tris with indices out of the file, the renderer does not check them */
+	result |= validate_tris(mesh);
 
 	/* Check vertex and tris count */
-	if (vertex_count == 0 || tris_count == 0)
+	if (result)
 	{
 		printf("Corrupted file %s\n", path);
+		free_mesh(mesh);
 		return 1;
 	}
 
-	/* Free previous tris and vertex */
-	free(tris_buffer);
-	free(vertex_buffer);
+	/* Trim the buffers */
+	mesh->vertex_buffer = (vertex_t*) realloc(mesh->vertex_buffer, mesh->vertex_count * sizeof(vertex_t));
+	mesh->tris_buffer = (int*) realloc(mesh->tris_buffer, mesh->tris_count * sizeof(int) * 3);
+	mesh->tris_line = (int*) realloc(mesh->tris_line, mesh->tris_count * sizeof(int));
+
+	return 0;
+}
+
+/* Read an OBJ in the mesh buffers, reused up to the capacity and grown past it */
+int read_obj(mesh_reader_t* reader, mesh_t* mesh, int* vertex_capacity, int* tris_capacity)
+{
+	int line_size = LINE_SIZE;
+	int face_capacity = FACE_SIZE;
+	char* line_buffer;
+	int* face;
 
-	/* Alloc the memory */
-	vertex_buffer = (vertex_t*) malloc(vertex_count * sizeof(vertex_t));
-	tris_buffer = (int*) malloc(tris_count * sizeof(int) * 3);
+	mesh->vertex_count = 0;
+	mesh->tris_count = 0;
 
-	/* Reset the counter and rewind the file */
-	vertex_count = 0;
-	tris_count = 0;
-	rewind(mesh_file);
+	line_buffer = (char*) malloc(line_size);
+	face = (int*) malloc(face_capacity * sizeof(int));
 
-	/* Cycle again, reading the data */
-	while(fgets(line_buffer, 1024, mesh_file)) 
+	while (read_line(reader, &line_buffer, &line_size)) 
 	{
+		int type = line_type(line_buffer);
+
 		/* Read vertex data */
-		if (line_buffer[0] == 'v' && line_buffer[1] == ' ') 
+		if (type == 'v') 
 		{
-			sscanf(line_buffer, "%*s %f %f %f", 
-				&vertex_buffer[vertex_count].x, 
-				&vertex_buffer[vertex_count].y, 
-				&vertex_buffer[vertex_count].z);
+			if (mesh->vertex_count == *vertex_capacity)
+			{
+				*vertex_capacity = *vertex_capacity ? *vertex_capacity * 2 : 1024;
+				mesh->vertex_buffer = (vertex_t*) realloc(mesh->vertex_buffer, *vertex_capacity * sizeof(vertex_t));
+			}
 
-			vertex_count++;
+			parse_vertex(line_buffer, &mesh->vertex_buffer[mesh->vertex_count]);
+			mesh->vertex_count++;
 		}
 
-		/* Read face data */
-		else if (line_buffer[0] == 'f' && line_buffer[1] == ' ') 
+		/* Read face data, a face with N vertex is split in N-2 tris */
+		else if (type == 'f') 
 		{
-			/* Parse the first tris */
-			int vertex0, vertex1, vertex2;
-			sscanf(line_buffer, "%*s %d/%*s %d/%*s %d/%*s %[^\n]",
-				&vertex0, &vertex1, &vertex2, line_buffer);
+			int vertex, count = parse_face(line_buffer, &face, &face_capacity, mesh->vertex_count);
 
-			/* Bind the vertex */
-			tris_buffer[tris_count*3+0] = vertex0-1;
-			tris_buffer[tris_count*3+1] = vertex1-1;
-			tris_buffer[tris_count*3+2] = vertex2-1;
-
-			/* Increase tris count */
-			tris_count++;
-			
-			/* Parse other tris if the face have more vertex */
-			while (sscanf(line_buffer, "%d/", &vertex1) == 1)
+			/* Bind the vertex0, the last and the new vertex as a tris, keeping the winding of the face */
+			for (vertex = 2; vertex < count; vertex++)
 			{
-				/* Bind the vertex0, the new vertex and the last as a tris */
-				tris_buffer[tris_count*3+0] = vertex0-1;
-				tris_buffer[tris_count*3+1] = vertex1-1;
-				tris_buffer[tris_count*3+2] = vertex2-1;
+				int* tris;
 
-				/* Set vertex2 as our new last vertex */
-				vertex2 = vertex1;			
-				
-				/* Increase tris count */
-				tris_count++;
+				if (mesh->tris_count == *tris_capacity)
+				{
+					*tris_capacity = *tris_capacity ? *tris_capacity * 2 : 1024;
+					mesh->tris_buffer = (int*) realloc(mesh->tris_buffer, *tris_capacity * sizeof(int) * 3);
+					mesh->tris_line = (int*) realloc(mesh->tris_line, *tris_capacity * sizeof(int));
+				}
 
-				/* Remove already parsed face and keep looping if other are present */
-				if (sscanf(line_buffer, "%*s %[^\n]", line_buffer) != 1)
-					break;
+				tris = &mesh->tris_buffer[mesh->tris_count*3];
+				tris[0] = face[0];
+				tris[1] = face[vertex-1];
+				tris[2] = face[vertex];
+				mesh->tris_line[mesh->tris_count] = reader->line_number;
+
+				/* Increase tris count */
+				mesh->tris_count++;
 			}
 		}
 	}
 
-	/* Close the file */
-	fclose(mesh_file);
+	free(line_buffer);
+	free(face);
 
-	return 0;
+	return reader->error;
 }
 
-/* Translate the mesh */
-void translate(float x, float y, float z) 
+/* Open a plain or compressed file, the compressed ones are decompressed on a thread ahead of the parser */
+int open_reader(mesh_reader_t* reader, char* path)
 {
-	/* Add translation directly to the matrix */
-	transform[3][0] -= x;
-	transform[3][1] += y;
-	transform[3][2] += z;
+	unsigned char magic[4] = {0, 0, 0, 0};
+	int block;
 
-	return;
-}
+	memset(reader, 0, sizeof(mesh_reader_t));
+	reader->file = fopen(path, "rb");
 
-/* Update transform matrix for scale and rotation */
-void update_transform(float update[3][3])
-{
-	int row, col, dot_index;
+	if (reader->file == NULL)
+		return 1;
 
-	/* Copy old transform */
-	float copy[4][4];
-	for (row = 0; row < 4; row++)
+	/* Pick the codec by the magic */
+	if (fread(magic, 1, 4, reader->file) >= 2 && magic[0] == 0x1f && magic[1] == 0x8b)
+		reader->codec = CODEC_GZIP;
+	else if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd)
+		reader->codec = CODEC_ZSTD;
+
+	rewind(reader->file);
+
+	#ifdef ZLIB
+	if (reader->codec == CODEC_GZIP)
 	{
-		for (col = 0; col < 4; col++)
-		{
-			copy[col][row] = transform[col][row];
-		}
+		fclose(reader->file);
+		reader->file = NULL;
+		reader->gz_file = gzopen(path, "rb");
+
+		if (reader->gz_file == NULL)
+			return 1;
+
+		gzbuffer(reader->gz_file, READ_BLOCK);
 	}
+	#endif
 
-	/* Multiply the update * transform using the copy */
-	for (row = 0; row < 3; row++)
+	#ifdef ZSTD
+	if (reader->codec == CODEC_ZSTD)
 	{
-		for (col = 0; col < 3; col++)
-		{
-			transform[col][row] = 0;
+		reader->zstd = ZSTD_createDStream();
+		ZSTD_initDStream(reader->zstd);
+		reader->zstd_buffer = (char*) malloc(ZSTD_DStreamInSize());
+		reader->zstd_in.src = reader->zstd_buffer;
+	}
+	#endif
 
-			for (dot_index = 0; dot_index < 3; dot_index++)
-			{
-				transform[col][row] += update[dot_index][row]*copy[col][dot_index];
-			}
-		}
+	/* Codec not built in */
+	#ifndef ZLIB
+	if (reader->codec == CODEC_GZIP)
+	{
+		printf("Build with -DZLIB to read gzip files\n");
+		fclose(reader->file);
+		return 1;
+	}
+	#endif
+	#ifndef ZSTD
+	if (reader->codec == CODEC_ZSTD)
+	{
+		printf("Build with -DZSTD to read zstd files\n");
+		fclose(reader->file);
+		return 1;
 	}
+	#endif
 
-	return;
+	/* Plain files use a single block, read in place of the parser */
+	for (block = 0; block < (reader->codec == CODEC_NONE ? 1 : READ_BLOCKS); block++)
+		reader->block[block] = (char*) malloc(READ_BLOCK);
+
+	/* Start the decompressor */
+	#ifdef THREADS
+	if (reader->codec != CODEC_NONE)
+	{
+		reader->threaded = 1;
+		pthread_mutex_init(&reader->lock, NULL);
+		pthread_cond_init(&reader->ready, NULL);
+		pthread_create(&reader->thread, NULL, reader_thread, reader);
+	}
+	#endif
+
+	return 0;
 }
 
-/* Scale the mesh */
-void scale(float x, float y, float z)
+/* Stop the decompressor and close the file */
+void close_reader(mesh_reader_t* reader)
 {
-	int row, col;
-	float update_mat[3][3];
+	int block;
 
-	/* Create empty matrix */
-	for (row = 0; row < 3; row++)
+	#ifdef THREADS
+	if (reader->threaded)
 	{
-		for (col = 0; col < 3; col++)
-		{
-			update_mat[col][row] = 0;
-		}
+		/* Stop it even if the parser did not reach the end */
+		pthread_mutex_lock(&reader->lock);
+		reader->done = 1;
+		pthread_cond_broadcast(&reader->ready);
+		pthread_mutex_unlock(&reader->lock);
+
+		pthread_join(reader->thread, NULL);
+		pthread_mutex_destroy(&reader->lock);
+		pthread_cond_destroy(&reader->ready);
 	}
+	#endif
 
-	/* Add scale */
-	update_mat[0][0] = x;
-	update_mat[1][1] = y;
-	update_mat[2][2] = z;
+	#ifdef ZLIB
+	if (reader->gz_file != NULL)
+		gzclose(reader->gz_file);
+	#endif
 
-	/* Update global matrix */
-	update_transform(update_mat);
+	#ifdef ZSTD
+	ZSTD_freeDStream(reader->zstd);
+	free(reader->zstd_buffer);
+	#endif
+
+	if (reader->file != NULL)
+		fclose(reader->file);
+
+	for (block = 0; block < READ_BLOCKS; block++)
+		free(reader->block[block]);
 
 	return;
 }
 
-/* Rotate the mesh on X axis */
-void rotate_x(float x)
+/* Read and decompress the next bytes of the file, return 0 at the end and -1 on error */
+long read_block(mesh_reader_t* reader, char* data, long size)
 {
-	int row, col;
-	float sin_rot, cos_rot;
-	float update_mat[3][3];
+	#ifdef ZLIB
+	if (reader->codec == CODEC_GZIP)
+		return gzread(reader->gz_file, data, size);
+	#endif
 
-	/* Create empty matrix */
-	for (row = 0; row < 3; row++)
+	#ifdef ZSTD
+	if (reader->codec == CODEC_ZSTD)
 	{
-		for (col = 0; col < 3; col++)
+		ZSTD_outBuffer out;
+
+		out.dst = data;
+		out.size = size;
+		out.pos = 0;
+
+		/* Refill the input when all of it is consumed */
+		while (out.pos < out.size)
 		{
-			update_mat[col][row] = 0;
-		}
-	}
+			if (reader->zstd_in.pos == reader->zstd_in.size)
+			{
+				reader->zstd_in.size = fread(reader->zstd_buffer, 1, ZSTD_DStreamInSize(), reader->file);
+				reader->zstd_in.pos = 0;
 
-	/* Compute sine and cosine */
-	sin_rot = sine(x);
-	cos_rot = cosine(x);
+				if (reader->zstd_in.size == 0)
+					break;
+			}
 
-	/* Add rotation */
-	update_mat[1][1] = cos_rot;
-	update_mat[1][2] = sin_rot;
-	update_mat[2][2] = cos_rot;
-	update_mat[2][1] = -sin_rot;
-	update_mat[0][0] = 1.f;
+			if (ZSTD_isError(ZSTD_decompressStream(reader->zstd, &out, &reader->zstd_in)))
+				return -1;
+		}
 
-	/* Update global matrix */
-	update_transform(update_mat);
+		return out.pos;
+	}
+	#endif
 
-	return;
+	return fread(data, 1, size, reader->file);
 }
 
-/* Rotate the mesh on Y axis */
-void rotate_y(float y)
+#ifdef THREADS
+/* Decompressor, fill the free blocks of the ring until the end of the file */
+void* reader_thread(void* arg)
 {
-	int row, col;
-	float sin_rot, cos_rot;
-	float update_mat[3][3];
+	mesh_reader_t* reader = (mesh_reader_t*) arg;
 
-	/* Create empty matrix */
-	for (row = 0; row < 3; row++)
+	pthread_mutex_lock(&reader->lock);
+
+	while (!reader->done)
 	{
-		for (col = 0; col < 3; col++)
+		int block = reader->produced % READ_BLOCKS;
+		long size;
+
+		/* Ring full, wait for the parser */
+		if (reader->produced - reader->consumed == READ_BLOCKS)
 		{
-			update_mat[col][row] = 0;
+			pthread_cond_wait(&reader->ready, &reader->lock);
+			continue;
+		}
+
+		/* The block is free, fill it without the lock */
+		pthread_mutex_unlock(&reader->lock);
+		size = read_block(reader, reader->block[block], READ_BLOCK);
+		pthread_mutex_lock(&reader->lock);
+
+		if (size <= 0)
+		{
+			reader->error = size < 0;
+			reader->done = 1;
+		}
+		else
+		{
+			reader->block_size[block] = size;
+			reader->produced++;
 		}
+
+		pthread_cond_broadcast(&reader->ready);
 	}
-	
-	/* Compute sine and cosine */
-	sin_rot = sine(y);
-	cos_rot = cosine(y);
 
-	/* Add rotation */
-	update_mat[0][0] = cos_rot;
-	update_mat[2][0] = -sin_rot;
-	update_mat[0][2] = sin_rot;
-	update_mat[2][2] = cos_rot;
-	update_mat[1][1] = 1.f;
+	pthread_mutex_unlock(&reader->lock);
 
-	/* Update global matrix */
-	update_transform(update_mat);
+	return NULL;
+}
+#endif
 
-	return;
+/* Release the block in use and take the next one, return 0 at the end */
+int next_block(mesh_reader_t* reader)
+{
+	#ifdef THREADS
+	if (reader->threaded)
+	{
+		pthread_mutex_lock(&reader->lock);
+
+		if (reader->held)
+			reader->consumed++;
+
+		/* Wait the decompressor */
+		while (reader->produced == reader->consumed && !reader->done)
+			pthread_cond_wait(&reader->ready, &reader->lock);
+
+		reader->held = reader->produced != reader->consumed;
+
+		if (reader->held)
+		{
+			reader->cursor = reader->block[reader->consumed % READ_BLOCKS];
+			reader->left = reader->block_size[reader->consumed % READ_BLOCKS];
+		}
+
+		/* Free slot for the decompressor */
+		pthread_cond_broadcast(&reader->ready);
+		pthread_mutex_unlock(&reader->lock);
+	}
+	else
+	#endif
+	{
+		/* Read it here, a failed read leaves nothing to parse */
+		reader->left = reader->done ? 0 : read_block(reader, reader->block[0], READ_BLOCK);
+		reader->cursor = reader->block[0];
+		reader->error |= reader->left < 0;
+		reader->left = reader->left > 0 ? reader->left : 0;
+		reader->held = reader->left > 0;
+		reader->done = !reader->held;
+	}
+
+	if (reader->held)
+		reader->total += reader->left;
+
+	return reader->held;
 }
 
-/* Rotate the mesh on Z axis */
-void rotate_z(float z)
+/* Read a whole line growing the buffer, lines ending with a backslash are joined, return 0 at the end of the file */
+int read_line(mesh_reader_t* reader, char** line_buffer, int* size)
 {
-	int row, col;
-	float sin_rot, cos_rot;
-	float update_mat[3][3];
+	int length = 0;
 
-	/* Create empty matrix */
-	for (row = 0; row < 3; row++)
+	reader->line_number = reader->line_count+1;
+
+	while (1)
 	{
-		for (col = 0; col < 3; col++)
+		const char* end;
+		long count;
+
+		/* Room for one more char and the terminator */
+		if (length >= *size-1)
 		{
-			update_mat[col][row] = 0;
+			*size *= 2;
+			*line_buffer = (char*) realloc(*line_buffer, *size);
 		}
-	}
 
-	/* Compute sine and cosine */
-	sin_rot = sine(-z);
-	cos_rot = cosine(-z);
+		/* Block used up */
+		if (reader->left == 0 && !next_block(reader))
+			break;
 
-	/* Add rotation */
-	update_mat[0][0] = cos_rot;
-	update_mat[0][1] = sin_rot;
-	update_mat[1][0] = -sin_rot;
-	update_mat[1][1] = cos_rot;
-	update_mat[2][2] = 1.f;
+		/* Copy up to the new line, or to the end of the block */
+		count = (reader->left < *size-1-length) ? reader->left : *size-1-length;
+		end = (const char*) memchr(reader->cursor, '\n', count);
 
-	/* Update global matrix */
-	update_transform(update_mat);
+		if (end != NULL)
+			count = end - reader->cursor + 1;
 
-	return;
-}
+		memcpy(*line_buffer + length, reader->cursor, count);
+		length += count;
+		reader->cursor += count;
+		reader->left -= count;
 
-/* Clear the screen and depth buffer */
-void clear_buffer()
-{
-	int row, col;
-	for (row = 0; row < buffer_height; row++)
-	{	
-		for (col = 0; col < buffer_width; col++)
+		if (end != NULL)
 		{
-			screen_buffer[col+row*buffer_width] = ' ';
-			depth_buffer[col+row*buffer_width] = 0;
+			int last = length-2;
+
+			reader->line_count++;
+
+			/* Continuation, the backslash and the new line become a blank */
+			if (last >= 0 && (*line_buffer)[last] == '\r')
+				last--;
+
+			if (last < 0 || (*line_buffer)[last] != '\\')
+				break;
+
+			(*line_buffer)[last] = ' ';
+			length = last+1;
 		}
 	}
 
-	return;
+	(*line_buffer)[length] = '\0';
+
+	return length > 0;
 }
 
-/* Restore position */
-void restore_mesh()
+/* Type of an OBJ line, 'v' for vertex, 'f' for face, 0 for anything else */
+int line_type(const char* line_buffer)
 {
-	int row, col;
-	
-	/* Restore identity matrix */
-	for (col = 0; col < 4; col++)
-	{
-		for (row = 0; row < 4; row++)
-		{
-			if (col == row)
-				transform[col][row] = 1;
-			else
-				transform[col][row] = 0;
-		}
-	}
+	while (*line_buffer == ' ' || *line_buffer == '\t')
+		line_buffer++;
 
-	/* Translate and rotate for initial view */
-	translate(0, 0, START_Z);
-	rotate_y(PI);
+	if ((line_buffer[0] == 'v' || line_buffer[0] == 'f') && (line_buffer[1] == ' ' || line_buffer[1] == '\t'))
+		return line_buffer[0];
 
-	return;
+	return 0;
 }
 
-/* Render to screen buffer */
-void render_to_buffer()
+/* Parse the position of a vertex line, missing values are zero */
+void parse_vertex(const char* line_buffer, vertex_t* vertex)
 {
-	int tris, vertex;
-	int x, y;
-	unsigned int material_index = 0;
+	char* end;
 
-	/* Used for near plane culling when we split a tris in 2 */
-	int last_half_rendered = 0;
+	/* Skip the keyword */
+	line_buffer = strchr(line_buffer, 'v') + 1;
 
-	/* Clear before start */
-	clear_buffer();
+	vertex->x = strtof(line_buffer, &end);
+	vertex->y = strtof(end, &end);
+	vertex->z = strtof(end, &end);
+
+	return;
+}
 
-	for (tris = 0; tris < tris_count; tris++) 
+/* Parse the vertex indices of a face line as 0 based, growing the face buffer, return how many are found */
+int parse_face(const char* line_buffer, int** face, int* capacity, int vertex_count)
+{
+	int count = 0;
+
+	/* Skip the keyword */
+	line_buffer = strchr(line_buffer, 'f') + 1;
+
+	/* Every token is v, v/vt, v//vn or v/vt/vn, up to the end of the line or a comment */
+	while (1)
 	{
-		/* Barycentric coordinate determinant */
-		float determinant;
+		long index = 0;
+		int negative = 0;
+		int digits = 0;
 
-		/* Get the bounding coordinate of the tris */
-		int min_x = buffer_width-1;
-		int min_y = buffer_height-1;
-		int max_x = 0;
-		int max_y = 0;
-		int behind_near = 0;
+		while (*line_buffer == ' ' || *line_buffer == '\t' || *line_buffer == '\r')
+			line_buffer++;
 
-		/* Transformed vertex */
-		vertex_t vertex_arr[3];
+		if (*line_buffer == '-' || *line_buffer == '+')
+			negative = *line_buffer++ == '-';
 
-		/* Face normal and lighting */
-		vertex_t normal, edge0, edge1;
-		float normal_mag, light;
-	
-		/* Render the tris with another material */
-		material_index++;
+		for (; *line_buffer >= '0' && *line_buffer <= '9'; line_buffer++, digits++)
+			index = (index < 100000000) ? index*10 + (*line_buffer - '0') : 1000000000;
 
-		/* Return to 0 if last element is reached */
-		if (material_index == sizeof(material_array)/sizeof(material_array[0]))
-			material_index = 0;
+		if (digits == 0)
+			break;
 
-		for (vertex = 0; vertex < 3; vertex++)
+		/* Skip the texture and normal indices */
+		while (*line_buffer != '\0' && *line_buffer != ' ' && *line_buffer != '\t' && 
+			*line_buffer != '\r' && *line_buffer != '\n')
+			line_buffer++;
+
+		if (count == *capacity)
 		{
-			/* Multiply with transform matrix */
-			vertex_arr[vertex].x = transform[0][0]*vertex_buffer[tris_buffer[tris*3+vertex]].x+
-					transform[1][0]*vertex_buffer[tris_buffer[tris*3+vertex]].y+
-					transform[2][0]*vertex_buffer[tris_buffer[tris*3+vertex]].z+
-					transform[3][0];
+			*capacity *= 2;
+			*face = (int*) realloc(*face, *capacity * sizeof(int));
+		}
 
-			vertex_arr[vertex].y = transform[0][1]*vertex_buffer[tris_buffer[tris*3+vertex]].x+
-					transform[1][1]*vertex_buffer[tris_buffer[tris*3+vertex]].y+
-					transform[2][1]*vertex_buffer[tris_buffer[tris*3+vertex]].z+
-					transform[3][1];
+		/* Negative indices count back from the last vertex read */
+		(*face)[count++] = negative ? vertex_count - (int)index : (int)index - 1;
+	}
 
-			vertex_arr[vertex].z = transform[0][2]*vertex_buffer[tris_buffer[tris*3+vertex]].x+
-					transform[1][2]*vertex_buffer[tris_buffer[tris*3+vertex]].y+
-					transform[2][2]*vertex_buffer[tris_buffer[tris*3+vertex]].z+
-					transform[3][2];
+	return count;
+}
 
-			/* Count vertex behind near plane */
-			if (vertex_arr[vertex].z < NEAR_PLANE)
-				behind_near++;
+#ifdef BENCHMARK
+/* Previous sscanf face parser, the baseline of the parser benchmark */
+int parse_face_scanf(char* line_buffer, int* face, int max_count)
+{
+	int count = 3;
+
+	/* Parse the first tris */
+	if (sscanf(line_buffer, "%*s %d/%*s %d/%*s %d/%*s %[^\n]", &face[0], &face[1], &face[2], line_buffer) < 3)
+		return 0;
+
+	/* Parse other vertex if the face have more */
+	while (count < max_count && sscanf(line_buffer, "%d/", &face[count]) == 1)
+	{
+		count++;
+
+		/* Remove already parsed vertex and keep looping if other are present */
+		if (sscanf(line_buffer, "%*s %[^\n]", line_buffer) != 1)
+			break;
+	}
+
+	return count;
+}
+
+/* Tokenize the lines of a mesh with the current and the previous parser, print the throughput of both */
+int benchmark_parser(char* path)
+{
+	char line_buffer[1024];
+	char* text = NULL;
+	long text_size = 0;
+	long text_capacity = 0;
+	int face_capacity = FACE_SIZE;
+	int* face = (int*) malloc(face_capacity * sizeof(int));
+	int old_face[FACE_MAX];
+	double best[2] = {0, 0};
+	long checksum[2] = {0, 0};
+	int run, parser;
+	mesh_reader_t reader;
+
+	/* Decompress the whole file first, only the tokenizing is timed */
+	if (open_reader(&reader, path))
+	{
+		printf("Error reading file %s\n", path);
+		return 1;
+	}
+
+	while (next_block(&reader))
+	{
+		if (text_size + reader.left > text_capacity)
+		{
+			text_capacity = (text_size + reader.left)*2;
+			text = (char*) realloc(text, text_capacity);
 		}
 
-		/* Near plane clipping nad culling */
-		if (behind_near > 0)
+		memcpy(text + text_size, reader.cursor, reader.left);
+		text_size += reader.left;
+		reader.left = 0;
+	}
+
+	close_reader(&reader);
+
+	/* Best of 5 runs for each parser */
+	for (run = 0; run < 5; run++)
+	{
+		for (parser = 0; parser < 2; parser++)
 		{
-			/* If all vertex are behind */
-			if (behind_near == 3)
-			{
-				/* Skip the tris */
-				continue;
-			}
+			const char* line = text;
+			int vertex_count = 0;
+			double start = clock_ms();
 
-			/* If we have 1 or 2 vertex behind */
-			else
-			{
-				/* Find the 2 point of intersection with the near plane */
-				vertex_t intersect[2];
-				int id[3];
+			checksum[parser] = 0;
 
-				/* Set id[0] as id of the one on the different side */
-				if ((vertex_arr[0].z >= NEAR_PLANE && behind_near == 2) ||
-					(vertex_arr[0].z < NEAR_PLANE && behind_near == 1))
+			while (line < text + text_size)
+			{
+				const char* end = (const char*) memchr(line, '\n', text + text_size - line);
+				long length = (end ? end : text + text_size) - line;
+				int vertex, count;
+
+				/* Same line copy for both */
+				length = length < 1023 ? length : 1023;
+				memcpy(line_buffer, line, length);
+				line_buffer[length] = '\0';
+				line = end ? end+1 : text + text_size;
+
+				/* Current parser */
+				if (parser == 0)
 				{
-					id[0] = 0;
-					id[1] = 1;
-					id[2] = 2;
+					int type = line_type(line_buffer);
+
+					if (type == 'v')
+					{
+						vertex_t position;
+
+						parse_vertex(line_buffer, &position);
+						checksum[0] += (long)position.x;
+						vertex_count++;
+					}
+					else if (type == 'f')
+					{
+						count = parse_face(line_buffer, &face, &face_capacity, vertex_count);
+
+						for (vertex = 0; vertex < count; vertex++)
+							checksum[0] += face[vertex]+1;
+					}
 				}
-				else if ((vertex_arr[1].z >= NEAR_PLANE && behind_near == 2) ||
-					(vertex_arr[1].z < NEAR_PLANE && behind_near == 1))
+
+				/* Previous parser */
+				else if (line_buffer[0] == 'v' && line_buffer[1] == ' ')
 				{
-					id[0] = 1;
-					id[1] = 0;
-					id[2] = 2;
+					vertex_t position;
+
+					sscanf(line_buffer, "%*s %f %f %f", &position.x, &position.y, &position.z);
+					checksum[1] += (long)position.x;
 				}
-				else
+				else if (line_buffer[0] == 'f' && line_buffer[1] == ' ')
 				{
-					id[0] = 2;
-					id[1] = 0;
-					id[2] = 1;
+					count = parse_face_scanf(line_buffer, old_face, FACE_MAX);
+
+					for (vertex = 0; vertex < count; vertex++)
+						checksum[1] += old_face[vertex];
 				}
+			}
 
-				/* Calculate the intersection point, check alignment first */
-				intersect[0].x = (vertex_arr[id[0]].x == vertex_arr[id[1]].x) ? vertex_arr[id[0]].x :
-						vertex_arr[id[0]].x + (NEAR_PLANE-vertex_arr[id[0]].z)*
-						(vertex_arr[id[0]].x-vertex_arr[id[1]].x)/(vertex_arr[id[0]].z-vertex_arr[id[1]].z);
+			start = clock_ms() - start;
 
-				intersect[0].y = (vertex_arr[id[0]].y == vertex_arr[id[1]].y) ? vertex_arr[id[0]].y :
-						vertex_arr[id[0]].y + (NEAR_PLANE-vertex_arr[id[0]].z)*
-						(vertex_arr[id[0]].y-vertex_arr[id[1]].y)/(vertex_arr[id[0]].z-vertex_arr[id[1]].z);
-				
-				intersect[1].x = (vertex_arr[id[0]].x == vertex_arr[id[2]].x) ? vertex_arr[id[0]].x :
-						vertex_arr[id[0]].x + (NEAR_PLANE-vertex_arr[id[0]].z)*
-						(vertex_arr[id[0]].x-vertex_arr[id[2]].x)/(vertex_arr[id[0]].z-vertex_arr[id[2]].z);
+			if (run == 0 || start < best[parser])
+				best[parser] = start;
+		}
+	}
 
-				intersect[1].y = (vertex_arr[id[0]].y == vertex_arr[id[2]].y) ? vertex_arr[id[0]].y :
-						vertex_arr[id[0]].y + (NEAR_PLANE-vertex_arr[id[0]].z)*
-						(vertex_arr[id[0]].y-vertex_arr[id[2]].y)/(vertex_arr[id[0]].z-vertex_arr[id[2]].z);
-				
-				/* Create new tris */
-				if (behind_near == 2)
-				{
-					/* The vertex in front is kept, the other 2 become the intersect */
-					vertex_arr[0].x = vertex_arr[id[0]].x;
-					vertex_arr[0].y = vertex_arr[id[0]].y;
-					vertex_arr[0].z = vertex_arr[id[0]].z;
+	printf("Parser: %.1f MB/s, previous sscanf parser: %.1f MB/s, speedup %.2fx, checksum %s\n",
+		text_size/1048576.0/(best[0]/1000), text_size/1048576.0/(best[1]/1000), best[1]/best[0],
+		checksum[0] == checksum[1] ? "match" : "differ");
 
-					vertex_arr[1].x = intersect[0].x;
-					vertex_arr[1].y = intersect[0].y;
-					vertex_arr[1].z = NEAR_PLANE;
+	free(text);
+	free(face);
 
-					vertex_arr[2].x = intersect[1].x;
-					vertex_arr[2].y = intersect[1].y;
-					vertex_arr[2].z = NEAR_PLANE;
-				}
-				else
-				{
-					/* If we have 2 vertex in front we need to create 2 tris */
-					last_half_rendered = !last_half_rendered;
+	return 0;
+}
 
-					/* Check with tris we rendered last time */
-					if (last_half_rendered)
-					{
-						/* Create the first tris */
-						vertex_t tmp;
+/* Time a turn of the mesh in every output mode, in samples rastered per second */
+void benchmark_raster()
+{
+	int mode, frame;
 
-						tmp.x = vertex_arr[id[1]].x;
-						tmp.y = vertex_arr[id[1]].y;
-						tmp.z = vertex_arr[id[1]].z;
+	for (mode = 0; mode < GLYPH_MODE_COUNT; mode++)
+	{
+		double start;
 
-						vertex_arr[2].x = vertex_arr[id[2]].x;
-						vertex_arr[2].y = vertex_arr[id[2]].y;
-						vertex_arr[2].z = vertex_arr[id[2]].z;
-	
-						vertex_arr[1].x = tmp.x;
-						vertex_arr[1].y = tmp.y;
-						vertex_arr[1].z = tmp.z;
+		glyph_mode = mode;
+		restore_mesh();
+		create_buffer(SCRIPT_WIDTH, SCRIPT_HEIGHT);
 
-						vertex_arr[0].x = intersect[0].x;
-						vertex_arr[0].y = intersect[0].y;
-						vertex_arr[0].z = NEAR_PLANE;
+		start = clock_ms();
 
-						/* Decrease tris, so we get the same tris next cycle */
-						tris--;
-					}
-					else
-					{	
-						/* Create the second tris */
-						vertex_arr[2].x = vertex_arr[id[2]].x;
-						vertex_arr[2].y = vertex_arr[id[2]].y;
-						vertex_arr[2].z = vertex_arr[id[2]].z;
-				
-						vertex_arr[0].x = intersect[1].x;
-						vertex_arr[0].y = intersect[1].y;
-						vertex_arr[0].z = NEAR_PLANE;
+		for (frame = 0; frame < RASTER_BENCH_FRAMES; frame++)
+		{
+			rotate_y(2*PI/RASTER_BENCH_FRAMES);
+			render_to_buffer();
+		}
 
-						vertex_arr[1].x = intersect[0].x;
-						vertex_arr[1].y = intersect[0].y;
-						vertex_arr[1].z = NEAR_PLANE;
-					
-						/* Decrease material, so we use the same as the other half */
-						material_index = (material_index > 0) ? material_index-1 :
-								sizeof(material_array)/sizeof(material_array[0])-1;
-					}
-				}
-			}
+		start = clock_ms() - start;
+
+		printf("%-10s: %dx%d samples, %.3f ms/frame, %.1f Msamples/s\n", glyph_mode_name[mode],
+			buffer_width, buffer_height, start/RASTER_BENCH_FRAMES,
+			(double)buffer_width*buffer_height*RASTER_BENCH_FRAMES/1000/start);
+	}
+
+	return;
+}
+
+/* Time every frame stage at every viewport size, clip is the raster of a mesh crossing the near plane */
+int benchmark_suite(const char* kind, long tris)
+{
+	double result[BENCH_STAGES][BENCH_SIZES];
+	int pass, size, stage;
+	FILE* output = tmpfile();
+
+	if (output == NULL)
+	{
+		puts("Error opening the present output");
+		return 1;
+	}
+
+	/* First pass on the mesh asked, second one on the near plane floor for the clip stage */
+	for (pass = 0; pass < 2; pass++)
+	{
+		if (generate_mesh(pass == 0 ? kind : "near", tris, &lod_chain[0]))
+		{
+			fclose(output);
+			return 1;
 		}
 
-		/* Face normal and light intensity */
-		if (do_light)
+		/* Parse the text of the mesh asked */
+		#ifdef POSIX
+		if (pass == 0)
 		{
-			/* Compute face normal as cross product */
-			edge0.x = vertex_arr[0].x-vertex_arr[2].x;
-			edge0.y = vertex_arr[0].y-vertex_arr[2].y;
-			edge0.z = vertex_arr[0].z-vertex_arr[2].z;
-			edge1.x = vertex_arr[1].x-vertex_arr[2].x;
-			edge1.y = vertex_arr[1].y-vertex_arr[2].y;
-			edge1.z = vertex_arr[1].z-vertex_arr[2].z;
+			double rate = benchmark_parse(&lod_chain[0]);
 
-			normal.x = edge0.y*edge1.z - edge0.z*edge1.y;
-			normal.y = edge0.z*edge1.x - edge0.x*edge1.z;
-			normal.z = edge0.x*edge1.y - edge0.y*edge1.x;
-	
-			/* Compute light factor */
-			light = normal.x*-LIGHT_POS_X+normal.y*LIGHT_POS_Y+normal.z*LIGHT_POS_Z;
-		
-			/* Flip normal if its a backward */
-			if (normal.z > 0) 
-				light *= -1;
+			if (rate > 0)
+				printf("Parse: %s of %d tris, %.1f MB/s\n", kind, lod_chain[0].tris_count, rate);
 		}
-		
-		/* Raster vertex to screen */
-		for (vertex = 0; vertex < 3; vertex++)
+		#endif
+
+		compact_mesh(&lod_chain[0], 0);
+		lod_count = 1;
+
+		for (size = 0; size < BENCH_SIZES; size++)
 		{
-			/* Orthographic projection */
-			if (ortho)
-			{
-				vertex_arr[vertex].x = (vertex_arr[vertex].x / -transform[3][2] * buffer_width) + buffer_width/2;
-				vertex_arr[vertex].y = (vertex_arr[vertex].y / -transform[3][2] * buffer_height)*screen_rateo + buffer_height/2;
-			}
+			create_buffer(bench_size[size][0], bench_size[size][1]);
+			restore_mesh();
+			clear_buffer();
+			draw_mesh(&lod_chain[0]);
 
-			/* Perspective projection */
-			else
+			for (stage = 0; stage < BENCH_STAGES; stage++)
 			{
-				vertex_arr[vertex].x = (vertex_arr[vertex].x / -vertex_arr[vertex].z * buffer_width) + buffer_width/2;
-				vertex_arr[vertex].y = (vertex_arr[vertex].y / -vertex_arr[vertex].z * buffer_height)*screen_rateo + buffer_height/2;
+				/* The clip stage runs on the second mesh only, the others on the first */
+				if ((stage == BENCH_CLIP) == (pass == 1))
+					result[stage][size] = time_stage(stage, &lod_chain[0], output, BENCH_RUNS, BENCH_BATCHES);
 			}
-
-			/* Get boundaries */
-			if (vertex_arr[vertex].x < min_x)
-				min_x = (int) vertex_arr[vertex].x;
-			if (vertex_arr[vertex].x > max_x)
-				max_x = (int) vertex_arr[vertex].x;
-			if (vertex_arr[vertex].y < min_y)
-				min_y = (int) vertex_arr[vertex].y;
-			if (vertex_arr[vertex].y > max_y)
-				max_y = (int) vertex_arr[vertex].y;
 		}
+	}
 
-		/* Check boundaries */
-		max_x = (max_x > buffer_width-1) ? buffer_width-1 : max_x;
-		max_y = (max_y > buffer_height-1) ? buffer_height-1 : max_y;
-		min_x = (min_x < 0) ? 0 : min_x;
-		min_y = (min_y < 0) ? 0 : min_y;
-		
-		/* Calculate the determinant for barycentric coordinate */
-		determinant = 1/((vertex_arr[1].y-vertex_arr[2].y)*(vertex_arr[0].x-vertex_arr[2].x) +
-					(vertex_arr[2].x-vertex_arr[1].x)*(vertex_arr[0].y-vertex_arr[2].y));
+	fclose(output);
 
-		/* Test only the pixel in this area */
-		for (y = min_y; y <= max_y; y++) 
-		{
-			for (x = min_x; x <= max_x; x++) 
-			{
-				/* Calculate barycentric coordinate */
-				float lambda0 = ((vertex_arr[1].y-vertex_arr[2].y)*(x-vertex_arr[2].x) +
-					(vertex_arr[2].x-vertex_arr[1].x)*(y-vertex_arr[2].y))*determinant;
-				float lambda1 = ((vertex_arr[2].y-vertex_arr[0].y)*(x-vertex_arr[2].x) +
-					(vertex_arr[0].x-vertex_arr[2].x)*(y-vertex_arr[2].y))*determinant;
-				float lambda2 = 1.0f - lambda0 - lambda1;
-				
-				/* If is inside the triangle, render it */
-				if (lambda0 >= 0 && lambda1 >= 0 && lambda2 >= 0) 
-				{
-					/* Interpolate Z value */
-					float pixel_depth;
-			
-					/* Check if we are using ortho or perspective rendering */
-					if (ortho)
-					{
-						pixel_depth = 1.f/(vertex_arr[0].z * lambda0 +
-								vertex_arr[1].z * lambda1 +
-								vertex_arr[2].z * lambda2);
-					}
-					else
-					{
-						/* Perspective correct interpolation */
-						pixel_depth = lambda0 / vertex_arr[0].z +
-								lambda1 / vertex_arr[1].z +
-								lambda2 / vertex_arr[2].z;
-					}
+	/* Raster and clip clear the buffer before each run */
+	for (size = 0; size < BENCH_SIZES; size++)
+	{
+		result[BENCH_RASTER][size] -= result[BENCH_CLEAR][size];
+		result[BENCH_CLIP][size] -= result[BENCH_CLEAR][size];
+	}
 
-					/* Test depth buffer */
-					if (depth_buffer[x+y*buffer_width] < pixel_depth)
-					{
-						/* Update both buffer */	
-						depth_buffer[x+y*buffer_width] = pixel_depth;
-					
-						if (do_light)
-							screen_buffer[x+y*buffer_width] = light < 0 ? SHADOW_CHAR : LIGHT_CHAR;
-						else
-							screen_buffer[x+y*buffer_width] = material_array[material_index];
-					}
-				}
-			}			
-		}
+	printf("%-10s", "ms/run");
+
+	for (size = 0; size < BENCH_SIZES; size++)
+	{
+		char label[16];
+
+		sprintf(label, "%dx%d", bench_size[size][0], bench_size[size][1]);
+		printf(" %10s", label);
 	}
 
-	return;
-}
+	putchar('\n');
 
-/* Clear the console */
-void clear_screen()
-{	
-	#ifdef NCURSES
-	/* Just call ncurses clear */
-	clear();
-	
-	#else
-	/* Use CLI method */
-	int new_line;
+	for (stage = 0; stage < BENCH_STAGES; stage++)
+	{
+		printf("%-10s", bench_stage_name[stage]);
+
+		for (size = 0; size < BENCH_SIZES; size++)
+			printf(" %10.4f", result[stage][size]);
 
-	/* Print 64 new line */
-	for (new_line = 0; new_line < 64; new_line++)
 		putchar('\n');
-	#endif
+	}
+
+	return 0;
+}
+
+/* Best time of a stage in ms per run, in batches since a run is too short to be timed alone */
+double time_stage(int stage, const mesh_t* mesh, FILE* output, int runs, int batches)
+{
+	double best = 0;
+	int batch, run;
+
+	for (batch = 0; batch < batches; batch++)
+	{
+		double start = clock_ms();
+
+		for (run = 0; run < runs; run++)
+			bench_step(stage, mesh, output);
+
+		start = (clock_ms() - start)/runs;
+
+		if (batch == 0 || start < best)
+			best = start;
+	}
+
+	return best;
+}
+
+/* A run of a frame stage on the transformed mesh */
+void bench_step(int stage, const mesh_t* mesh, FILE* output)
+{
+	switch (stage)
+	{
+		case BENCH_TRANSFORM:
+			transform_vertices(mesh, transform, view_buffer);
+			break;
+
+		case BENCH_CLIP:
+		case BENCH_RASTER:
+			clear_buffer();
+			forward_kernel(mesh->tris_buffer != NULL)(mesh);
+			break;
+
+		case BENCH_CLEAR:
+			clear_buffer();
+			break;
+
+		case BENCH_PRESENT:
+			rewind(output);
+			write_screen(output);
+			break;
+	}
 
 	return;
 }
 
-/* Draw in the console */
-void draw_screen()
+/* Write the mesh as an OBJ file and time its parse, in MB/s */
+#ifdef POSIX
+double benchmark_parse(const mesh_t* mesh)
 {
-	int col, row;
+	char path[] = "/tmp/mesh-viewer-XXXXXX";
+	int handle = mkstemp(path);
+	FILE* text;
+	mesh_t parsed;
+	double best = 0;
+	long size;
+	int index, batch;
+
+	if (handle < 0 || (text = fdopen(handle, "w")) == NULL)
+	{
+		puts("Error writing the parse benchmark file");
+		return 0;
+	}
 
-	/* Frame benchmark */
-	#ifdef BENCHMARK
-	struct timeval start_frame, stop_frame, stop_render;
-	gettimeofday(&start_frame, NULL);
-	#endif
+	for (index = 0; index < mesh->vertex_count; index++)
+		fprintf(text, "v %f %f %f\n", mesh->vertex_buffer[index].x, mesh->vertex_buffer[index].y,
+			mesh->vertex_buffer[index].z);
 
-	/* Render to buffer */
-	render_to_buffer();
+	for (index = 0; index < mesh->tris_count; index++)
+		fprintf(text, "f %d %d %d\n", mesh->tris_buffer[index*3]+1, mesh->tris_buffer[index*3+1]+1,
+			mesh->tris_buffer[index*3+2]+1);
 
-	/* Benchmark rastering time */
-	#ifdef BENCHMARK
-	gettimeofday(&stop_render, NULL);
-	#endif
-	
-	/* Clear the console */
-	clear_screen();
+	size = ftell(text);
+	fclose(text);
 
-	#ifdef NCURSES
-	/* Print it, Ncurses color mode */
-	if (use_color)
+	for (batch = 0; batch < BENCH_BATCHES; batch++)
 	{
-		/* Light mode */
-		if (do_light)
-		{
-			for (row = 0; row < buffer_height; row++)
-			{	
-				for (col = 0; col < buffer_width; col++)
-				{
-					/* Set color attribute */
-					if (screen_buffer[col+row*buffer_width] == SHADOW_CHAR)
-						attron(COLOR_PAIR(3));
-					else if (screen_buffer[col+row*buffer_width] == LIGHT_CHAR)
-						attron(COLOR_PAIR(2));
-					else
-						attron(COLOR_PAIR(1));
+		double start = clock_ms();
 
-					/* Print a blank space */
-					addch(' ');
-				}
-			}
-		}
+		memset(&parsed, 0, sizeof(mesh_t));
 
-		/* No light */
-		else
-		{
-			for (row = 0; row < buffer_height; row++)
-			{	
-				for (col = 0; col < buffer_width; col++)
-				{
-					/* Set color attribute */
-					if (screen_buffer[col+row*buffer_width] != ' ')
-						attron(COLOR_PAIR(screen_buffer[col+row*buffer_width]%7+4));
-					else
-						attron(COLOR_PAIR(1));
+		if (parse_obj(path, &parsed))
+			break;
 
-					/* Print a blank space */
-					addch(' ');
-				}
-			}
-		}
+		start = clock_ms() - start;
+		free_mesh(&parsed);
 
-		/* Restore black and white */
-		attron(COLOR_PAIR(1));
+		if (batch == 0 || start < best)
+			best = start;
 	}
 
-	/* Ncurses, no color */
-	else
+	unlink(path);
+
+	return best > 0 ? size/1048576.0/(best/1000) : 0;
+}
+#endif
+
+/* Render every view, size, ortho and light combination and the silhouette, compare them with the golden frames
+   or write them */
+int check_frames(char* golden_path, int update)
+{
+	char line[CHECK_LINE], expected[CHECK_LINE], header[CHECK_LINE] = "";
+	int size, view, mode, frames = 0, failed = 0, frame_failed = 0;
+	FILE* output = tmpfile();
+	FILE* golden;
+
+	if (output == NULL)
 	{
-		for (row = 0; row < buffer_height; row++)
-		{	
-			for (col = 0; col < buffer_width; col++)
+		puts("Error opening the check output");
+		return 1;
+	}
+
+	/* Every frame after a header line naming it, a bracket no frame row starts with */
+	for (size = 0; size < CHECK_SIZES; size++)
+	{
+		create_buffer(check_size[size][0], check_size[size][1]);
+
+		for (view = 0; view < CHECK_VIEWS; view++)
+		{
+			for (mode = 0; mode < CHECK_MODES; mode++)
 			{
-				/* Print the char in the buffer */
-				addch(screen_buffer[col+row*buffer_width]);
+				/* The last mode is the silhouette wireframe in perspective, it depends on the tris winding */
+				ortho = mode < 4 ? mode >> 1 : 0;
+				do_light = mode < 4 ? mode & 1 : 1;
+				wire_mode = mode < 4 ? WIRE_OFF : WIRE_SILHOUETTE;
+				check_view(view);
+				render_to_buffer();
+
+				if (wire_mode == WIRE_OFF)
+					fprintf(output, "[Frame: %dx%d, view %d, ortho %d, light %d]\n", check_size[size][0],
+						check_size[size][1], view, ortho, do_light);
+				else
+					fprintf(output, "[Frame: %dx%d, view %d, wire %s]\n", check_size[size][0], check_size[size][1],
+						view, wire_mode_name[wire_mode]);
+
+				write_screen(output);
+				frames++;
 			}
 		}
 	}
 
-	/* Frame benchmark */
-	#ifdef BENCHMARK
-	gettimeofday(&stop_frame, NULL);
+	ortho = 0;
+	do_light = 1;
+	wire_mode = WIRE_OFF;
+	rewind(output);
 
-	mvprintw(0, 0, "[Frame: %.1f ms (Render: %.1f ms), Tris: %d]", 
+	golden = fopen(golden_path, update ? "w" : "r");
+
+	if (golden == NULL)
+	{
+		printf("Error %s file %s\n", update ? "writing" : "reading", golden_path);
+		fclose(output);
+		return 1;
+	}
+
+	/* Write the frames as the new golden ones */
+	if (update)
+	{
+		while (fgets(line, sizeof(line), output) != NULL)
+			fputs(line, golden);
+
+		printf("[Check: %d frames written to %s]\n", frames, golden_path);
+	}
+
+	/* Compare line by line, a frame fails on its first row that differs */
+	else
+	{
+		while (fgets(line, sizeof(line), output) != NULL)
+		{
+			if (fgets(expected, sizeof(expected), golden) == NULL)
+				expected[0] = '\0';
+
+			if (line[0] == '[')
+			{
+				strcpy(header, line);
+				frame_failed = 0;
+			}
+
+			if (strcmp(line, expected) != 0 && !frame_failed)
+			{
+				printf("Frame differs: %s", header);
+				frame_failed = 1;
+				failed++;
+			}
+		}
+
+		/* Golden frames left over */
+		if (fgets(expected, sizeof(expected), golden) != NULL && failed == 0)
+		{
+			puts("Golden frames left over");
+			failed++;
+		}
+
+		printf("[Check: %s, %d/%d frames match]\n", golden_path, frames - failed, frames);
+	}
+
+	fclose(golden);
+	fclose(output);
+
+	return failed > 0;
+}
+
+/* Restore the view and move it to a check view */
+void check_view(int view)
+{
+	restore_mesh();
+	rotate_x(check_turn[view][0]*PI/180);
+	rotate_y(check_turn[view][1]*PI/180);
+	translate(0, 0, check_turn[view][2]);
+
+	return;
+}
+
+/* Time the frame stages at every check size against the baseline of this machine, or write it when missing */
+int check_timing(char* baseline_path, int update)
+{
+	double result[BENCH_STAGES][CHECK_SIZES];
+	int size, stage, failed = 0;
+	FILE* output = tmpfile();
+	FILE* baseline = update ? NULL : fopen(baseline_path, "r");
+
+	if (output == NULL)
+	{
+		puts("Error opening the check output");
+		return 1;
+	}
+
+	for (size = 0; size < CHECK_SIZES; size++)
+	{
+		const mesh_t* mesh;
+
+		create_buffer(check_size[size][0], check_size[size][1]);
+		check_view(0);
+		render_to_buffer();
+		mesh = &lod_chain[lod_active];
+
+		/* Clip needs its own mesh, it is timed by the suite only */
+		for (stage = 0; stage < BENCH_STAGES; stage++)
+			if (stage != BENCH_CLIP)
+				result[stage][size] = time_stage(stage, mesh, output, CHECK_RUNS, CHECK_BATCHES);
+
+		result[BENCH_RASTER][size] -= result[BENCH_CLEAR][size];
+	}
+
+	fclose(output);
+
+	/* No baseline yet, this run is the one */
+	if (baseline == NULL)
+	{
+		baseline = fopen(baseline_path, "w");
+
+		if (baseline == NULL)
+		{
+			printf("Error writing file %s\n", baseline_path);
+			return 1;
+		}
+
+		for (stage = 0; stage < BENCH_STAGES; stage++)
+			for (size = 0; size < CHECK_SIZES; size++)
+				if (stage != BENCH_CLIP)
+					fprintf(baseline, "%s %dx%d %.6f\n", bench_stage_name[stage], check_size[size][0],
+						check_size[size][1], result[stage][size]);
+
+		fclose(baseline);
+		printf("[Check: timing baseline written to %s]\n", baseline_path);
+
+		return 0;
+	}
+
+	/* Same order as written, a stage fails when slower by the ratio and more than the timer noise */
+	for (stage = 0; stage < BENCH_STAGES; stage++)
+	{
+		for (size = 0; size < CHECK_SIZES && stage != BENCH_CLIP; size++)
+		{
+			double base;
+
+			if (fscanf(baseline, "%*s %*s %lf", &base) != 1)
+			{
+				printf("Error reading file %s\n", baseline_path);
+				fclose(baseline);
+				return 1;
+			}
+
+			if (result[stage][size] > base*CHECK_SLOWDOWN && result[stage][size] - base > CHECK_NOISE_MS)
+			{
+				printf("Slower: %s at %dx%d, %.4f ms against %.4f ms\n", bench_stage_name[stage],
+					check_size[size][0], check_size[size][1], result[stage][size], base);
+				failed++;
+			}
+		}
+	}
+
+	fclose(baseline);
+	printf("[Check: %s, %d stages slower than the baseline]\n", baseline_path, failed);
+
+	return failed > 0;
+}
+#endif
+
+/* Load a mesh, the loader is picked by the file magic */
+int load_mesh(char* path, mesh_t* mesh)
+{
+	unsigned char header[STL_HEADER];
+	unsigned long size, count, read;
+	FILE* mesh_file = fopen(path, "rb");
+
+	/* Check the read to be succefull */
+	if (mesh_file == NULL)
+	{
+		printf("Error reading file %s\n", path);
+		return 1;
+	}
+
+	/* File size and first bytes */
+	fseek(mesh_file, 0, SEEK_END);
+	size = ftell(mesh_file);
+	rewind(mesh_file);
+	read = fread(header, 1, STL_HEADER, mesh_file);
+	fclose(mesh_file);
+
+	#ifdef BENCHMARK
+	load_bytes = size;
+	#endif
+
+	/* PLY, ascii or binary */
+	if (read >= 4 && memcmp(header, "ply", 3) == 0 && (header[3] == '\n' || header[3] == '\r'))
+		return parse_ply(path, mesh);
+
+	/* Binary STL has no magic, but its size follows the tris count */
+	if (read == STL_HEADER)
+	{
+		count = header[80] | header[81] << 8 | header[82] << 16 | (unsigned long)header[83] << 24;
+
+		if (size == STL_HEADER + count*STL_RECORD)
+			return parse_stl(path, mesh, 1);
+	}
+
+	/* Ascii STL */
+	if (read >= 6 && memcmp(header, "solid", 5) == 0 && (header[5] == ' ' || header[5] == '\n' || header[5] == '\r'))
+		return parse_stl(path, mesh, 0);
+
+	return parse_obj(path, mesh);
+}
+
+/* Build a stress mesh of about tris tris: sphere, grid, terrain, degenerate or near (crossing the near plane) */
+int generate_mesh(const char* kind, long tris, mesh_t* mesh)
+{
+	int side = 1;
+	int index, row, col;
+
+	free_mesh(mesh);
+
+	/* Latitude and longitude subdivision, twice as many segments as rings */
+	if (strcmp(kind, "sphere") == 0)
+	{
+		int rings = 2, segments;
+
+		while ((long)(rings+1)*(rings+1)*4 <= tris)
+			rings++;
+		segments = rings*2;
+
+		mesh->vertex_count = 2 + (rings-1)*segments;
+		mesh->tris_count = 2*segments*(rings-1);
+		mesh->vertex_buffer = (vertex_t*) malloc(mesh->vertex_count * sizeof(vertex_t));
+		mesh->tris_buffer = (int*) malloc(mesh->tris_count * sizeof(int) * 3);
+
+		if (mesh->vertex_buffer == NULL || mesh->tris_buffer == NULL)
+		{
+			printf("Not enough memory for %d tris\n", mesh->tris_count);
+			free_mesh(mesh);
+			return 1;
+		}
+
+		/* Poles first, then a ring at a time */
+		mesh->vertex_buffer[0].x = 0; mesh->vertex_buffer[0].y = 1; mesh->vertex_buffer[0].z = 0;
+		mesh->vertex_buffer[1].x = 0; mesh->vertex_buffer[1].y = -1; mesh->vertex_buffer[1].z = 0;
+
+		for (row = 1; row < rings; row++)
+		{
+			float radius = sine(PI*row/rings);
+			float height = cosine(PI*row/rings);
+
+			for (col = 0; col < segments; col++)
+			{
+				vertex_t* vertex = &mesh->vertex_buffer[2 + (row-1)*segments + col];
+
+				vertex->x = radius*cosine(2*PI*col/segments);
+				vertex->y = height;
+				vertex->z = radius*sine(2*PI*col/segments);
+			}
+		}
+
+		for (col = 0, index = 0; col < segments; col++)
+		{
+			int next = (col+1) % segments;
+
+			/* Fans on the poles */
+			mesh->tris_buffer[index++] = 0;
+			mesh->tris_buffer[index++] = 2 + next;
+			mesh->tris_buffer[index++] = 2 + col;
+
+			mesh->tris_buffer[index++] = 1;
+			mesh->tris_buffer[index++] = 2 + (rings-2)*segments + col;
+			mesh->tris_buffer[index++] = 2 + (rings-2)*segments + next;
+
+			/* Two tris between every couple of rings */
+			for (row = 1; row < rings-1; row++)
+			{
+				int top = 2 + (row-1)*segments, bottom = 2 + row*segments;
+
+				mesh->tris_buffer[index++] = top + col;
+				mesh->tris_buffer[index++] = top + next;
+				mesh->tris_buffer[index++] = bottom + col;
+
+				mesh->tris_buffer[index++] = top + next;
+				mesh->tris_buffer[index++] = bottom + next;
+				mesh->tris_buffer[index++] = bottom + col;
+			}
+		}
+
+		return 0;
+	}
+
+	/* The other kinds start from a square grid of quads */
+	while ((long)(side+1)*(side+1)*2 <= tris)
+		side++;
+
+	if (strcmp(kind, "grid") != 0 && strcmp(kind, "terrain") != 0 && strcmp(kind, "degenerate") != 0 &&
+		strcmp(kind, "near") != 0)
+	{
+		printf("Unknown mesh kind %s\n", kind);
+		return 1;
+	}
+
+	if (grid_mesh(mesh, side, side))
+	{
+		printf("Not enough memory for %ld tris\n", (long)side*side*2);
+		return 1;
+	}
+
+	/* Relief of a few noise octaves */
+	if (strcmp(kind, "terrain") == 0)
+	{
+		for (index = 0; index < mesh->vertex_count; index++)
+		{
+			vertex_t* vertex = &mesh->vertex_buffer[index];
+
+			vertex->z = 0.4f*value_noise(vertex->x*2, vertex->y*2) + 0.2f*value_noise(vertex->x*4, vertex->y*4) +
+				0.1f*value_noise(vertex->x*8, vertex->y*8) + 0.05f*value_noise(vertex->x*16, vertex->y*16);
+		}
+	}
+
+	/* Floor from far behind the view to far in front of it, facing up */
+	else if (strcmp(kind, "near") == 0)
+	{
+		for (index = 0; index < mesh->vertex_count; index++)
+		{
+			vertex_t* vertex = &mesh->vertex_buffer[index];
+
+			vertex->z = vertex->y*30;
+			vertex->y = -0.6f;
+			vertex->x *= -2;
+		}
+	}
+
+	/* Every other tris collapsed: repeated index, three vertex on a row line, or a long sliver */
+	else if (strcmp(kind, "degenerate") == 0)
+	{
+		for (index = 0; index < mesh->tris_count; index++)
+		{
+			int* corner = &mesh->tris_buffer[index*3];
+			int start = corner[0] - corner[0] % (side+1);
+
+			if (index % 4 == 1)
+				corner[2] = corner[0];
+			else if (index % 4 == 2 && side >= 2)
+			{
+				corner[0] = start;
+				corner[1] = start + side/2;
+				corner[2] = start + side;
+			}
+			else if (index % 4 == 3 && corner[0] + side+1 < mesh->vertex_count)
+			{
+				corner[1] = start + side;
+				corner[2] = start + side+1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Flat grid of columns x rows quads on [-1, 1] in the xy plane */
+int grid_mesh(mesh_t* mesh, int columns, int rows)
+{
+	int row, col, index = 0;
+
+	mesh->vertex_count = (columns+1)*(rows+1);
+	mesh->tris_count = columns*rows*2;
+	mesh->vertex_buffer = (vertex_t*) malloc(mesh->vertex_count * sizeof(vertex_t));
+	mesh->tris_buffer = (int*) malloc(mesh->tris_count * sizeof(int) * 3);
+
+	if (mesh->vertex_buffer == NULL || mesh->tris_buffer == NULL)
+	{
+		free_mesh(mesh);
+		return 1;
+	}
+
+	for (row = 0; row <= rows; row++)
+	{
+		for (col = 0; col <= columns; col++)
+		{
+			vertex_t* vertex = &mesh->vertex_buffer[col + row*(columns+1)];
+
+			vertex->x = 2.f*col/columns - 1;
+			vertex->y = 2.f*row/rows - 1;
+			vertex->z = 0;
+		}
+	}
+
+	for (row = 0; row < rows; row++)
+	{
+		for (col = 0; col < columns; col++)
+		{
+			int corner = col + row*(columns+1);
+
+			mesh->tris_buffer[index++] = corner;
+			mesh->tris_buffer[index++] = corner+1;
+			mesh->tris_buffer[index++] = corner+columns+1;
+
+			mesh->tris_buffer[index++] = corner+1;
+			mesh->tris_buffer[index++] = corner+columns+2;
+			mesh->tris_buffer[index++] = corner+columns+1;
+		}
+	}
+
+	return 0;
+}
+
+/* Smooth value noise in [-1, 1], hashed on the integer lattice */
+float value_noise(float x, float y)
+{
+	int cell_x = (int)(x + 1024) - 1024;
+	int cell_y = (int)(y + 1024) - 1024;
+	float fraction_x = x - cell_x;
+	float fraction_y = y - cell_y;
+	float corner[4];
+	int index;
+
+	for (index = 0; index < 4; index++)
+	{
+		unsigned int hash = (unsigned int)(cell_x + (index & 1))*73856093u ^ (unsigned int)(cell_y + (index >> 1))*19349663u;
+
+		hash = (hash ^ (hash >> 13))*1274126177u;
+		corner[index] = (float)(hash & 0xFFFF)/32767.5f - 1;
+	}
+
+	/* Smoothstep between the corners */
+	fraction_x = fraction_x*fraction_x*(3 - 2*fraction_x);
+	fraction_y = fraction_y*fraction_y*(3 - 2*fraction_y);
+
+	return (corner[0] + (corner[1]-corner[0])*fraction_x)*(1-fraction_y) +
+		(corner[2] + (corner[3]-corner[2])*fraction_x)*fraction_y;
+}
+
+/* Tris count, with an optional K or M suffix */
+long parse_count(const char* text)
+{
+	char* end;
+	double count = strtod(text, &end);
+
+	if (*end == 'k' || *end == 'K')
+		count *= 1000;
+	else if (*end == 'm' || *end == 'M')
+		count *= 1000000;
+
+	return (long) count;
+}
+
+/* Map a whole file in memory, read it if there is no mmap */
+char* map_file(char* path, unsigned long* size)
+{
+	char* map;
+
+	#ifdef POSIX
+	struct stat status;
+	int file = open(path, O_RDONLY);
+
+	if (file < 0)
+		return NULL;
+
+	if (fstat(file, &status) || status.st_size == 0)
+	{
+		close(file);
+		return NULL;
+	}
+
+	/* Private copy on write pages, the mesh can be changed in place */
+	*size = status.st_size;
+	map = (char*) mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+	close(file);
+
+	return (map == MAP_FAILED) ? NULL : map;
+
+	#else
+	FILE* file = fopen(path, "rb");
+
+	if (file == NULL)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+	rewind(file);
+
+	map = (char*) malloc(*size ? *size : 1);
+
+	if (*size == 0 || fread(map, 1, *size, file) != *size)
+	{
+		free(map);
+		map = NULL;
+	}
+
+	fclose(file);
+
+	return map;
+	#endif
+}
+
+/* Release a mapped file */
+void unmap_file(char* map, unsigned long size)
+{
+	#ifdef POSIX
+	munmap(map, size);
+
+	#else
+	(void) size;
+	free(map);
+	#endif
+
+	return;
+}
+
+/* Type of a PLY property, -1 if unknown */
+int ply_type(const char* name)
+{
+	unsigned int type;
+
+	for (type = 0; type < sizeof(ply_type_name)/sizeof(ply_type_name[0]); type++)
+	{
+		if (strcmp(name, ply_type_name[type]) == 0)
+			return type % 8;
+	}
+
+	return -1;
+}
+
+/* Read a PLY value of any type and format, return 0 at the end of the data */
+int ply_read(ply_reader_t* reader, int type, double* value)
+{
+	unsigned char bytes[8];
+	int size = ply_type_size[type];
+	int byte, one = 1;
+	int little = *(char*)&one == 1;
+
+	/* Ascii, one token */
+	if (reader->format == PLY_ASCII)
+	{
+		char token[64];
+		int length = 0;
+
+		while (reader->cursor < reader->end && (*reader->cursor == ' ' || *reader->cursor == '\t' || 
+			*reader->cursor == '\n' || *reader->cursor == '\r'))
+			reader->cursor++;
+
+		while (reader->cursor < reader->end && length < 63 && *reader->cursor != ' ' && 
+			*reader->cursor != '\t' && *reader->cursor != '\n' && *reader->cursor != '\r')
+			token[length++] = *reader->cursor++;
+
+		token[length] = '\0';
+		*value = strtod(token, NULL);
+
+		return length > 0;
+	}
+
+	/* Binary, swap the bytes if the file endianness is not the machine one */
+	if (reader->end - reader->cursor < size)
+		return 0;
+
+	for (byte = 0; byte < size; byte++)
+		bytes[(little == (reader->format == PLY_LITTLE_ENDIAN)) ? byte : size-1-byte] = reader->cursor[byte];
+
+	reader->cursor += size;
+
+	switch (type)
+	{
+		case PLY_INT8:		*value = *(signed char*)bytes; break;
+		case PLY_UINT8:		*value = *(unsigned char*)bytes; break;
+		case PLY_INT16:		{ short number; memcpy(&number, bytes, 2); *value = number; } break;
+		case PLY_UINT16:	{ unsigned short number; memcpy(&number, bytes, 2); *value = number; } break;
+		case PLY_INT32:		{ int number; memcpy(&number, bytes, 4); *value = number; } break;
+		case PLY_UINT32:	{ unsigned int number; memcpy(&number, bytes, 4); *value = number; } break;
+		case PLY_FLOAT32:	{ float number; memcpy(&number, bytes, 4); *value = number; } break;
+		default:		memcpy(value, bytes, 8); break;
+	}
+
+	return 1;
+}
+
+/* Parse a PLY file, vertex are used in place when they are stored as vertex_t */
+int parse_ply(char* path, mesh_t* mesh)
+{
+	char line_buffer[1024];
+	char word[3][PLY_NAME_MAX];
+	ply_element_t element[PLY_ELEMENT_MAX];
+	int element_count = 0;
+	int tris_capacity = 0;
+	int index, property;
+	int one = 1;
+	int corrupt = 0;
+	unsigned long size;
+	ply_reader_t reader;
+	char* map = map_file(path, &size);
+
+	/* Check the read to be succefull */
+	if (map == NULL)
+	{
+		printf("Error reading file %s\n", path);
+		return 1;
+	}
+
+	reader.cursor = map;
+	reader.end = map + size;
+	reader.format = -1;
+
+	/* Header, one line at time up to end_header */
+	while (1)
+	{
+		int length = 0;
+
+		while (reader.cursor < reader.end && *reader.cursor != '\n' && length < 1023)
+			line_buffer[length++] = *reader.cursor++;
+
+		line_buffer[length] = '\0';
+
+		/* Header not terminated */
+		if (reader.cursor >= reader.end)
+			break;
+
+		reader.cursor++;
+
+		if (strncmp(line_buffer, "end_header", 10) == 0)
+			break;
+
+		/* Words of the line */
+		word[0][0] = word[1][0] = word[2][0] = '\0';
+		sscanf(line_buffer, "%*s %31s %31s %31s", word[0], word[1], word[2]);
+
+		if (strncmp(line_buffer, "format ", 7) == 0)
+		{
+			if (strcmp(word[0], "ascii") == 0)
+				reader.format = PLY_ASCII;
+			else if (strcmp(word[0], "binary_little_endian") == 0)
+				reader.format = PLY_LITTLE_ENDIAN;
+			else if (strcmp(word[0], "binary_big_endian") == 0)
+				reader.format = PLY_BIG_ENDIAN;
+		}
+		else if (strncmp(line_buffer, "element ", 8) == 0 && element_count < PLY_ELEMENT_MAX)
+		{
+			ply_element_t* last = &element[element_count++];
+
+			strcpy(last->name, word[0]);
+			last->count = atoi(word[1]);
+			last->property_count = 0;
+		}
+		else if (strncmp(line_buffer, "property ", 9) == 0 && element_count > 0 &&
+			element[element_count-1].property_count < PLY_PROPERTY_MAX)
+		{
+			ply_element_t* last = &element[element_count-1];
+			ply_property_t* added = &last->property[last->property_count++];
+
+			/* List: count type, item type and name */
+			if (strcmp(word[0], "list") == 0)
+			{
+				sscanf(line_buffer, "%*s %*s %*s %*s %31s", added->name);
+				added->count_type = ply_type(word[1]);
+				added->type = ply_type(word[2]);
+			}
+			else
+			{
+				strcpy(added->name, word[1]);
+				added->count_type = -1;
+				added->type = ply_type(word[0]);
+			}
+
+			/* Unknown type, can not be skipped */
+			if (added->type < 0 || (strcmp(word[0], "list") == 0 && added->count_type < 0))
+				reader.format = -1;
+		}
+	}
+
+	/* Check the header */
+	if (reader.format < 0 || reader.cursor >= reader.end)
+	{
+		printf("Corrupted file %s\n", path);
+		unmap_file(map, size);
+		return 1;
+	}
+
+	/* Free previous tris and vertex */
+	free_mesh(mesh);
+
+	/* Read the elements in order, a value missing from the body stops the read */
+	for (index = 0; index < element_count && !corrupt; index++)
+	{
+		ply_element_t* current = &element[index];
+		int is_vertex = strcmp(current->name, "vertex") == 0;
+		int is_face = strcmp(current->name, "face") == 0;
+		int axis[PLY_PROPERTY_MAX];
+		int record, stride = 0;
+		long least = 0;
+
+		/* Position axis of every property, the record size if every property is fixed size and the least one */
+		for (property = 0; property < current->property_count; property++)
+		{
+			const ply_property_t* sized = &current->property[property];
+
+			axis[property] = (sized->name[1] == '\0' && sized->name[0] >= 'x' && sized->name[0] <= 'z') ?
+						sized->name[0]-'x' : -1;
+
+			if (stride >= 0 && sized->count_type < 0)
+				stride += ply_type_size[sized->type];
+			else
+				stride = -1;
+
+			/* A char for an ascii value, a list at least its count */
+			if (reader.format == PLY_ASCII)
+				least++;
+			else
+				least += ply_type_size[sized->count_type < 0 ? sized->type : sized->count_type];
+		}
+
+		/* A count from the header that the rest of the file can not hold */
+		if (current->count < 0 || reader.end - reader.cursor < (long)current->count * least)
+		{
+			corrupt = 1;
+			break;
+		}
+
+		if (is_vertex)
+		{
+			/* Little endian float x, y, z only, at a float aligned offset: the file is the vertex buffer */
+			if (reader.format == PLY_LITTLE_ENDIAN && *(char*)&one == 1 && current->property_count == 3 &&
+				axis[0] == 0 && axis[1] == 1 && axis[2] == 2 && stride == sizeof(vertex_t) &&
+				current->property[0].type == PLY_FLOAT32 && current->property[1].type == PLY_FLOAT32 &&
+				current->property[2].type == PLY_FLOAT32 && (reader.cursor - map) % sizeof(float) == 0 &&
+				reader.end - reader.cursor >= (long)current->count * stride)
+			{
+				mesh->vertex_buffer = (vertex_t*) reader.cursor;
+				mesh->vertex_count = current->count;
+				mesh->file_map = map;
+				mesh->file_size = size;
+				reader.cursor += (long)current->count * stride;
+				continue;
+			}
+
+			mesh->vertex_buffer = (vertex_t*) calloc(current->count > 0 ? current->count : 1, sizeof(vertex_t));
+
+			if (mesh->vertex_buffer == NULL)
+			{
+				corrupt = 1;
+				break;
+			}
+
+			mesh->vertex_count = current->count;
+		}
+
+		/* Fixed size records of an unused element are skipped at once */
+		if (!is_vertex && !is_face && reader.format != PLY_ASCII && stride >= 0)
+		{
+			if (reader.end - reader.cursor < (long)current->count * stride)
+				corrupt = 1;
+			else
+				reader.cursor += (long)current->count * stride;
+
+			continue;
+		}
+
+		for (record = 0; record < current->count && !corrupt; record++)
+		{
+			for (property = 0; property < current->property_count && !corrupt; property++)
+			{
+				const ply_property_t* read_property = &current->property[property];
+				double value;
+
+				/* Plain value, keep the position */
+				if (read_property->count_type < 0)
+				{
+					if (!ply_read(&reader, read_property->type, &value))
+					{
+						corrupt = 1;
+						break;
+					}
+
+					if (is_vertex && axis[property] >= 0)
+						((float*)&mesh->vertex_buffer[record])[axis[property]] = (float)value;
+				}
+
+				/* List, the face indices are split as a fan like the OBJ faces */
+				else
+				{
+					int item, count;
+					int face[FACE_MAX];
+
+					if (!ply_read(&reader, read_property->count_type, &value))
+					{
+						corrupt = 1;
+						break;
+					}
+
+					count = (int)value;
+
+					for (item = 0; item < count; item++)
+					{
+						if (!ply_read(&reader, read_property->type, &value))
+						{
+							corrupt = 1;
+							break;
+						}
+
+						if (item < FACE_MAX)
+							face[item] = (int)value;
+					}
+
+					if (corrupt || !is_face || (strcmp(read_property->name, "vertex_indices") != 0 && 
+						strcmp(read_property->name, "vertex_index") != 0))
+						continue;
+
+					/* Items past the max are read but left out of the fan */
+					if (count > FACE_MAX)
+						count = FACE_MAX;
+
+					for (item = 2; item < count; item++)
+					{
+						/* Grow the tris buffer, keeping the old one if it can not */
+						if (mesh->tris_count == tris_capacity)
+						{
+							int* grown;
+
+							tris_capacity = tris_capacity ? tris_capacity*2 : current->count+1;
+							grown = (int*) realloc(mesh->tris_buffer, (unsigned long)tris_capacity * sizeof(int) * 3);
+
+							if (grown == NULL)
+							{
+								corrupt = 1;
+								break;
+							}
+
+							mesh->tris_buffer = grown;
+						}
+
+						mesh->tris_buffer[mesh->tris_count*3+0] = face[0];
+						mesh->tris_buffer[mesh->tris_count*3+1] = face[item-1];
+						mesh->tris_buffer[mesh->tris_count*3+2] = face[item];
+						mesh->tris_count++;
+					}
+				}
+			}
+		}
+	}
+
+	/* Mapping not used by the mesh */
+	if (mesh->file_map == NULL)
+		unmap_file(map, size);
+
+	/* Check the body was complete, then the vertex and tris count */
+	if (corrupt || validate_tris(mesh))
+	{
+		printf("Corrupted file %s\n", path);
+		free_mesh(mesh);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Parse a binary or ascii STL, welding the tris corners in shared vertex */
+int parse_stl(char* path, mesh_t* mesh, int binary)
+{
+	int tris_count = 0;
+	int result;
+	vertex_t* corner = NULL;
+
+	if (binary)
+	{
+		int index;
+		unsigned long size;
+		char* map = map_file(path, &size);
+
+		/* Check the read to be succefull */
+		if (map == NULL)
+		{
+			printf("Error reading file %s\n", path);
+			return 1;
+		}
+
+		/* Corners of every record, after the normal */
+		tris_count = (int)((size - STL_HEADER) / STL_RECORD);
+		corner = (vertex_t*) malloc((tris_count ? tris_count : 1) * sizeof(vertex_t) * 3);
+
+		if (corner == NULL)
+		{
+			printf("Not enough memory for %d tris\n", tris_count);
+			unmap_file(map, size);
+			return 1;
+		}
+
+		for (index = 0; index < tris_count; index++)
+			memcpy(&corner[index*3], map + STL_HEADER + index*STL_RECORD + sizeof(vertex_t), sizeof(vertex_t) * 3);
+
+		unmap_file(map, size);
+	}
+	else
+	{
+		char line_buffer[1024];
+		int corner_count = 0;
+		int corner_capacity = 0;
+		FILE* mesh_file = fopen(path, "r");
+
+		/* Check the read to be succefull */
+		if (mesh_file == NULL)
+		{
+			printf("Error reading file %s\n", path);
+			return 1;
+		}
+
+		/* Every "vertex x y z" line is a corner, three make a tris */
+		while (fgets(line_buffer, 1024, mesh_file))
+		{
+			vertex_t vertex;
+
+			if (sscanf(line_buffer, " vertex %f %f %f", &vertex.x, &vertex.y, &vertex.z) != 3)
+				continue;
+
+			if (corner_count == corner_capacity)
+			{
+				vertex_t* grown;
+
+				corner_capacity = corner_capacity ? corner_capacity*2 : 3072;
+				grown = (vertex_t*) realloc(corner, (unsigned long)corner_capacity * sizeof(vertex_t));
+
+				if (grown == NULL)
+				{
+					printf("Not enough memory for %d tris\n", corner_count/3);
+					free(corner);
+					fclose(mesh_file);
+					return 1;
+				}
+
+				corner = grown;
+			}
+
+			corner[corner_count++] = vertex;
+		}
+
+		fclose(mesh_file);
+		tris_count = corner_count/3;
+	}
+
+	/* Free previous tris and vertex */
+	free_mesh(mesh);
+
+	result = tris_count == 0 || weld_mesh(mesh, corner, tris_count) || validate_tris(mesh);
+	free(corner);
+
+	if (result)
+		printf("Corrupted file %s\n", path);
+
+	return result;
+}
+
+/* Build vertex and tris buffers from the tris corners, corners at the same position share a vertex */
+int weld_mesh(mesh_t* mesh, const vertex_t* corner, int tris_count)
+{
+	int index;
+	int table_size = 1;
+	int* table;
+	vertex_t* shrunk;
+
+	/* Open addressing table at most half full */
+	while (table_size < tris_count*6)
+		table_size *= 2;
+
+	table = (int*) malloc(table_size * sizeof(int));
+	mesh->vertex_buffer = (vertex_t*) malloc(tris_count * sizeof(vertex_t) * 3);
+	mesh->tris_buffer = (int*) malloc(tris_count * sizeof(int) * 3);
+
+	/* Leave the mesh empty if any is missing */
+	if (table == NULL || mesh->vertex_buffer == NULL || mesh->tris_buffer == NULL)
+	{
+		free(table);
+		free(mesh->vertex_buffer);
+		free(mesh->tris_buffer);
+		mesh->vertex_buffer = NULL;
+		mesh->tris_buffer = NULL;
+		return 1;
+	}
+
+	for (index = 0; index < table_size; index++)
+		table[index] = -1;
+
+	for (index = 0; index < tris_count*3; index++)
+	{
+		unsigned int bits[3], hash;
+		int slot;
+		vertex_t vertex = corner[index];
+
+		/* Same key for 0 and -0 */
+		vertex.x += 0.0f;
+		vertex.y += 0.0f;
+		vertex.z += 0.0f;
+		memcpy(bits, &vertex, sizeof(bits));
+
+		hash = (bits[0]*73856093u) ^ (bits[1]*19349663u) ^ (bits[2]*83492791u);
+		slot = (int)(hash & (table_size-1));
+
+		/* Find the position or add it */
+		while (table[slot] != -1 && memcmp(&mesh->vertex_buffer[table[slot]], &vertex, sizeof(vertex_t)) != 0)
+			slot = (slot+1) & (table_size-1);
+
+		if (table[slot] == -1)
+		{
+			table[slot] = mesh->vertex_count;
+			mesh->vertex_buffer[mesh->vertex_count++] = vertex;
+		}
+
+		mesh->tris_buffer[index] = table[slot];
+	}
+
+	/* Shrink to the welded vertex, the larger buffer stays if it can not */
+	mesh->tris_count = tris_count;
+	shrunk = (vertex_t*) realloc(mesh->vertex_buffer, mesh->vertex_count * sizeof(vertex_t));
+	if (shrunk != NULL)
+		mesh->vertex_buffer = shrunk;
+	free(table);
+
+	return 0;
+}
+
+/* Drop the tris with a vertex out of the buffer, return 1 if nothing is left */
+int validate_tris(mesh_t* mesh)
+{
+	int index, vertex;
+	int tris_count = 0;
+
+	for (index = 0; index < mesh->tris_count; index++)
+	{
+		const int* tris = &mesh->tris_buffer[index*3];
+
+		for (vertex = 0; vertex < 3; vertex++)
+		{
+			if (tris[vertex] < 0 || tris[vertex] >= mesh->vertex_count)
+				break;
+		}
+
+		if (vertex < 3)
+			continue;
+
+		memmove(&mesh->tris_buffer[tris_count*3], tris, sizeof(int) * 3);
+
+		if (mesh->tris_line)
+			mesh->tris_line[tris_count] = mesh->tris_line[index];
+
+		tris_count++;
+	}
+
+	mesh->tris_count = tris_count;
+
+	return mesh->vertex_count == 0 || mesh->tris_count == 0;
+}
+
+/* Free the vertex buffer, or the file it points into */
+void free_vertex(mesh_t* mesh)
+{
+	if (mesh->file_map)
+		unmap_file(mesh->file_map, mesh->file_size);
+	else
+		free(mesh->vertex_buffer);
+
+	mesh->vertex_buffer = NULL;
+	mesh->file_map = NULL;
+	mesh->file_size = 0;
+
+	return;
+}
+
+/* Free the mesh storage */
+void free_mesh(mesh_t* mesh)
+{
+	free_vertex(mesh);
+	free(mesh->tris_buffer);
+	free(mesh->quant_buffer);
+	free(mesh->tris_buffer16);
+	free(mesh->edge_buffer);
+	free(mesh->edge_face);
+	free(mesh->tris_line);
+	free(mesh->bvh_node);
+	free(mesh->bvh_tris);
+
+	/* Clear everything */
+	memset(mesh, 0, sizeof(mesh_t));
+
+	return;
+}
+
+/* Compute the bounding box */
+void compute_bounds(mesh_t* mesh)
+{
+	int index;
+
+	mesh->bound_min = mesh->vertex_buffer[0];
+	mesh->bound_max = mesh->vertex_buffer[0];
+
+	for (index = 1; index < mesh->vertex_count; index++)
+	{
+		vertex_t* vertex = &mesh->vertex_buffer[index];
+
+		if (vertex->x < mesh->bound_min.x) mesh->bound_min.x = vertex->x;
+		if (vertex->y < mesh->bound_min.y) mesh->bound_min.y = vertex->y;
+		if (vertex->z < mesh->bound_min.z) mesh->bound_min.z = vertex->z;
+		if (vertex->x > mesh->bound_max.x) mesh->bound_max.x = vertex->x;
+		if (vertex->y > mesh->bound_max.y) mesh->bound_max.y = vertex->y;
+		if (vertex->z > mesh->bound_max.z) mesh->bound_max.z = vertex->z;
+	}
+
+	return;
+}
+
+/* Move the mesh to compact storage, choose the narrowest index and optionally quantize the position */
+void compact_mesh(mesh_t* mesh, int quantize)
+{
+	int index;
+
+	/* Quantization need the bounding box */
+	compute_bounds(mesh);
+
+	/* 16 bit indices if every vertex can be addressed */
+	if (mesh->vertex_count <= 65536)
+	{
+		mesh->tris_buffer16 = (unsigned short*) malloc(mesh->tris_count * sizeof(unsigned short) * 3);
+
+		for (index = 0; index < mesh->tris_count*3; index++)
+			mesh->tris_buffer16[index] = (unsigned short) mesh->tris_buffer[index];
+
+		free(mesh->tris_buffer);
+		mesh->tris_buffer = NULL;
+	}
+
+	/* Quantize the position to 16 bit per axis against the bounding box */
+	if (quantize)
+	{
+		mesh->quant_step.x = (mesh->bound_max.x-mesh->bound_min.x)/65535;
+		mesh->quant_step.y = (mesh->bound_max.y-mesh->bound_min.y)/65535;
+		mesh->quant_step.z = (mesh->bound_max.z-mesh->bound_min.z)/65535;
+		mesh->quant_buffer = (unsigned short*) malloc(mesh->vertex_count * sizeof(unsigned short) * 3);
+
+		for (index = 0; index < mesh->vertex_count; index++)
+		{
+			vertex_t* vertex = &mesh->vertex_buffer[index];
+
+			/* Round to the nearest step, flat axis are stored as zero */
+			mesh->quant_buffer[index*3+0] = mesh->quant_step.x > 0 ? 
+				(unsigned short)((vertex->x-mesh->bound_min.x)/mesh->quant_step.x + 0.5f) : 0;
+			mesh->quant_buffer[index*3+1] = mesh->quant_step.y > 0 ? 
+				(unsigned short)((vertex->y-mesh->bound_min.y)/mesh->quant_step.y + 0.5f) : 0;
+			mesh->quant_buffer[index*3+2] = mesh->quant_step.z > 0 ? 
+				(unsigned short)((vertex->z-mesh->bound_min.z)/mesh->quant_step.z + 0.5f) : 0;
+		}
+
+		/* Rounding error is at most half a step on the widest axis */
+		mesh->quant_error = mesh->quant_step.x;
+		if (mesh->quant_step.y > mesh->quant_error) mesh->quant_error = mesh->quant_step.y;
+		if (mesh->quant_step.z > mesh->quant_error) mesh->quant_error = mesh->quant_step.z;
+		mesh->quant_error /= 2;
+
+		free_vertex(mesh);
+	}
+
+	return;
+}
+
+/* Get a vertex index from the tris buffer */
+int mesh_index(const mesh_t* mesh, int index)
+{
+	return mesh->tris_buffer16 ? mesh->tris_buffer16[index] : mesh->tris_buffer[index];
+}
+
+/* Get a vertex position, dequantize it if needed */
+void mesh_vertex(const mesh_t* mesh, int index, vertex_t* vertex)
+{
+	if (mesh->quant_buffer)
+	{
+		vertex->x = mesh->bound_min.x + mesh->quant_buffer[index*3+0]*mesh->quant_step.x;
+		vertex->y = mesh->bound_min.y + mesh->quant_buffer[index*3+1]*mesh->quant_step.y;
+		vertex->z = mesh->bound_min.z + mesh->quant_buffer[index*3+2]*mesh->quant_step.z;
+	}
+	else
+		*vertex = mesh->vertex_buffer[index];
+
+	return;
+}
+
+/* Mesh memory in bytes */
+unsigned long mesh_size(const mesh_t* mesh)
+{
+	unsigned long vertex_size = mesh->quant_buffer ? sizeof(unsigned short)*3 : sizeof(vertex_t);
+	unsigned long index_size = mesh->tris_buffer16 ? sizeof(unsigned short) : sizeof(int);
+
+	return vertex_size*mesh->vertex_count + index_size*mesh->tris_count*3;
+}
+
+/* Unique edge list, each edge hashed on its sorted vertex pair */
+int build_edges(mesh_t* mesh)
+{
+	int index, corner;
+	int table_size = 1;
+	int* table;
+
+	/* Open addressing table at most half full */
+	while (table_size < mesh->tris_count*6)
+		table_size *= 2;
+
+	table = (int*) malloc(table_size * sizeof(int));
+	mesh->edge_buffer = (int*) malloc(mesh->tris_count * sizeof(int) * 6);
+	mesh->edge_face = (int*) malloc(mesh->tris_count * sizeof(int) * 6);
+	mesh->edge_count = 0;
+
+	if (table == NULL || mesh->edge_buffer == NULL || mesh->edge_face == NULL)
+	{
+		free(table);
+		free(mesh->edge_buffer);
+		free(mesh->edge_face);
+		mesh->edge_buffer = NULL;
+		mesh->edge_face = NULL;
+		return 1;
+	}
+
+	for (index = 0; index < table_size; index++)
+		table[index] = -1;
+
+	for (index = 0; index < mesh->tris_count; index++)
+	{
+		for (corner = 0; corner < 3; corner++)
+		{
+			int from = mesh_index(mesh, index*3+corner);
+			int to = mesh_index(mesh, index*3+(corner+1) % 3);
+			int low = from < to ? from : to;
+			int high = from < to ? to : from;
+			unsigned int hash = ((unsigned int)low*73856093u) ^ ((unsigned int)high*19349663u);
+			int slot = (int)(hash & (table_size-1));
+			int* edge;
+
+			/* A collapsed edge draws nothing */
+			if (from == to)
+				continue;
+
+			/* Find the edge or add it */
+			while (table[slot] != -1 && (mesh->edge_buffer[table[slot]*2] != low ||
+				mesh->edge_buffer[table[slot]*2+1] != high))
+				slot = (slot+1) & (table_size-1);
+
+			if (table[slot] == -1)
+			{
+				table[slot] = mesh->edge_count;
+				mesh->edge_buffer[mesh->edge_count*2] = low;
+				mesh->edge_buffer[mesh->edge_count*2+1] = high;
+				mesh->edge_face[mesh->edge_count*2] = index;
+				mesh->edge_face[mesh->edge_count*2+1] = -1;
+				mesh->edge_count++;
+				continue;
+			}
+
+			/* Second face, an edge shared by more keeps the first two */
+			edge = &mesh->edge_face[table[slot]*2];
+			if (edge[1] == -1 && edge[0] != index)
+				edge[1] = index;
+		}
+	}
+
+	mesh->edge_buffer = (int*) realloc(mesh->edge_buffer, (mesh->edge_count > 0 ? mesh->edge_count : 1) * sizeof(int) * 2);
+	mesh->edge_face = (int*) realloc(mesh->edge_face, (mesh->edge_count > 0 ? mesh->edge_count : 1) * sizeof(int) * 2);
+	free(table);
+
+	return 0;
+}
+
+/* Simplify with quadric error vertex clustering on a grid over the bounding box */
+int simplify_mesh(const mesh_t* source, mesh_t* target, int grid)
+{
+	int index, vertex;
+	int cluster_count = 0;
+	int tris_count = 0;
+	int table_size = 1;
+	int* table;
+	int* vertex_cluster;
+	cluster_t* cluster;
+	const vertex_t* min = &source->bound_min;
+	float cell = source->bound_max.x - min->x;
+
+	/* Cubic cells sized on the widest axis */
+	if (source->bound_max.y - min->y > cell) cell = source->bound_max.y - min->y;
+	if (source->bound_max.z - min->z > cell) cell = source->bound_max.z - min->z;
+	cell /= grid;
+
+	if (cell <= 0 || source->vertex_count <= 0)
+		return 1;
+
+	/* Open addressing table from cell to cluster, at most a cluster per vertex */
+	while (table_size < source->vertex_count*2)
+		table_size *= 2;
+
+	table = (int*) malloc(table_size * sizeof(int));
+	vertex_cluster = (int*) malloc(source->vertex_count * sizeof(int));
+	cluster = (cluster_t*) calloc(source->vertex_count, sizeof(cluster_t));
+
+	for (index = 0; index < table_size; index++)
+		table[index] = -1;
+
+	/* Assign every vertex to the cluster of its cell */
+	for (vertex = 0; vertex < source->vertex_count; vertex++)
+	{
+		const vertex_t* position = &source->vertex_buffer[vertex];
+		int cell_x = (int)((position->x - min->x)/cell);
+		int cell_y = (int)((position->y - min->y)/cell);
+		int cell_z = (int)((position->z - min->z)/cell);
+		int key, slot;
+
+		/* The max bound fall in the last cell */
+		cell_x = (cell_x < grid) ? cell_x : grid-1;
+		cell_y = (cell_y < grid) ? cell_y : grid-1;
+		cell_z = (cell_z < grid) ? cell_z : grid-1;
+		key = cell_x + grid*(cell_y + grid*cell_z);
+
+		/* Find the cell or add it */
+		slot = (int)(((unsigned int)key*2654435761u) & (unsigned int)(table_size-1));
+		while (table[slot] != -1 && cluster[table[slot]].key != key)
+			slot = (slot+1) & (table_size-1);
+
+		if (table[slot] == -1)
+		{
+			table[slot] = cluster_count;
+			cluster[cluster_count].key = key;
+			cluster_count++;
+		}
+
+		/* Keep the sum for the fallback position */
+		vertex_cluster[vertex] = table[slot];
+		cluster[table[slot]].count++;
+		cluster[table[slot]].sum[0] += position->x;
+		cluster[table[slot]].sum[1] += position->y;
+		cluster[table[slot]].sum[2] += position->z;
+	}
+
+	/* Add the plane of every face to the clusters of its vertex */
+	for (index = 0; index < source->tris_count; index++)
+	{
+		const vertex_t* vertex0 = &source->vertex_buffer[source->tris_buffer[index*3+0]];
+		const vertex_t* vertex1 = &source->vertex_buffer[source->tris_buffer[index*3+1]];
+		const vertex_t* vertex2 = &source->vertex_buffer[source->tris_buffer[index*3+2]];
+		double edge0[3], edge1[3], plane[4], length2;
+
+		edge0[0] = vertex1->x-vertex0->x; edge0[1] = vertex1->y-vertex0->y; edge0[2] = vertex1->z-vertex0->z;
+		edge1[0] = vertex2->x-vertex0->x; edge1[1] = vertex2->y-vertex0->y; edge1[2] = vertex2->z-vertex0->z;
+
+		plane[0] = edge0[1]*edge1[2] - edge0[2]*edge1[1];
+		plane[1] = edge0[2]*edge1[0] - edge0[0]*edge1[2];
+		plane[2] = edge0[0]*edge1[1] - edge0[1]*edge1[0];
+		plane[3] = -(plane[0]*vertex0->x + plane[1]*vertex0->y + plane[2]*vertex0->z);
+		length2 = plane[0]*plane[0] + plane[1]*plane[1] + plane[2]*plane[2];
+
+		/* Degenerate face has no plane */
+		if (length2 == 0)
+			continue;
+
+		/* Outer product of the plane, divided by the squared normal length to normalize it */
+		for (vertex = 0; vertex < 3; vertex++)
+		{
+			double* quadric = cluster[vertex_cluster[source->tris_buffer[index*3+vertex]]].quadric;
+
+			quadric[0] += plane[0]*plane[0]/length2;
+			quadric[1] += plane[0]*plane[1]/length2;
+			quadric[2] += plane[0]*plane[2]/length2;
+			quadric[3] += plane[0]*plane[3]/length2;
+			quadric[4] += plane[1]*plane[1]/length2;
+			quadric[5] += plane[1]*plane[2]/length2;
+			quadric[6] += plane[1]*plane[3]/length2;
+			quadric[7] += plane[2]*plane[2]/length2;
+			quadric[8] += plane[2]*plane[3]/length2;
+			quadric[9] += plane[3]*plane[3]/length2;
+		}
+	}
+
+	/* Alloc the simplified mesh, never bigger than the source */
+	free_mesh(target);
+	target->vertex_buffer = (vertex_t*) malloc(cluster_count * sizeof(vertex_t));
+	target->tris_buffer = (int*) malloc(source->tris_count * sizeof(int) * 3);
+	target->vertex_count = cluster_count;
+	target->lod_error = cell;
+
+	/* Place each cluster on its quadric minimum */
+	for (index = 0; index < cluster_count; index++)
+	{
+		double* q = cluster[index].quadric;
+		double mean[3], solution[3], trace, determinant;
+		int cell_x = cluster[index].key % grid;
+		int cell_y = cluster[index].key / grid % grid;
+		int cell_z = cluster[index].key / grid / grid;
+
+		mean[0] = cluster[index].sum[0]/cluster[index].count;
+		mean[1] = cluster[index].sum[1]/cluster[index].count;
+		mean[2] = cluster[index].sum[2]/cluster[index].count;
+
+		/* Solve the 3x3 system with Cramer rule */
+		determinant = q[0]*(q[4]*q[7]-q[5]*q[5]) - q[1]*(q[1]*q[7]-q[5]*q[2]) + q[2]*(q[1]*q[5]-q[4]*q[2]);
+		trace = (q[0]+q[4]+q[7])/3;
+
+		if (determinant > 1e-3*trace*trace*trace)
+		{
+			solution[0] = (-q[3]*(q[4]*q[7]-q[5]*q[5]) - q[1]*(-q[6]*q[7]+q[5]*q[8]) + 
+					q[2]*(-q[6]*q[5]+q[4]*q[8]))/determinant;
+			solution[1] = (q[0]*(-q[6]*q[7]+q[8]*q[5]) + q[3]*(q[1]*q[7]-q[5]*q[2]) + 
+					q[2]*(-q[1]*q[8]+q[6]*q[2]))/determinant;
+			solution[2] = (q[0]*(-q[4]*q[8]+q[5]*q[6]) - q[1]*(-q[1]*q[8]+q[6]*q[2]) - 
+					q[3]*(q[1]*q[5]-q[4]*q[2]))/determinant;
+		}
+
+		/* Flat or unstable cluster, use the mean */
+		else
+		{
+			solution[0] = mean[0];
+			solution[1] = mean[1];
+			solution[2] = mean[2];
+		}
+
+		/* Too far from its cell, use the mean */
+		if (solution[0] < min->x + (cell_x-0.5)*cell || solution[0] > min->x + (cell_x+1.5)*cell ||
+			solution[1] < min->y + (cell_y-0.5)*cell || solution[1] > min->y + (cell_y+1.5)*cell ||
+			solution[2] < min->z + (cell_z-0.5)*cell || solution[2] > min->z + (cell_z+1.5)*cell)
+		{
+			solution[0] = mean[0];
+			solution[1] = mean[1];
+			solution[2] = mean[2];
+		}
+
+		target->vertex_buffer[index].x = (float)solution[0];
+		target->vertex_buffer[index].y = (float)solution[1];
+		target->vertex_buffer[index].z = (float)solution[2];
+	}
+
+	/* Keep the tris spanning three clusters */
+	for (index = 0; index < source->tris_count; index++)
+	{
+		int cluster0 = vertex_cluster[source->tris_buffer[index*3+0]];
+		int cluster1 = vertex_cluster[source->tris_buffer[index*3+1]];
+		int cluster2 = vertex_cluster[source->tris_buffer[index*3+2]];
+
+		if (cluster0 != cluster1 && cluster1 != cluster2 && cluster2 != cluster0)
+		{
+			target->tris_buffer[tris_count*3+0] = cluster0;
+			target->tris_buffer[tris_count*3+1] = cluster1;
+			target->tris_buffer[tris_count*3+2] = cluster2;
+			tris_count++;
+		}
+	}
+
+	target->tris_count = tris_count;
+	compute_bounds(target);
+
+	free(table);
+	free(vertex_cluster);
+	free(cluster);
+
+	return 0;
+}
+
+/* Build the coarser levels from the loaded mesh, halving the grid every level */
+void build_lod_chain()
+{
+	int grid = LOD_MIN_GRID;
+
+	/* Start around the vertex spacing of the mesh */
+	while (grid < LOD_MAX_GRID && grid*grid < lod_chain[0].vertex_count)
+		grid *= 2;
+
+	compute_bounds(&lod_chain[0]);
+
+	for (lod_count = 1; lod_count < LOD_MAX && grid >= LOD_MIN_GRID; grid /= 2)
+	{
+		mesh_t* level = &lod_chain[lod_count];
+
+		if (simplify_mesh(&lod_chain[0], level, grid))
+			break;
+
+		/* Drop a level that barely simplify the previous one */
+		if (level->tris_count == 0 || level->tris_count > lod_chain[lod_count-1].tris_count*3/4)
+		{
+			free_mesh(level);
+			continue;
+		}
+
+		lod_count++;
+	}
+
+	return;
+}
+
+/* Coarsest level whose error is smaller than a cell once projected */
+int select_lod()
+{
+	int level, axis;
+	float scale2 = 0;
+	float near, far, cell_size;
+
+	/* Pinned level */
+	if (lod_pin >= 0)
+		return lod_pin;
+
+	/* Widest scale of the transform, squared */
+	for (axis = 0; axis < 3; axis++)
+	{
+		float length2 = transform[axis][0]*transform[axis][0] + transform[axis][1]*transform[axis][1] +
+				transform[axis][2]*transform[axis][2];
+
+		if (length2 > scale2)
+			scale2 = length2;
+	}
+
+	/* Distance used by the projection, the nearest mesh point in perspective */
+	if (ortho)
+		near = transform[3][2] < 0 ? -transform[3][2] : transform[3][2];
+	else
+		view_depth_range(&lod_chain[0], &near, &far);
+
+	if (near <= 0)
+		return 0;
+
+	/* World size of a cell at that distance */
+	cell_size = near/(buffer_width > buffer_height*screen_rateo ? buffer_width : buffer_height*screen_rateo);
+
+	for (level = lod_count-1; level > 0; level--)
+	{
+		if (lod_chain[level].lod_error*lod_chain[level].lod_error*scale2 <= 
+			LOD_CELL_ERROR*LOD_CELL_ERROR*cell_size*cell_size)
+			break;
+	}
+
+	return level;
+}
+
+/* Translate the mesh */
+void translate(float x, float y, float z) 
+{
+	/* Add translation directly to the matrix */
+	transform[3][0] -= x;
+	transform[3][1] += y;
+	transform[3][2] += z;
+
+	return;
+}
+
+/* Update transform matrix for scale and rotation */
+void update_transform(float update[3][3])
+{
+	int row, col, dot_index;
+
+	/* Copy old transform */
+	float copy[4][4];
+	for (row = 0; row < 4; row++)
+	{
+		for (col = 0; col < 4; col++)
+		{
+			copy[col][row] = transform[col][row];
+		}
+	}
+
+	/* Multiply the update * transform using the copy */
+	for (row = 0; row < 3; row++)
+	{
+		for (col = 0; col < 3; col++)
+		{
+			transform[col][row] = 0;
+
+			for (dot_index = 0; dot_index < 3; dot_index++)
+			{
+				transform[col][row] += update[dot_index][row]*copy[col][dot_index];
+			}
+		}
+	}
+
+	return;
+}
+
+/* Scale the mesh */
+void scale(float x, float y, float z)
+{
+	int row, col;
+	float update_mat[3][3];
+
+	/* Create empty matrix */
+	for (row = 0; row < 3; row++)
+	{
+		for (col = 0; col < 3; col++)
+		{
+			update_mat[col][row] = 0;
+		}
+	}
+
+	/* Add scale */
+	update_mat[0][0] = x;
+	update_mat[1][1] = y;
+	update_mat[2][2] = z;
+
+	/* Update global matrix */
+	update_transform(update_mat);
+
+	return;
+}
+
+/* Rotate the mesh on X axis */
+void rotate_x(float x)
+{
+	int row, col;
+	float sin_rot, cos_rot;
+	float update_mat[3][3];
+
+	/* Create empty matrix */
+	for (row = 0; row < 3; row++)
+	{
+		for (col = 0; col < 3; col++)
+		{
+			update_mat[col][row] = 0;
+		}
+	}
+
+	/* Compute sine and cosine */
+	sin_rot = sine(x);
+	cos_rot = cosine(x);
+
+	/* Add rotation */
+	update_mat[1][1] = cos_rot;
+	update_mat[1][2] = sin_rot;
+	update_mat[2][2] = cos_rot;
+	update_mat[2][1] = -sin_rot;
+	update_mat[0][0] = 1.f;
+
+	/* Update global matrix */
+	update_transform(update_mat);
+
+	return;
+}
+
+/* Rotate the mesh on Y axis */
+void rotate_y(float y)
+{
+	int row, col;
+	float sin_rot, cos_rot;
+	float update_mat[3][3];
+
+	/* Create empty matrix */
+	for (row = 0; row < 3; row++)
+	{
+		for (col = 0; col < 3; col++)
+		{
+			update_mat[col][row] = 0;
+		}
+	}
+	
+	/* Compute sine and cosine */
+	sin_rot = sine(y);
+	cos_rot = cosine(y);
+
+	/* Add rotation */
+	update_mat[0][0] = cos_rot;
+	update_mat[2][0] = -sin_rot;
+	update_mat[0][2] = sin_rot;
+	update_mat[2][2] = cos_rot;
+	update_mat[1][1] = 1.f;
+
+	/* Update global matrix */
+	update_transform(update_mat);
+
+	return;
+}
+
+/* Rotate the mesh on Z axis */
+void rotate_z(float z)
+{
+	int row, col;
+	float sin_rot, cos_rot;
+	float update_mat[3][3];
+
+	/* Create empty matrix */
+	for (row = 0; row < 3; row++)
+	{
+		for (col = 0; col < 3; col++)
+		{
+			update_mat[col][row] = 0;
+		}
+	}
+
+	/* Compute sine and cosine */
+	sin_rot = sine(-z);
+	cos_rot = cosine(-z);
+
+	/* Add rotation */
+	update_mat[0][0] = cos_rot;
+	update_mat[0][1] = sin_rot;
+	update_mat[1][0] = -sin_rot;
+	update_mat[1][1] = cos_rot;
+	update_mat[2][2] = 1.f;
+
+	/* Update global matrix */
+	update_transform(update_mat);
+
+	return;
+}
+
+/* Clear the screen and depth buffer */
+void clear_buffer()
+{
+	int row, col;
+	for (row = 0; row < buffer_height; row++)
+	{	
+		for (col = 0; col < buffer_width; col++)
+		{
+			screen_buffer[col+row*buffer_width] = ' ';
+		}
+	}
+
+	/* Zero is the farthest value in every format */
+	if (depth_mode == DEPTH_FIXED16)
+		memset(depth_buffer16, 0, sizeof(unsigned short) * buffer_width * buffer_height);
+	else
+		memset(depth_buffer, 0, sizeof(float) * buffer_width * buffer_height);
+
+	if (deferred)
+		memset(id_buffer, 0xFF, sizeof(unsigned int) * buffer_width * buffer_height);
+
+	if (glyph_mode != GLYPH_TEXT)
+		memset(coverage_buffer, 0, output_width * output_height);
+
+	return;
+}
+
+/* Restore position */
+void restore_mesh()
+{
+	int row, col;
+	
+	/* Restore identity matrix */
+	for (col = 0; col < 4; col++)
+	{
+		for (row = 0; row < 4; row++)
+		{
+			if (col == row)
+				transform[col][row] = 1;
+			else
+				transform[col][row] = 0;
+		}
+	}
+
+	/* Translate and rotate for initial view */
+	translate(0, 0, START_Z);
+	rotate_y(PI);
+
+	/* Or move back just enough to see the whole mesh */
+	if (auto_fit)
+		fit_view();
+
+	return;
+}
+
+/* Vertex stage, apply a transform matrix to every mesh vertex */
+void transform_vertices(const mesh_t* mesh, float matrix[4][4], vertex_t* view)
+{
+	int index;
+
+	/* Quantized input, fold the dequantization into the matrix */
+	if (mesh->quant_buffer)
+	{
+		int row;
+		float folded[4][3];
+		const unsigned short* quant = mesh->quant_buffer;
+
+		/* Scale by the step and move the origin to the box corner */
+		for (row = 0; row < 3; row++)
+		{
+			folded[0][row] = matrix[0][row]*mesh->quant_step.x;
+			folded[1][row] = matrix[1][row]*mesh->quant_step.y;
+			folded[2][row] = matrix[2][row]*mesh->quant_step.z;
+			folded[3][row] = matrix[3][row]+matrix[0][row]*mesh->bound_min.x+
+					matrix[1][row]*mesh->bound_min.y+matrix[2][row]*mesh->bound_min.z;
+		}
+
+		for (index = 0; index < mesh->vertex_count; index++)
+		{
+			view[index].x = folded[0][0]*quant[index*3+0]+folded[1][0]*quant[index*3+1]+
+					folded[2][0]*quant[index*3+2]+folded[3][0];
+			view[index].y = folded[0][1]*quant[index*3+0]+folded[1][1]*quant[index*3+1]+
+					folded[2][1]*quant[index*3+2]+folded[3][1];
+			view[index].z = folded[0][2]*quant[index*3+0]+folded[1][2]*quant[index*3+1]+
+					folded[2][2]*quant[index*3+2]+folded[3][2];
+		}
+	}
+
+	/* Full precision input */
+	else
+	{
+		const vertex_t* vertex = mesh->vertex_buffer;
+
+		for (index = 0; index < mesh->vertex_count; index++)
+		{
+			/* Multiply with transform matrix */
+			view[index].x = matrix[0][0]*vertex[index].x+matrix[1][0]*vertex[index].y+
+					matrix[2][0]*vertex[index].z+matrix[3][0];
+			view[index].y = matrix[0][1]*vertex[index].x+matrix[1][1]*vertex[index].y+
+					matrix[2][1]*vertex[index].z+matrix[3][1];
+			view[index].z = matrix[0][2]*vertex[index].x+matrix[1][2]*vertex[index].y+
+					matrix[2][2]*vertex[index].z+matrix[3][2];
+		}
+	}
+
+	return;
+}
+
+/* View depth range of the transformed mesh bounding box, starting from the near plane */
+void view_depth_range(const mesh_t* mesh, float* near, float* far)
+{
+	int corner;
+
+	/* Z of the 8 box corners */
+	for (corner = 0; corner < 8; corner++)
+	{
+		float x = (corner & 1) ? mesh->bound_max.x : mesh->bound_min.x;
+		float y = (corner & 2) ? mesh->bound_max.y : mesh->bound_min.y;
+		float z = (corner & 4) ? mesh->bound_max.z : mesh->bound_min.z;
+		float view_z = transform[0][2]*x + transform[1][2]*y + transform[2][2]*z + transform[3][2];
+
+		if (corner == 0 || view_z < *near)
+			*near = view_z;
+		if (corner == 0 || view_z > *far)
+			*far = view_z;
+	}
+
+	/* Nothing is rendered before the near plane */
+	if (*near < NEAR_PLANE)
+		*near = NEAR_PLANE;
+	if (*far < *near*1.001f)
+		*far = *near*1.001f;
+
+	return;
+}
+
+/* Test a box through a transform against the view, margin is the extra screen fraction accepted on every side */
+int box_visible(const vertex_t* min, const vertex_t* max, float matrix[4][4], float margin)
+{
+	int corner;
+	int behind = 0;
+	int outside = 15;
+	float limit_x = buffer_width*margin;
+	float limit_y = buffer_height*margin;
+
+	for (corner = 0; corner < 8; corner++)
+	{
+		float x = (corner & 1) ? max->x : min->x;
+		float y = (corner & 2) ? max->y : min->y;
+		float z = (corner & 4) ? max->z : min->z;
+		float view_x = matrix[0][0]*x + matrix[1][0]*y + matrix[2][0]*z + matrix[3][0];
+		float view_y = matrix[0][1]*x + matrix[1][1]*y + matrix[2][1]*z + matrix[3][1];
+		float view_z = matrix[0][2]*x + matrix[1][2]*y + matrix[2][2]*z + matrix[3][2];
+		float depth, screen_x, screen_y;
+
+		/* A box crossing the near plane can not be rejected by its projection */
+		if (view_z < NEAR_PLANE)
+		{
+			behind++;
+			outside = 0;
+			continue;
+		}
+
+		/* Same projection as the raster kernel */
+		depth = ortho ? -transform[3][2] : -view_z;
+		screen_x = view_x / depth * buffer_width + buffer_width/2;
+		screen_y = view_y / depth * buffer_height * screen_rateo + buffer_height/2;
+
+		/* Keep the sides every corner is out of */
+		outside &= (screen_x < -limit_x) | (screen_x > buffer_width+limit_x) << 1 |
+			(screen_y < -limit_y) << 2 | (screen_y > buffer_height+limit_y) << 3;
+	}
+
+	return behind < 8 && outside == 0;
+}
+
+/* Fit the depth range on the transformed mesh bounding box */
+void update_depth_range(const mesh_t* mesh)
+{
+	float near, far;
+
+	view_depth_range(mesh, &near, &far);
+
+	/* Linear in 1/z, so it can still be interpolated */
+	depth_scale = 1/(1/near - 1/far);
+	depth_bias = -depth_scale/far;
+
+	return;
+}
+
+/* Snap a screen coordinate to the subpixel grid, round half away from zero */
+int to_fixed(float coordinate)
+{
+	/* Clamp in the guard band, so the edge functions can not overflow */
+	if (!(coordinate > -GUARD_BAND))
+		coordinate = -GUARD_BAND;
+	if (coordinate > GUARD_BAND)
+		coordinate = GUARD_BAND;
+
+	coordinate *= SUBPIXEL_ONE;
+
+	return (coordinate < 0) ? -(int)(-coordinate + 0.5f) : (int)(coordinate + 0.5f);
+}
+
+/* Depth buffer memory in bytes */
+unsigned long depth_size()
+{
+	unsigned long cell_size = (depth_mode == DEPTH_FIXED16) ? sizeof(unsigned short) : sizeof(float);
+
+	return cell_size * buffer_width * buffer_height;
+}
+
+/* Smallest depth difference told apart at the far end of the mesh range */
+float depth_step()
+{
+	float far = -depth_scale/depth_bias;
+
+	/* Float keeps the relative precision of 1/z, 16 bit splits the 1/z range in even steps */
+	if (depth_mode == DEPTH_FIXED16)
+		return far*far/(depth_scale*65534);
+
+	return far*FLT_EPSILON;
+}
+
+/* Raster the mesh, the mode arguments are constant in every specialization so no test is left in the loops */
+static KERNEL_INLINE void raster_mesh(const mesh_t* mesh, const tile_t* tile, const int is_ortho, const int use_light, 
+					const int format, const int wide_index, const int visibility, const int coverage)
+{
+	int tris, vertex;
+	int x, y;
+	unsigned int material_index = 0;
+
+	/* Target of the raster: every tris on the frame buffers, or the tris binned on a tile of a larger image */
+	const int* const tris_list = tile != NULL ? tile->tris_list : NULL;
+	const int count = tris_list != NULL ? tile->tris_count : mesh->tris_count;
+	const vertex_t* const view = tile != NULL ? tile->view : view_buffer;
+	const int image_width = tile != NULL ? tile->image_width : buffer_width;
+	const int image_height = tile != NULL ? tile->image_height : buffer_height;
+	const float rateo = tile != NULL ? tile->rateo : screen_rateo;
+	const float ortho_distance = tile != NULL ? tile->ortho_distance : -transform[3][2];
+	const int target_width = tile != NULL ? tile->width : buffer_width;
+	const int target_height = tile != NULL ? tile->height : buffer_height;
+	char* const target_screen = tile != NULL ? tile->screen : screen_buffer;
+	float* const target_depth = tile != NULL ? tile->depth : depth_buffer;
+
+	/* Samples per cell as shifts, the cell row of the coverage buffer */
+	const int shift_x = glyph_shift_x[glyph_mode];
+	const int shift_y = glyph_shift_y[glyph_mode];
+	const int cell_width = buffer_width >> shift_x;
+
+	/* Used for near plane culling when we split a tris in 2 */
+	int last_half_rendered = 0;
+
+	for (tris = 0; tris < count; tris++) 
+	{
+		/* Index of the tris in the mesh */
+		const int index = tris_list != NULL ? tris_list[tris] : tris;
+
+		/* Subpixel vertex, twice the area and its inverse */
+		int fixed_x[3], fixed_y[3];
+		long long area;
+		float inverse_area;
+
+		/* Edge function values, steps and fill rule bias */
+		long long edge_row[3], step_x[3], step_y[3];
+		int bias[3];
+
+		/* Get the bounding coordinate of the tris */
+		int min_x, min_y, max_x, max_y;
+		int behind_near = 0;
+
+		/* Transformed vertex */
+		vertex_t vertex_arr[3];
+
+		/* Face normal and lighting */
+		vertex_t normal, edge0, edge1;
+		float light = 0;
+
+		/* Id kept by the visibility buffer, both halves of a split tris share it */
+		unsigned int tris_id = index;
+
+		/* Coverage bit of the tris samples: lit, or any in material mode */
+		int sample_on = 1;
+	
+		/* Every tris with the next material, both halves of a split tris share it */
+		material_index = (index+1) % (sizeof(material_array)/sizeof(material_array[0]));
+
+		for (vertex = 0; vertex < 3; vertex++)
+		{
+			/* Fetch the transformed vertex */
+			vertex_arr[vertex] = view[wide_index ? mesh->tris_buffer[index*3+vertex] : 
+						mesh->tris_buffer16[index*3+vertex]];
+
+			/* Count vertex behind near plane */
+			if (vertex_arr[vertex].z < NEAR_PLANE)
+				behind_near++;
+		}
+
+		/* Near plane clipping nad culling */
+		if (behind_near > 0)
+		{
+			/* If all vertex are behind */
+			if (behind_near == 3)
+			{
+				/* Skip the tris */
+				continue;
+			}
+
+			/* If we have 1 or 2 vertex behind */
+			else
+			{
+				/* Find the 2 point of intersection with the near plane */
+				vertex_t intersect[2];
+				int id[3];
+
+				/* Set id[0] as id of the one on the different side */
+				if ((vertex_arr[0].z >= NEAR_PLANE && behind_near == 2) ||
+					(vertex_arr[0].z < NEAR_PLANE && behind_near == 1))
+				{
+					id[0] = 0;
+					id[1] = 1;
+					id[2] = 2;
+				}
+				else if ((vertex_arr[1].z >= NEAR_PLANE && behind_near == 2) ||
+					(vertex_arr[1].z < NEAR_PLANE && behind_near == 1))
+				{
+					id[0] = 1;
+					id[1] = 0;
+					id[2] = 2;
+				}
+				else
+				{
+					id[0] = 2;
+					id[1] = 0;
+					id[2] = 1;
+				}
+
+				/* Calculate the intersection point, check alignment first */
+				intersect[0].x = (vertex_arr[id[0]].x == vertex_arr[id[1]].x) ? vertex_arr[id[0]].x :
+						vertex_arr[id[0]].x + (NEAR_PLANE-vertex_arr[id[0]].z)*
+						(vertex_arr[id[0]].x-vertex_arr[id[1]].x)/(vertex_arr[id[0]].z-vertex_arr[id[1]].z);
+
+				intersect[0].y = (vertex_arr[id[0]].y == vertex_arr[id[1]].y) ? vertex_arr[id[0]].y :
+						vertex_arr[id[0]].y + (NEAR_PLANE-vertex_arr[id[0]].z)*
+						(vertex_arr[id[0]].y-vertex_arr[id[1]].y)/(vertex_arr[id[0]].z-vertex_arr[id[1]].z);
+				
+				intersect[1].x = (vertex_arr[id[0]].x == vertex_arr[id[2]].x) ? vertex_arr[id[0]].x :
+						vertex_arr[id[0]].x + (NEAR_PLANE-vertex_arr[id[0]].z)*
+						(vertex_arr[id[0]].x-vertex_arr[id[2]].x)/(vertex_arr[id[0]].z-vertex_arr[id[2]].z);
+
+				intersect[1].y = (vertex_arr[id[0]].y == vertex_arr[id[2]].y) ? vertex_arr[id[0]].y :
+						vertex_arr[id[0]].y + (NEAR_PLANE-vertex_arr[id[0]].z)*
+						(vertex_arr[id[0]].y-vertex_arr[id[2]].y)/(vertex_arr[id[0]].z-vertex_arr[id[2]].z);
+				
+				/* Create new tris */
+				if (behind_near == 2)
+				{
+					/* The vertex in front is kept, the other 2 become the intersect */
+					vertex_arr[0].x = vertex_arr[id[0]].x;
+					vertex_arr[0].y = vertex_arr[id[0]].y;
+					vertex_arr[0].z = vertex_arr[id[0]].z;
+
+					vertex_arr[1].x = intersect[0].x;
+					vertex_arr[1].y = intersect[0].y;
+					vertex_arr[1].z = NEAR_PLANE;
+
+					vertex_arr[2].x = intersect[1].x;
+					vertex_arr[2].y = intersect[1].y;
+					vertex_arr[2].z = NEAR_PLANE;
+				}
+				else
+				{
+					/* If we have 2 vertex in front we need to create 2 tris */
+					last_half_rendered = !last_half_rendered;
+
+					/* Check with tris we rendered last time */
+					if (last_half_rendered)
+					{
+						/* Create the first tris */
+						vertex_t tmp;
+
+						tmp.x = vertex_arr[id[1]].x;
+						tmp.y = vertex_arr[id[1]].y;
+						tmp.z = vertex_arr[id[1]].z;
+
+						vertex_arr[2].x = vertex_arr[id[2]].x;
+						vertex_arr[2].y = vertex_arr[id[2]].y;
+						vertex_arr[2].z = vertex_arr[id[2]].z;
+	
+						vertex_arr[1].x = tmp.x;
+						vertex_arr[1].y = tmp.y;
+						vertex_arr[1].z = tmp.z;
+
+						vertex_arr[0].x = intersect[0].x;
+						vertex_arr[0].y = intersect[0].y;
+						vertex_arr[0].z = NEAR_PLANE;
+
+						/* Decrease tris, so we get the same tris next cycle */
+						tris--;
+					}
+					else
+					{	
+						/* Create the second tris */
+						vertex_arr[2].x = vertex_arr[id[2]].x;
+						vertex_arr[2].y = vertex_arr[id[2]].y;
+						vertex_arr[2].z = vertex_arr[id[2]].z;
+				
+						vertex_arr[0].x = intersect[1].x;
+						vertex_arr[0].y = intersect[1].y;
+						vertex_arr[0].z = NEAR_PLANE;
+
+						vertex_arr[1].x = intersect[0].x;
+						vertex_arr[1].y = intersect[0].y;
+						vertex_arr[1].z = NEAR_PLANE;
+					}
+				}
+			}
+		}
+
+		/* Face normal and light intensity */
+		if (use_light)
+		{
+			/* Compute face normal as cross product */
+			edge0.x = vertex_arr[0].x-vertex_arr[2].x;
+			edge0.y = vertex_arr[0].y-vertex_arr[2].y;
+			edge0.z = vertex_arr[0].z-vertex_arr[2].z;
+			edge1.x = vertex_arr[1].x-vertex_arr[2].x;
+			edge1.y = vertex_arr[1].y-vertex_arr[2].y;
+			edge1.z = vertex_arr[1].z-vertex_arr[2].z;
+
+			normal.x = edge0.y*edge1.z - edge0.z*edge1.y;
+			normal.y = edge0.z*edge1.x - edge0.x*edge1.z;
+			normal.z = edge0.x*edge1.y - edge0.y*edge1.x;
+	
+			/* Compute light factor */
+			light = normal.x*-LIGHT_POS_X+normal.y*LIGHT_POS_Y+normal.z*LIGHT_POS_Z;
+		
+			/* Flip normal if its a backward */
+			if (normal.z > 0) 
+				light *= -1;
+
+			if (coverage)
+				sample_on = light >= 0;
+		}
+		
+		/* Raster vertex to screen */
+		for (vertex = 0; vertex < 3; vertex++)
+		{
+			/* Orthographic projection */
+			if (is_ortho)
+			{
+				vertex_arr[vertex].x = (vertex_arr[vertex].x / ortho_distance * image_width) + image_width/2;
+				vertex_arr[vertex].y = (vertex_arr[vertex].y / ortho_distance * image_height)*rateo + image_height/2;
+			}
+
+			/* Perspective projection */
+			else
+			{
+				vertex_arr[vertex].x = (vertex_arr[vertex].x / -vertex_arr[vertex].z * image_width) + image_width/2;
+				vertex_arr[vertex].y = (vertex_arr[vertex].y / -vertex_arr[vertex].z * image_height)*rateo + image_height/2;
+			}
+
+			/* Snap to the subpixel grid, then move the origin to the tile corner */
+			fixed_x[vertex] = to_fixed(vertex_arr[vertex].x);
+			fixed_y[vertex] = to_fixed(vertex_arr[vertex].y);
+
+			if (tile != NULL)
+			{
+				fixed_x[vertex] -= tile->x << SUBPIXEL_BITS;
+				fixed_y[vertex] -= tile->y << SUBPIXEL_BITS;
+			}
+		}
+
+		/* Twice the signed area, skip degenerate tris */
+		area = (long long)(fixed_x[1]-fixed_x[0])*(fixed_y[2]-fixed_y[0]) -
+			(long long)(fixed_y[1]-fixed_y[0])*(fixed_x[2]-fixed_x[0]);
+
+		if (area == 0)
+			continue;
+
+		/* Keep a single winding, swap the last two vertex */
+		if (area < 0)
+		{
+			int tmp_fixed;
+			float tmp_z;
+
+			tmp_fixed = fixed_x[1]; fixed_x[1] = fixed_x[2]; fixed_x[2] = tmp_fixed;
+			tmp_fixed = fixed_y[1]; fixed_y[1] = fixed_y[2]; fixed_y[2] = tmp_fixed;
+			tmp_z = vertex_arr[1].z; vertex_arr[1].z = vertex_arr[2].z; vertex_arr[2].z = tmp_z;
+
+			area = -area;
+		}
+
+		/* Get boundaries, first and last pixel center inside the subpixel box */
+		min_x = fixed_x[0] < fixed_x[1] ? fixed_x[0] : fixed_x[1];
+		min_x = min_x < fixed_x[2] ? min_x : fixed_x[2];
+		max_x = fixed_x[0] > fixed_x[1] ? fixed_x[0] : fixed_x[1];
+		max_x = max_x > fixed_x[2] ? max_x : fixed_x[2];
+		min_y = fixed_y[0] < fixed_y[1] ? fixed_y[0] : fixed_y[1];
+		min_y = min_y < fixed_y[2] ? min_y : fixed_y[2];
+		max_y = fixed_y[0] > fixed_y[1] ? fixed_y[0] : fixed_y[1];
+		max_y = max_y > fixed_y[2] ? max_y : fixed_y[2];
+
+		/* Check boundaries */
+		min_x = (min_x <= 0) ? 0 : (min_x + SUBPIXEL_ONE-1) >> SUBPIXEL_BITS;
+		min_y = (min_y <= 0) ? 0 : (min_y + SUBPIXEL_ONE-1) >> SUBPIXEL_BITS;
+		max_x = (max_x < 0) ? -1 : max_x >> SUBPIXEL_BITS;
+		max_y = (max_y < 0) ? -1 : max_y >> SUBPIXEL_BITS;
+		max_x = (max_x > target_width-1) ? target_width-1 : max_x;
+		max_y = (max_y > target_height-1) ? target_height-1 : max_y;
+
+		/* Edge functions, edge k is the one in front of vertex k */
+		for (vertex = 0; vertex < 3; vertex++)
+		{
+			int from = (vertex+1) % 3;
+			int to = (vertex+2) % 3;
+			int delta_x = fixed_x[to]-fixed_x[from];
+			int delta_y = fixed_y[to]-fixed_y[from];
+
+			/* Value on the first pixel and step on both axis */
+			edge_row[vertex] = (long long)delta_x*((min_y << SUBPIXEL_BITS)-fixed_y[from]) -
+					(long long)delta_y*((min_x << SUBPIXEL_BITS)-fixed_x[from]);
+			step_x[vertex] = -(long long)delta_y*SUBPIXEL_ONE;
+			step_y[vertex] = (long long)delta_x*SUBPIXEL_ONE;
+
+			/* Top-left rule, pixel on the other edges belongs to the neighbour tris */
+			bias[vertex] = (delta_y > 0 || (delta_y == 0 && delta_x < 0)) ? 0 : -1;
+		}
+
+		/* Barycentric normalization */
+		inverse_area = 1.f/(float)area;
+
+		/* Test only the pixel in this area */
+		for (y = min_y; y <= max_y; y++) 
+		{
+			long long edge0 = edge_row[0];
+			long long edge1 = edge_row[1];
+			long long edge2 = edge_row[2];
+
+			for (x = min_x; x <= max_x; x++, edge0 += step_x[0], edge1 += step_x[1], edge2 += step_x[2]) 
+			{
+				/* If is inside the triangle, render it */
+				if (((edge0+bias[0]) | (edge1+bias[1]) | (edge2+bias[2])) >= 0) 
+				{
+					/* Calculate barycentric coordinate */
+					float lambda0 = (float)edge0*inverse_area;
+					float lambda1 = (float)edge1*inverse_area;
+					float lambda2 = (float)edge2*inverse_area;
+
+					/* Interpolate Z value */
+					float pixel_depth;
+			
+					/* Check if we are using ortho or perspective rendering */
+					if (is_ortho)
+					{
+						pixel_depth = 1.f/(vertex_arr[0].z * lambda0 +
+								vertex_arr[1].z * lambda1 +
+								vertex_arr[2].z * lambda2);
+					}
+					else
+					{
+						/* Perspective correct interpolation */
+						pixel_depth = lambda0 / vertex_arr[0].z +
+								lambda1 / vertex_arr[1].z +
+								lambda2 / vertex_arr[2].z;
+					}
+
+					/* Map to the mesh range, 1 is near and 0 is far */
+					if (format == DEPTH_FIXED16)
+					{
+						pixel_depth = pixel_depth*depth_scale + depth_bias;
+						pixel_depth = (pixel_depth < 0) ? 0 : (pixel_depth > 1) ? 1 : pixel_depth;
+					}
+
+					/* Test depth buffer, 16 bit keep 0 for the clear value */
+					if (format == DEPTH_FIXED16)
+					{
+						unsigned short fixed_depth = (unsigned short)(pixel_depth*65534 + 1.5f);
+
+						if (depth_buffer16[x+y*target_width] >= fixed_depth)
+							continue;
+
+						depth_buffer16[x+y*target_width] = fixed_depth;
+					}
+					else
+					{
+						if (target_depth[x+y*target_width] >= pixel_depth)
+							continue;
+
+						target_depth[x+y*target_width] = pixel_depth;
+					}
+
+					/* Keep the tris for the resolve pass, or shade the cell now */
+					if (visibility)
+						id_buffer[x+y*target_width] = tris_id;
+					else if (coverage)
+					{
+						unsigned char* cell = &coverage_buffer[(x >> shift_x) + (y >> shift_y)*cell_width];
+						unsigned char bit = 1 << (((y & ((1 << shift_y)-1)) << shift_x) + (x & ((1 << shift_x)-1)));
+
+						*cell = sample_on ? (*cell | bit) : (*cell & ~bit);
+					}
+					else if (use_light)
+						target_screen[x+y*target_width] = light < 0 ? SHADOW_CHAR : LIGHT_CHAR;
+					else
+						target_screen[x+y*target_width] = material_array[material_index];
+				}
+			}
+
+			/* Next row */
+			edge_row[0] += step_y[0];
+			edge_row[1] += step_y[1];
+			edge_row[2] += step_y[2];
+		}
+	}
+
+	return;
+}
+
+/* Kernel specializations, one per projection, shading, depth format and index width */
+#define RASTER_KERNEL(name, is_ortho, use_light, format, wide_index, visibility, coverage) \
+void name(const mesh_t* mesh) { raster_mesh(mesh, NULL, is_ortho, use_light, format, wide_index, visibility, coverage); }
+
+RASTER_KERNEL(raster_persp_material_float, 0, 0, DEPTH_FLOAT, 0, 0, 0)
+RASTER_KERNEL(raster_persp_material_fixed16, 0, 0, DEPTH_FIXED16, 0, 0, 0)
+RASTER_KERNEL(raster_persp_light_float, 0, 1, DEPTH_FLOAT, 0, 0, 0)
+RASTER_KERNEL(raster_persp_light_fixed16, 0, 1, DEPTH_FIXED16, 0, 0, 0)
+RASTER_KERNEL(raster_ortho_material_float, 1, 0, DEPTH_FLOAT, 0, 0, 0)
+RASTER_KERNEL(raster_ortho_material_fixed16, 1, 0, DEPTH_FIXED16, 0, 0, 0)
+RASTER_KERNEL(raster_ortho_light_float, 1, 1, DEPTH_FLOAT, 0, 0, 0)
+RASTER_KERNEL(raster_ortho_light_fixed16, 1, 1, DEPTH_FIXED16, 0, 0, 0)
+RASTER_KERNEL(raster_persp_material_float_wide, 0, 0, DEPTH_FLOAT, 1, 0, 0)
+RASTER_KERNEL(raster_persp_material_fixed16_wide, 0, 0, DEPTH_FIXED16, 1, 0, 0)
+RASTER_KERNEL(raster_persp_light_float_wide, 0, 1, DEPTH_FLOAT, 1, 0, 0)
+RASTER_KERNEL(raster_persp_light_fixed16_wide, 0, 1, DEPTH_FIXED16, 1, 0, 0)
+RASTER_KERNEL(raster_ortho_material_float_wide, 1, 0, DEPTH_FLOAT, 1, 0, 0)
+RASTER_KERNEL(raster_ortho_material_fixed16_wide, 1, 0, DEPTH_FIXED16, 1, 0, 0)
+RASTER_KERNEL(raster_ortho_light_float_wide, 1, 1, DEPTH_FLOAT, 1, 0, 0)
+RASTER_KERNEL(raster_ortho_light_fixed16_wide, 1, 1, DEPTH_FIXED16, 1, 0, 0)
+
+/* Visibility buffer kernels, the shading is left to the resolve pass */
+RASTER_KERNEL(raster_persp_id_float, 0, 0, DEPTH_FLOAT, 0, 1, 0)
+RASTER_KERNEL(raster_persp_id_fixed16, 0, 0, DEPTH_FIXED16, 0, 1, 0)
+RASTER_KERNEL(raster_ortho_id_float, 1, 0, DEPTH_FLOAT, 0, 1, 0)
+RASTER_KERNEL(raster_ortho_id_fixed16, 1, 0, DEPTH_FIXED16, 0, 1, 0)
+RASTER_KERNEL(raster_persp_id_float_wide, 0, 0, DEPTH_FLOAT, 1, 1, 0)
+RASTER_KERNEL(raster_persp_id_fixed16_wide, 0, 0, DEPTH_FIXED16, 1, 1, 0)
+RASTER_KERNEL(raster_ortho_id_float_wide, 1, 0, DEPTH_FLOAT, 1, 1, 0)
+RASTER_KERNEL(raster_ortho_id_fixed16_wide, 1, 0, DEPTH_FIXED16, 1, 1, 0)
+
+/* Coverage kernels, a bit per sample in the glyph of its cell, only the lit samples are set with the light on */
+RASTER_KERNEL(raster_persp_cover_material_float, 0, 0, DEPTH_FLOAT, 0, 0, 1)
+RASTER_KERNEL(raster_persp_cover_material_fixed16, 0, 0, DEPTH_FIXED16, 0, 0, 1)
+RASTER_KERNEL(raster_persp_cover_light_float, 0, 1, DEPTH_FLOAT, 0, 0, 1)
+RASTER_KERNEL(raster_persp_cover_light_fixed16, 0, 1, DEPTH_FIXED16, 0, 0, 1)
+RASTER_KERNEL(raster_ortho_cover_material_float, 1, 0, DEPTH_FLOAT, 0, 0, 1)
+RASTER_KERNEL(raster_ortho_cover_material_fixed16, 1, 0, DEPTH_FIXED16, 0, 0, 1)
+RASTER_KERNEL(raster_ortho_cover_light_float, 1, 1, DEPTH_FLOAT, 0, 0, 1)
+RASTER_KERNEL(raster_ortho_cover_light_fixed16, 1, 1, DEPTH_FIXED16, 0, 0, 1)
+RASTER_KERNEL(raster_persp_cover_material_float_wide, 0, 0, DEPTH_FLOAT, 1, 0, 1)
+RASTER_KERNEL(raster_persp_cover_material_fixed16_wide, 0, 0, DEPTH_FIXED16, 1, 0, 1)
+RASTER_KERNEL(raster_persp_cover_light_float_wide, 0, 1, DEPTH_FLOAT, 1, 0, 1)
+RASTER_KERNEL(raster_persp_cover_light_fixed16_wide, 0, 1, DEPTH_FIXED16, 1, 0, 1)
+RASTER_KERNEL(raster_ortho_cover_material_float_wide, 1, 0, DEPTH_FLOAT, 1, 0, 1)
+RASTER_KERNEL(raster_ortho_cover_material_fixed16_wide, 1, 0, DEPTH_FIXED16, 1, 0, 1)
+RASTER_KERNEL(raster_ortho_cover_light_float_wide, 1, 1, DEPTH_FLOAT, 1, 0, 1)
+RASTER_KERNEL(raster_ortho_cover_light_fixed16_wide, 1, 1, DEPTH_FIXED16, 1, 0, 1)
+
+/* Kernel table, indexed by [wide_index][ortho][do_light][depth_mode] */
+static const raster_kernel_t raster_table[2][2][2][DEPTH_MODE_COUNT] = 
+{
+	{
+		{
+			{raster_persp_material_float, raster_persp_material_fixed16},
+			{raster_persp_light_float, raster_persp_light_fixed16}
+		},
+		{
+			{raster_ortho_material_float, raster_ortho_material_fixed16},
+			{raster_ortho_light_float, raster_ortho_light_fixed16}
+		}
+	},
+	{
+		{
+			{raster_persp_material_float_wide, raster_persp_material_fixed16_wide},
+			{raster_persp_light_float_wide, raster_persp_light_fixed16_wide}
+		},
+		{
+			{raster_ortho_material_float_wide, raster_ortho_material_fixed16_wide},
+			{raster_ortho_light_float_wide, raster_ortho_light_fixed16_wide}
+		}
+	}
+};
+
+/* Visibility kernel table, indexed by [wide_index][ortho][depth_mode] */
+static const raster_kernel_t visibility_table[2][2][DEPTH_MODE_COUNT] = 
+{
+	{
+		{raster_persp_id_float, raster_persp_id_fixed16},
+		{raster_ortho_id_float, raster_ortho_id_fixed16}
+	},
+	{
+		{raster_persp_id_float_wide, raster_persp_id_fixed16_wide},
+		{raster_ortho_id_float_wide, raster_ortho_id_fixed16_wide}
+	}
+};
+
+/* Coverage kernel table, indexed by [wide_index][ortho][do_light][depth_mode] */
+static const raster_kernel_t coverage_table[2][2][2][DEPTH_MODE_COUNT] = 
+{
+	{
+		{
+			{raster_persp_cover_material_float, raster_persp_cover_material_fixed16},
+			{raster_persp_cover_light_float, raster_persp_cover_light_fixed16}
+		},
+		{
+			{raster_ortho_cover_material_float, raster_ortho_cover_material_fixed16},
+			{raster_ortho_cover_light_float, raster_ortho_cover_light_fixed16}
+		}
+	},
+	{
+		{
+			{raster_persp_cover_material_float_wide, raster_persp_cover_material_fixed16_wide},
+			{raster_persp_cover_light_float_wide, raster_persp_cover_light_fixed16_wide}
+		},
+		{
+			{raster_ortho_cover_material_float_wide, raster_ortho_cover_material_fixed16_wide},
+			{raster_ortho_cover_light_float_wide, raster_ortho_cover_light_fixed16_wide}
+		}
+	}
+};
+
+/* Forward kernel of the output mode */
+raster_kernel_t forward_kernel(int wide_index)
+{
+	if (glyph_mode != GLYPH_TEXT)
+		return coverage_table[wide_index][ortho][do_light][depth_mode];
+
+	return raster_table[wide_index][ortho][do_light][depth_mode];
+}
+
+/* Tile kernels, the same body drawing the binned tris on a tile */
+#define TILE_KERNEL(name, is_ortho, use_light, wide_index) \
+void name(const mesh_t* mesh, const tile_t* tile) { raster_mesh(mesh, tile, is_ortho, use_light, DEPTH_FLOAT, wide_index, 0, 0); }
+
+TILE_KERNEL(tile_persp_material, 0, 0, 0)
+TILE_KERNEL(tile_persp_light, 0, 1, 0)
+TILE_KERNEL(tile_ortho_material, 1, 0, 0)
+TILE_KERNEL(tile_ortho_light, 1, 1, 0)
+TILE_KERNEL(tile_persp_material_wide, 0, 0, 1)
+TILE_KERNEL(tile_persp_light_wide, 0, 1, 1)
+TILE_KERNEL(tile_ortho_material_wide, 1, 0, 1)
+TILE_KERNEL(tile_ortho_light_wide, 1, 1, 1)
+
+/* Tile kernel table, indexed by [wide_index][ortho][do_light] */
+static const tile_kernel_t tile_table[2][2][2] = 
+{
+	{
+		{tile_persp_material, tile_persp_light},
+		{tile_ortho_material, tile_ortho_light}
+	},
+	{
+		{tile_persp_material_wide, tile_persp_light_wide},
+		{tile_ortho_material_wide, tile_ortho_light_wide}
+	}
+};
+
+/* Render the full detail mesh as a width x height text file, a row of tiles at a time */
+int render_poster(char* path, int width, int height)
+{
+	float* depth[TILE_WORKERS];
+	int* range;
+	int worker, line, tile_x, tile_count, bin_count, result = 0;
+	int frame_width = output_width, frame_height = output_height, frame_glyph = glyph_mode;
+	unsigned long row_size, depth_size;
+	double elapsed;
+	#ifdef THREADS
+	pthread_t thread[TILE_WORKERS];
+	#endif
+	#ifdef REALTIME
+	double start = clock_ms();
+	#else
+	clock_t start = clock();
+	#endif
+	FILE* output;
+
+	if (lod_chain[0].tris_count == 0 || width <= 0 || height <= 0)
+	{
+		puts("A poster needs a single mesh and a size");
+		return 1;
+	}
+
+	output = fopen(path, "w");
+
+	if (output == NULL)
+	{
+		printf("Error writing file %s\n", path);
+		return 1;
+	}
+
+	/* Tiles draw text, the frame buffers are created only for the view buffer */
+	glyph_mode = GLYPH_TEXT;
+	create_buffer(TILE_WIDTH, TILE_HEIGHT);
+
+	/* Project on the whole poster, only the tiles hold buffers */
+	buffer_width = width;
+	buffer_height = height;
+	screen_rateo = (float)width/height*FONT_RATEO;
+	transform_vertices(&lod_chain[0], transform, view_buffer);
+
+	memset(&poster, 0, sizeof(poster_t));
+	poster.mesh = &lod_chain[0];
+	poster.width = width;
+	poster.height = height;
+	poster.tiles_x = (width + TILE_WIDTH-1) / TILE_WIDTH;
+	poster.tiles_y = (height + TILE_HEIGHT-1) / TILE_HEIGHT;
+	tile_count = poster.tiles_x*poster.tiles_y;
+	bin_count = count_poster_bins();
+
+	/* A row of tile screens, a depth per worker, the bins and the tile range of every tris in one block */
+	row_size = (unsigned long)poster.tiles_x * TILE_WIDTH*TILE_HEIGHT;
+	depth_size = sizeof(float) * TILE_WIDTH*TILE_HEIGHT;
+	if (arena_reserve(&poster_arena, arena_align(row_size) + arena_align(depth_size)*TILE_WORKERS +
+			arena_align(sizeof(int) * (tile_count+1)) + arena_align(sizeof(int) * (bin_count > 0 ? bin_count : 1)) +
+			arena_align(sizeof(int) * 4 * poster.mesh->tris_count)))
+	{
+		puts("Not enough memory for the poster");
+		result = 1;
+	}
+	else
+	{
+		poster.row_screen = (char*) arena_alloc(&poster_arena, row_size);
+
+		for (worker = 0; worker < TILE_WORKERS; worker++)
+			depth[worker] = (float*) arena_alloc(&poster_arena, depth_size);
+
+		poster.bin_start = (int*) arena_alloc(&poster_arena, sizeof(int) * (tile_count+1));
+		poster.bin_tris = (int*) arena_alloc(&poster_arena, sizeof(int) * (bin_count > 0 ? bin_count : 1));
+		range = (int*) arena_alloc(&poster_arena, sizeof(int) * 4 * poster.mesh->tris_count);
+		bin_poster(range);
+	}
+
+	/* Workers started once for the poster, every one takes the next tile of the first row until none is left */
+	#ifdef THREADS
+	pthread_mutex_init(&poster.lock, NULL);
+	pthread_cond_init(&poster.wake, NULL);
+	pthread_cond_init(&poster.done, NULL);
+
+	if (!result)
+		for (worker = 0; worker < TILE_WORKERS; worker++)
+			pthread_create(&thread[worker], NULL, poster_worker, depth[worker]);
+	#endif
+
+	while (poster.row < poster.tiles_y && !result)
+	{
+		int row_height = height - poster.row*TILE_HEIGHT < TILE_HEIGHT ? height - poster.row*TILE_HEIGHT : TILE_HEIGHT;
+
+		/* Wait the tiles of the row */
+		#ifdef THREADS
+		pthread_mutex_lock(&poster.lock);
+
+		while (poster.tiles_done < poster.tiles_x)
+			pthread_cond_wait(&poster.done, &poster.lock);
+
+		pthread_mutex_unlock(&poster.lock);
+		#else
+		for (tile_x = 0; tile_x < poster.tiles_x; tile_x++)
+			poster_tile(tile_x, poster.row, depth[0]);
+		#endif
+
+		/* Stream the row, a line of each tile after the other */
+		for (line = 0; line < row_height; line++)
+		{
+			for (tile_x = 0; tile_x < poster.tiles_x; tile_x++)
+			{
+				int tile_width = width - tile_x*TILE_WIDTH < TILE_WIDTH ? width - tile_x*TILE_WIDTH : TILE_WIDTH;
+
+				fwrite(poster.row_screen + (unsigned long)tile_x*TILE_WIDTH*TILE_HEIGHT + line*tile_width, 1,
+					tile_width, output);
+			}
+
+			fputc('\n', output);
+		}
+
+		/* Next row for the workers, past the last one they leave */
+		#ifdef THREADS
+		pthread_mutex_lock(&poster.lock);
+		poster.row++;
+		poster.next_tile = 0;
+		poster.tiles_done = 0;
+		pthread_cond_broadcast(&poster.wake);
+		pthread_mutex_unlock(&poster.lock);
+		#else
+		poster.row++;
+		#endif
+	}
+
+	#ifdef THREADS
+	if (!result)
+		for (worker = 0; worker < TILE_WORKERS; worker++)
+			pthread_join(thread[worker], NULL);
+
+	pthread_mutex_destroy(&poster.lock);
+	pthread_cond_destroy(&poster.wake);
+	pthread_cond_destroy(&poster.done);
+	#endif
+
+	if (fclose(output) != 0)
+	{
+		printf("Error writing file %s\n", path);
+		result = 1;
+	}
+
+	/* Wall time with the real time clock, the workers add up in the cpu time */
+	#ifdef REALTIME
+	elapsed = clock_ms() - start;
+	#else
+	elapsed = (double) (clock() - start)*1000/CLOCKS_PER_SEC;
+	#endif
+
+	if (!result)
+		printf("[Poster: %dx%d, %d tiles, %d binned tris, Arena: %lu KB, Allocs: %lu, %.1f ms]\n", width, height,
+			tile_count, bin_count, poster_arena.capacity >> 10, poster_arena.alloc_count, elapsed);
+
+	memset(&poster, 0, sizeof(poster_t));
+
+	/* Back to the frame */
+	glyph_mode = frame_glyph;
+	create_buffer(frame_width, frame_height);
+
+	return result;
+}
+
+/* Tile range of a tris as left, top, right and bottom, return 0 if it is behind the near plane or out of the poster */
+int poster_box(int tris, int* box)
+{
+	const mesh_t* mesh = poster.mesh;
+	float min_x = GUARD_BAND, min_y = GUARD_BAND, max_x = -GUARD_BAND, max_y = -GUARD_BAND;
+	int vertex;
+
+	/* Vertex in front of the near plane and the edges crossing it, projected as in the kernel */
+	for (vertex = 0; vertex < 3; vertex++)
+	{
+		const vertex_t* from = &view_buffer[mesh_index(mesh, tris*3+vertex)];
+		const vertex_t* to = &view_buffer[mesh_index(mesh, tris*3+(vertex+1)%3)];
+		vertex_t point[2];
+		int points = 0, index;
+
+		if (from->z >= NEAR_PLANE)
+			point[points++] = *from;
+
+		if ((from->z < NEAR_PLANE) != (to->z < NEAR_PLANE))
+		{
+			float t = (NEAR_PLANE - from->z)/(to->z - from->z);
+
+			point[points].x = from->x + (to->x - from->x)*t;
+			point[points].y = from->y + (to->y - from->y)*t;
+			point[points++].z = NEAR_PLANE;
+		}
+
+		for (index = 0; index < points; index++)
+		{
+			float depth = ortho ? -transform[3][2] : -point[index].z;
+			float x = point[index].x / depth * poster.width + poster.width/2;
+			float y = point[index].y / depth * poster.height * screen_rateo + poster.height/2;
+
+			min_x = x < min_x ? x : min_x;
+			max_x = x > max_x ? x : max_x;
+			min_y = y < min_y ? y : min_y;
+			max_y = y > max_y ? y : max_y;
+		}
+	}
+
+	/* Cell range a cell wider on every side, the kernel snaps the same point a bit apart */
+	min_x = min_x < 1 ? 0 : min_x - 1;
+	min_y = min_y < 1 ? 0 : min_y - 1;
+	max_x = max_x > poster.width ? poster.width : max_x + 1;
+	max_y = max_y > poster.height ? poster.height : max_y + 1;
+
+	/* Behind the near plane or out of the poster, an empty range */
+	if (min_x > max_x || min_y > max_y || max_x < 0 || max_y < 0 || min_x >= poster.width || min_y >= poster.height)
+	{
+		box[0] = box[1] = 1;
+		box[2] = box[3] = 0;
+		return 0;
+	}
+
+	box[0] = (int)min_x / TILE_WIDTH;
+	box[1] = (int)min_y / TILE_HEIGHT;
+	box[2] = ((int)max_x < poster.width ? (int)max_x : poster.width-1) / TILE_WIDTH;
+	box[3] = ((int)max_y < poster.height ? (int)max_y : poster.height-1) / TILE_HEIGHT;
+
+	return 1;
+}
+
+/* Number of bin entries of the poster, so the bins are sized before they are filled */
+int count_poster_bins()
+{
+	int tris, box[4], bin_count = 0;
+
+	for (tris = 0; tris < poster.mesh->tris_count; tris++)
+		if (poster_box(tris, box))
+			bin_count += (box[2]-box[0]+1) * (box[3]-box[1]+1);
+
+	return bin_count;
+}
+
+/* Bin every tris on the tiles its projected box touches, in mesh order, counting first */
+void bin_poster(int* range)
+{
+	const mesh_t* mesh = poster.mesh;
+	int tile_count = poster.tiles_x*poster.tiles_y;
+	int tris, tile_x, tile_y, tile;
+
+	for (tile = 0; tile <= tile_count; tile++)
+		poster.bin_start[tile] = 0;
+
+	for (tris = 0; tris < mesh->tris_count; tris++)
+	{
+		int* box = &range[tris*4];
+
+		poster_box(tris, box);
+
+		for (tile_y = box[1]; tile_y <= box[3]; tile_y++)
+			for (tile_x = box[0]; tile_x <= box[2]; tile_x++)
+				poster.bin_start[tile_x + tile_y*poster.tiles_x + 1]++;
+	}
+
+	/* Start of every bin, then fill them in mesh order */
+	for (tile = 0; tile < tile_count; tile++)
+		poster.bin_start[tile+1] += poster.bin_start[tile];
+
+	for (tris = 0; tris < mesh->tris_count; tris++)
+	{
+		int* box = &range[tris*4];
+
+		for (tile_y = box[1]; tile_y <= box[3]; tile_y++)
+		{
+			for (tile_x = box[0]; tile_x <= box[2]; tile_x++)
+			{
+				tile = tile_x + tile_y*poster.tiles_x;
+				poster.bin_tris[poster.bin_start[tile]++] = tris;
+			}
+		}
+	}
+
+	/* Filling moved every start to the next one */
+	for (tile = tile_count; tile > 0; tile--)
+		poster.bin_start[tile] = poster.bin_start[tile-1];
+	poster.bin_start[0] = 0;
+
+	return;
+}
+
+/* Render a tile of a row on the given depth buffer */
+void poster_tile(int tile_x, int row, float* depth)
+{
+	tile_kernel_t raster = tile_table[poster.mesh->tris_buffer != NULL][ortho][do_light];
+	tile_t tile;
+	int bin;
+
+	/* Edge tiles are cut on the poster border */
+	tile.image_width = poster.width;
+	tile.image_height = poster.height;
+	tile.rateo = screen_rateo;
+	tile.ortho_distance = -transform[3][2];
+	tile.view = view_buffer;
+	tile.x = tile_x*TILE_WIDTH;
+	tile.y = row*TILE_HEIGHT;
+	tile.width = poster.width - tile.x < TILE_WIDTH ? poster.width - tile.x : TILE_WIDTH;
+	tile.height = poster.height - tile.y < TILE_HEIGHT ? poster.height - tile.y : TILE_HEIGHT;
+	tile.screen = poster.row_screen + (unsigned long)tile_x*TILE_WIDTH*TILE_HEIGHT;
+	tile.depth = depth;
+
+	bin = tile_x + row*poster.tiles_x;
+	tile.tris_list = poster.bin_tris + poster.bin_start[bin];
+	tile.tris_count = poster.bin_start[bin+1] - poster.bin_start[bin];
+
+	memset(tile.screen, ' ', tile.width*tile.height);
+	memset(tile.depth, 0, sizeof(float) * tile.width*tile.height);
+
+	raster(poster.mesh, &tile);
+
+	return;
+}
+
+#ifdef THREADS
+/* Take the next tile of the current row until the poster ends, on the depth buffer of the worker */
+void* poster_worker(void* arg)
+{
+	float* depth = (float*) arg;
+	int tile_x, row;
+
+	pthread_mutex_lock(&poster.lock);
+
+	while (poster.row < poster.tiles_y)
+	{
+		/* Row taken, wait for the next one */
+		if (poster.next_tile >= poster.tiles_x)
+		{
+			pthread_cond_wait(&poster.wake, &poster.lock);
+			continue;
+		}
+
+		tile_x = poster.next_tile++;
+		row = poster.row;
+		pthread_mutex_unlock(&poster.lock);
+
+		poster_tile(tile_x, row, depth);
+
+		/* The last tile of the row wakes the main thread */
+		pthread_mutex_lock(&poster.lock);
+
+		if (++poster.tiles_done == poster.tiles_x)
+			pthread_cond_signal(&poster.done);
+	}
+
+	pthread_mutex_unlock(&poster.lock);
+
+	return NULL;
+}
+#endif
+
+/* Split the frame in count viewports: the start view, then front, side and top in orthographic */
+void init_split(int count)
+{
+	int index;
+
+	split_count = count < SPLIT_MAX ? count : SPLIT_MAX;
+	split_focus = 0;
+
+	for (index = 0; index < split_count; index++)
+	{
+		restore_mesh();
+		ortho = index > 0;
+
+		if (index == 2)
+			rotate_y(PI/2);
+		else if (index == 3)
+			rotate_x(PI/2);
+
+		if (auto_fit)
+			fit_view();
+
+		keep_viewport(&split_view[index]);
+	}
+
+	use_viewport(&split_view[split_focus]);
+
+	/* A worker per viewport for the whole split, only the first time */
+	#ifdef THREADS
+	if (split_workers == 0)
+	{
+		pthread_mutex_init(&split_lock, NULL);
+		pthread_cond_init(&split_wake, NULL);
+		pthread_cond_init(&split_done, NULL);
+
+		for (split_workers = 0; split_workers < split_count; split_workers++)
+			pthread_create(&split_thread[split_workers], NULL, viewport_worker, &split_view[split_workers]);
+	}
+	#endif
+
+	return;
+}
+
+/* Stop the viewport workers */
+void close_split()
+{
+	#ifdef THREADS
+	int index;
+
+	if (split_workers == 0)
+		return;
+
+	pthread_mutex_lock(&split_lock);
+	split_stop = 1;
+	pthread_cond_broadcast(&split_wake);
+	pthread_mutex_unlock(&split_lock);
+
+	for (index = 0; index < split_workers; index++)
+		pthread_join(split_thread[index], NULL);
+
+	pthread_mutex_destroy(&split_lock);
+	pthread_cond_destroy(&split_wake);
+	pthread_cond_destroy(&split_done);
+	split_workers = 0;
+	split_stop = 0;
+	#endif
+
+	return;
+}
+
+/* Place the viewports on the frame in two columns, a cell of border between them */
+void layout_split(int width, int height)
+{
+	int index;
+	int columns = split_count > 1 ? 2 : 1;
+	int rows = (split_count+1) / 2;
+	int left = (width - (columns-1)) / columns;
+	int top = (height - (rows-1)) / rows;
+
+	for (index = 0; index < split_count; index++)
+	{
+		viewport_t* viewport = &split_view[index];
+		int col = index % columns;
+		int row = index / columns;
+
+		viewport->x = col*(left+1);
+		viewport->y = row*(top+1);
+
+		/* The last column and row take the cells left, an odd last viewport takes the whole row */
+		viewport->width = (col == columns-1 || index == split_count-1) ? width - viewport->x : left;
+		viewport->height = (row == rows-1) ? height - viewport->y : top;
+	}
+
+	return;
+}
+
+/* Render every viewport on its own worker, then composite them on the frame with borders and labels */
+void render_split()
+{
+	int index, row;
+	int frame_width = buffer_width, frame_height = buffer_height;
+	float frame_rateo = screen_rateo;
+	#ifdef BENCHMARK
+	double start;
+	#endif
+
+	/* The focused viewport takes the view moved by the input */
+	keep_viewport(&split_view[split_focus]);
+
+	/* Level of detail of every viewport, on its own view and size */
+	for (index = 0; index < split_count; index++)
+	{
+		viewport_t* viewport = &split_view[index];
+
+		if (viewport->width <= 0 || viewport->height <= 0)
+			continue;
+
+		use_viewport(viewport);
+		buffer_width = viewport->width;
+		buffer_height = viewport->height;
+		screen_rateo = (float)buffer_width/buffer_height*FONT_RATEO;
+		viewport->level = select_lod();
+	}
+
+	use_viewport(&split_view[split_focus]);
+	buffer_width = frame_width;
+	buffer_height = frame_height;
+	screen_rateo = frame_rateo;
+	lod_active = split_view[split_focus].level;
+
+	#ifdef BENCHMARK
+	start = clock_ms();
+	#endif
+
+	/* The mesh is shared read only, every worker writes its own buffers; wake them and wait the last one */
+	#ifdef THREADS
+	pthread_mutex_lock(&split_lock);
+	split_frame++;
+	split_drawn = 0;
+	pthread_cond_broadcast(&split_wake);
+
+	while (split_drawn < split_workers)
+		pthread_cond_wait(&split_done, &split_lock);
+
+	pthread_mutex_unlock(&split_lock);
+	#else
+	for (index = 0; index < split_count; index++)
+		draw_viewport(&split_view[index]);
+	#endif
+
+	#ifdef BENCHMARK
+	split_ms = clock_ms() - start;
+	#endif
+
+	/* Cells out of every viewport are the border rows, the border columns are set beside each viewport */
+	memset(screen_buffer, '-', buffer_width*buffer_height);
+
+	for (index = 0; index < split_count; index++)
+	{
+		viewport_t* viewport = &split_view[index];
+
+		if (viewport->width <= 0 || viewport->height <= 0)
+			continue;
+
+		for (row = 0; row < viewport->height; row++)
+		{
+			char* line = screen_buffer + viewport->x + (viewport->y+row)*buffer_width;
+
+			memcpy(line, viewport->screen + row*viewport->width, viewport->width);
+
+			if (viewport->x > 0)
+				line[-1] = '|';
+		}
+
+		/* Corners where the border column meets a border row */
+		if (viewport->x > 0 && viewport->y > 0)
+			screen_buffer[viewport->x-1 + (viewport->y-1)*buffer_width] = '+';
+		if (viewport->x > 0 && viewport->y+viewport->height < buffer_height)
+			screen_buffer[viewport->x-1 + (viewport->y+viewport->height)*buffer_width] = '+';
+
+		/* Number of the viewport in its corner, the focused one marked */
+		if (split_count > 1)
+		{
+			screen_buffer[viewport->x + viewport->y*buffer_width] = '1' + index;
+
+			if (index == split_focus && viewport->width > 1)
+				screen_buffer[viewport->x+1 + viewport->y*buffer_width] = '*';
+		}
+	}
+
+	return;
+}
+
+/* Transform and raster a viewport as a single tile of its own image */
+void draw_viewport(viewport_t* viewport)
+{
+	const mesh_t* mesh = &lod_chain[viewport->level];
+	tile_t tile;
+
+	if (viewport->width <= 0 || viewport->height <= 0)
+		return;
+
+	transform_vertices(mesh, viewport->transform, viewport->view);
+
+	tile.image_width = viewport->width;
+	tile.image_height = viewport->height;
+	tile.rateo = (float)viewport->width/viewport->height*FONT_RATEO;
+	tile.ortho_distance = -viewport->transform[3][2];
+	tile.view = viewport->view;
+	tile.x = 0;
+	tile.y = 0;
+	tile.width = viewport->width;
+	tile.height = viewport->height;
+	tile.screen = viewport->screen;
+	tile.depth = viewport->depth;
+	tile.tris_list = NULL;
+	tile.tris_count = 0;
+
+	memset(tile.screen, ' ', tile.width*tile.height);
+	memset(tile.depth, 0, sizeof(float) * tile.width*tile.height);
+
+	tile_table[mesh->tris_buffer != NULL][viewport->ortho][do_light](mesh, &tile);
+
+	return;
+}
+
+#ifdef THREADS
+/* Draw the viewport of the worker on every frame asked, until the split is closed */
+void* viewport_worker(void* arg)
+{
+	viewport_t* viewport = (viewport_t*) arg;
+	unsigned long frame = 0;
+
+	pthread_mutex_lock(&split_lock);
+
+	while (!split_stop)
+	{
+		/* Drawn already, wait for the next frame */
+		if (frame == split_frame)
+		{
+			pthread_cond_wait(&split_wake, &split_lock);
+			continue;
+		}
+
+		frame = split_frame;
+		pthread_mutex_unlock(&split_lock);
+
+		draw_viewport(viewport);
+
+		/* The last viewport wakes the main thread */
+		pthread_mutex_lock(&split_lock);
+
+		if (++split_drawn == split_workers)
+			pthread_cond_signal(&split_done);
+	}
+
+	pthread_mutex_unlock(&split_lock);
+
+	return NULL;
+}
+#endif
+
+/* Send the input to another viewport, the view of the one left is kept */
+void focus_viewport(int index)
+{
+	keep_viewport(&split_view[split_focus]);
+	split_focus = index;
+	use_viewport(&split_view[split_focus]);
+
+	return;
+}
+
+/* Load the view of a viewport in the renderer */
+void use_viewport(const viewport_t* viewport)
+{
+	memcpy(transform, viewport->transform, sizeof(transform));
+	ortho = viewport->ortho;
+
+	return;
+}
+
+/* Store the renderer view back in the viewport */
+void keep_viewport(viewport_t* viewport)
+{
+	memcpy(viewport->transform, transform, sizeof(transform));
+	viewport->ortho = ortho;
+
+	return;
+}
+
+
+/* Build the BVH of a mesh: binned SAH splits over the tris centroids, the top subtrees on their own threads */
+int build_bvh(mesh_t* mesh)
+{
+	bvh_builder_t builder;
+	int tris, vertex;
+	int capacity = mesh->tris_count*2;
+	#ifdef BENCHMARK
+	double start = clock_ms();
+	#endif
+
+	memset(&builder, 0, sizeof(bvh_builder_t));
+	builder.mesh = mesh;
+	builder.box_min = (vertex_t*) malloc(sizeof(vertex_t) * mesh->tris_count);
+	builder.box_max = (vertex_t*) malloc(sizeof(vertex_t) * mesh->tris_count);
+	builder.centroid = (vertex_t*) malloc(sizeof(vertex_t) * mesh->tris_count);
+	mesh->bvh_node = (bvh_node_t*) malloc(sizeof(bvh_node_t) * capacity);
+	mesh->bvh_tris = (int*) malloc(sizeof(int) * mesh->tris_count);
+
+	if (mesh->tris_count == 0 || builder.box_min == NULL || builder.box_max == NULL || builder.centroid == NULL ||
+		mesh->bvh_node == NULL || mesh->bvh_tris == NULL)
+	{
+		free(builder.box_min);
+		free(builder.box_max);
+		free(builder.centroid);
+		free(mesh->bvh_node);
+		free(mesh->bvh_tris);
+		mesh->bvh_node = NULL;
+		mesh->bvh_tris = NULL;
+		return 1;
+	}
+
+	/* Box and centroid of every tris in leaf order, the centroid is the box center */
+	for (tris = 0; tris < mesh->tris_count; tris++)
+	{
+		vertex_t point;
+
+		mesh_vertex(mesh, mesh_index(mesh, tris*3), &point);
+		builder.box_min[tris] = point;
+		builder.box_max[tris] = point;
+
+		for (vertex = 1; vertex < 3; vertex++)
+		{
+			mesh_vertex(mesh, mesh_index(mesh, tris*3+vertex), &point);
+			grow_box(&builder.box_min[tris], &builder.box_max[tris], &point);
+		}
+
+		builder.centroid[tris].x = (builder.box_min[tris].x + builder.box_max[tris].x)/2;
+		builder.centroid[tris].y = (builder.box_min[tris].y + builder.box_max[tris].y)/2;
+		builder.centroid[tris].z = (builder.box_min[tris].z + builder.box_max[tris].z)/2;
+		mesh->bvh_tris[tris] = tris;
+	}
+
+	/* Root over every tris, split down to the leaves */
+	mesh->bvh_node[0].first = 0;
+	mesh->bvh_node[0].count = mesh->tris_count;
+	builder.node_count = 1;
+
+	#ifdef THREADS
+	pthread_mutex_init(&builder.lock, NULL);
+	#endif
+
+	split_bvh(&builder, 0, 0);
+
+	#ifdef THREADS
+	pthread_mutex_destroy(&builder.lock);
+	#endif
+
+	/* Every split takes two nodes, the leaves hold a tris at least, so fewer nodes are used than reserved */
+	mesh->bvh_count = builder.node_count;
+	mesh->bvh_node = (bvh_node_t*) realloc(mesh->bvh_node, sizeof(bvh_node_t) * mesh->bvh_count);
+
+	free(builder.box_min);
+	free(builder.box_max);
+	free(builder.centroid);
+
+	#ifdef BENCHMARK
+	bvh_ms = clock_ms() - start;
+	#endif
+
+	return 0;
+}
+
+/* Bound a node, then split it on the bin plane of the lowest SAH cost, or keep it as a leaf */
+void split_bvh(bvh_builder_t* builder, int node_index, int depth)
+{
+	mesh_t* mesh = builder->mesh;
+	bvh_node_t* node = &mesh->bvh_node[node_index];
+	const int first = node->first;
+	const int count = node->count;
+	vertex_t* box_min = builder->box_min + first;
+	vertex_t* box_max = builder->box_max + first;
+	vertex_t* centroid = builder->centroid + first;
+	int* tris = mesh->bvh_tris + first;
+	int index, axis, bin, child, left;
+	int best_axis = -1, best_bin = 0;
+	int bin_count[3][BVH_BINS];
+	vertex_t bin_min[3][BVH_BINS], bin_max[3][BVH_BINS];
+	float best_cost, low[3], scale[3];
+	vertex_t centroid_min, centroid_max;
+
+	/* Node box and the box of its centroids */
+	node->min = box_min[0];
+	node->max = box_max[0];
+	centroid_min = centroid[0];
+	centroid_max = centroid[0];
+
+	for (index = 1; index < count; index++)
+	{
+		merge_box(&node->min, &node->max, &box_min[index], &box_max[index]);
+		grow_box(&centroid_min, &centroid_max, &centroid[index]);
+	}
+
+	if (count <= BVH_LEAF || depth >= BVH_DEPTH_MAX)
+		return;
+
+	/* Bin of a centroid on every axis, a flat axis puts all in the first bin */
+	for (axis = 0; axis < 3; axis++)
+	{
+		float extent = axis_value(&centroid_max, axis) - axis_value(&centroid_min, axis);
+
+		low[axis] = axis_value(&centroid_min, axis);
+		scale[axis] = extent > 0 ? BVH_BINS / extent : 0;
+
+		for (bin = 0; bin < BVH_BINS; bin++)
+			bin_count[axis][bin] = 0;
+	}
+
+	/* Tris count and box of every bin, the three axis in one pass */
+	for (index = 0; index < count; index++)
+	{
+		for (axis = 0; axis < 3; axis++)
+		{
+			bin = (int) ((axis_value(&centroid[index], axis) - low[axis]) * scale[axis]);
+			bin = bin < BVH_BINS ? bin : BVH_BINS-1;
+
+			if (bin_count[axis][bin]++ == 0)
+			{
+				bin_min[axis][bin] = box_min[index];
+				bin_max[axis][bin] = box_max[index];
+			}
+			else
+			{
+				merge_box(&bin_min[axis][bin], &bin_max[axis][bin], &box_min[index], &box_max[index]);
+			}
+		}
+	}
+
+	/* Cost of the leaf, area times tris as the SAH of a split */
+	best_cost = box_area(&node->min, &node->max) * count;
+
+	for (axis = 0; axis < 3; axis++)
+	{
+		float left_area[BVH_BINS];
+		int left_count[BVH_BINS];
+		vertex_t sweep_min, sweep_max;
+		int sweep_count = 0;
+
+		if (scale[axis] == 0)
+			continue;
+
+		/* Sweep from the left, then from the right pricing the plane before every bin */
+		for (bin = 0; bin < BVH_BINS-1; bin++)
+		{
+			if (bin_count[axis][bin] > 0)
+			{
+				if (sweep_count == 0)
+				{
+					sweep_min = bin_min[axis][bin];
+					sweep_max = bin_max[axis][bin];
+				}
+				else
+				{
+					merge_box(&sweep_min, &sweep_max, &bin_min[axis][bin], &bin_max[axis][bin]);
+				}
+
+				sweep_count += bin_count[axis][bin];
+			}
+
+			left_count[bin] = sweep_count;
+			left_area[bin] = sweep_count > 0 ? box_area(&sweep_min, &sweep_max) : 0;
+		}
+
+		sweep_count = 0;
+
+		for (bin = BVH_BINS-1; bin > 0; bin--)
+		{
+			float cost;
+
+			if (bin_count[axis][bin] > 0)
+			{
+				if (sweep_count == 0)
+				{
+					sweep_min = bin_min[axis][bin];
+					sweep_max = bin_max[axis][bin];
+				}
+				else
+				{
+					merge_box(&sweep_min, &sweep_max, &bin_min[axis][bin], &bin_max[axis][bin]);
+				}
+
+				sweep_count += bin_count[axis][bin];
+			}
+
+			if (sweep_count == 0 || left_count[bin-1] == 0)
+				continue;
+
+			cost = left_area[bin-1]*left_count[bin-1] + box_area(&sweep_min, &sweep_max)*sweep_count;
+
+			if (cost < best_cost)
+			{
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = bin;
+			}
+		}
+	}
+
+	/* No plane beats the leaf, split in the middle of the widest axis only if the leaf would be too large */
+	if (best_axis < 0)
+	{
+		if (count <= BVH_LEAF_MAX)
+			return;
+
+		for (axis = 0; axis < 3; axis++)
+			if (scale[axis] > 0 && (best_axis < 0 || scale[axis] < scale[best_axis]))
+				best_axis = axis;
+
+		/* Same centroid for every tris, nothing to split on */
+		if (best_axis < 0)
+			return;
+
+		best_bin = BVH_BINS/2;
+	}
+
+	/* Move the tris left of the plane first, their boxes with them so the subtrees read them in order */
+	left = 0;
+
+	for (index = 0; index < count; index++)
+	{
+		bin = (int) ((axis_value(&centroid[index], best_axis) - low[best_axis]) * scale[best_axis]);
+		bin = bin < BVH_BINS ? bin : BVH_BINS-1;
+
+		if (bin < best_bin)
+		{
+			int swap_tris = tris[index];
+			vertex_t swap;
+
+			tris[index] = tris[left];
+			tris[left] = swap_tris;
+			swap = box_min[index]; box_min[index] = box_min[left]; box_min[left] = swap;
+			swap = box_max[index]; box_max[index] = box_max[left]; box_max[left] = swap;
+			swap = centroid[index]; centroid[index] = centroid[left]; centroid[left] = swap;
+			left++;
+		}
+	}
+
+	if (left == 0 || left == count)
+		return;
+
+	/* Two children next to each other, taken under the lock while the subtrees are built in parallel */
+	#ifdef THREADS
+	pthread_mutex_lock(&builder->lock);
+	#endif
+	child = builder->node_count;
+	builder->node_count += 2;
+	#ifdef THREADS
+	pthread_mutex_unlock(&builder->lock);
+	#endif
+
+	mesh->bvh_node[child].first = first;
+	mesh->bvh_node[child].count = left;
+	mesh->bvh_node[child+1].first = first + left;
+	mesh->bvh_node[child+1].count = count - left;
+	node->first = child;
+	node->count = 0;
+
+	#ifdef THREADS
+	if (depth < BVH_THREAD_DEPTH && count >= BVH_THREAD_TRIS)
+	{
+		pthread_t thread;
+		bvh_task_t task;
+
+		task.builder = builder;
+		task.node = child;
+		task.depth = depth+1;
+
+		pthread_create(&thread, NULL, bvh_worker, &task);
+		split_bvh(builder, child+1, depth+1);
+		pthread_join(thread, NULL);
+
+		return;
+	}
+	#endif
+
+	split_bvh(builder, child, depth+1);
+	split_bvh(builder, child+1, depth+1);
+
+	return;
+}
+
+/* Build a BVH subtree on a thread */
+void* bvh_worker(void* arg)
+{
+	bvh_task_t* task = (bvh_task_t*) arg;
+
+	split_bvh(task->builder, task->node, task->depth);
+
+	return NULL;
+}
+
+/* Nearest tris hit by a model space ray past the near distance, -1 if none, its distance stored */
+int intersect_bvh(const mesh_t* mesh, const vertex_t* origin, const vertex_t* direction, float near, float* distance)
+{
+	int stack[BVH_STACK];
+	float stack_enter[BVH_STACK];
+	int top = 0, hit = -1, index, vertex;
+	float best = GUARD_BAND, enter;
+	vertex_t inverse;
+
+	/* Inverse direction for the slab test, a zero axis never crosses its slabs */
+	inverse.x = direction->x != 0 ? 1/direction->x : GUARD_BAND*GUARD_BAND;
+	inverse.y = direction->y != 0 ? 1/direction->y : GUARD_BAND*GUARD_BAND;
+	inverse.z = direction->z != 0 ? 1/direction->z : GUARD_BAND*GUARD_BAND;
+
+	if (!ray_box(origin, &inverse, &mesh->bvh_node[0], near, best, &enter))
+		return -1;
+
+	stack[top] = 0;
+	stack_enter[top++] = enter;
+
+	while (top > 0)
+	{
+		const bvh_node_t* node;
+
+		top--;
+
+		/* A nearer hit was found since the node was pushed */
+		if (stack_enter[top] > best)
+			continue;
+
+		node = &mesh->bvh_node[stack[top]];
+
+		/* Leaf, test its tris, the lower index wins a tie so the pick does not depend on the order */
+		if (node->count > 0)
+		{
+			for (index = node->first; index < node->first + node->count; index++)
+			{
+				int tris = mesh->bvh_tris[index];
+				vertex_t corner[3];
+				float t;
+
+				for (vertex = 0; vertex < 3; vertex++)
+					mesh_vertex(mesh, mesh_index(mesh, tris*3+vertex), &corner[vertex]);
+
+				t = ray_tris(origin, direction, corner);
+
+				if (t >= near && (t < best || (t == best && tris < hit)))
+				{
+					best = t;
+					hit = tris;
+				}
+			}
+		}
+
+		/* Inner node, the nearer child is popped first */
+		else
+		{
+			float child_enter[2];
+			int child_hit[2], child;
+
+			for (child = 0; child < 2; child++)
+				child_hit[child] = ray_box(origin, &inverse, &mesh->bvh_node[node->first+child], near, best,
+							&child_enter[child]);
+
+			for (child = 0; child < 2; child++)
+			{
+				/* Far child first */
+				int pick = (child_enter[0] > child_enter[1]) ? child : 1-child;
+
+				if (child_hit[pick])
+				{
+					stack[top] = node->first+pick;
+					stack_enter[top++] = child_enter[pick];
+				}
+			}
+		}
+	}
+
+	*distance = best;
+
+	return hit;
+}
+
+/* Slab test of a ray against a node box between near and far, the entry distance stored */
+int ray_box(const vertex_t* origin, const vertex_t* inverse, const bvh_node_t* node, float near, float far, float* enter)
+{
+	float low, high, swap;
+	int axis;
+
+	for (axis = 0; axis < 3; axis++)
+	{
+		low = (axis_value(&node->min, axis) - axis_value(origin, axis)) * axis_value(inverse, axis);
+		high = (axis_value(&node->max, axis) - axis_value(origin, axis)) * axis_value(inverse, axis);
+
+		if (low > high)
+		{
+			swap = low;
+			low = high;
+			high = swap;
+		}
+
+		near = low > near ? low : near;
+		far = high < far ? high : far;
+
+		if (near > far)
+			return 0;
+	}
+
+	*enter = near;
+
+	return 1;
+}
+
+/* Distance along a ray to a tris, both sides are hit as both are rastered, -1 on a miss */
+float ray_tris(const vertex_t* origin, const vertex_t* direction, const vertex_t* corner)
+{
+	vertex_t edge0, edge1, normal, offset, cross;
+	float det, u, v;
+
+	edge0.x = corner[1].x - corner[0].x;
+	edge0.y = corner[1].y - corner[0].y;
+	edge0.z = corner[1].z - corner[0].z;
+	edge1.x = corner[2].x - corner[0].x;
+	edge1.y = corner[2].y - corner[0].y;
+	edge1.z = corner[2].z - corner[0].z;
+
+	normal.x = direction->y*edge1.z - direction->z*edge1.y;
+	normal.y = direction->z*edge1.x - direction->x*edge1.z;
+	normal.z = direction->x*edge1.y - direction->y*edge1.x;
+	det = edge0.x*normal.x + edge0.y*normal.y + edge0.z*normal.z;
+
+	/* Parallel to the ray, or degenerate */
+	if (det == 0)
+		return -1;
+
+	offset.x = origin->x - corner[0].x;
+	offset.y = origin->y - corner[0].y;
+	offset.z = origin->z - corner[0].z;
+	u = (offset.x*normal.x + offset.y*normal.y + offset.z*normal.z) / det;
+
+	if (u < 0 || u > 1)
+		return -1;
+
+	cross.x = offset.y*edge0.z - offset.z*edge0.y;
+	cross.y = offset.z*edge0.x - offset.x*edge0.z;
+	cross.z = offset.x*edge0.y - offset.y*edge0.x;
+	v = (direction->x*cross.x + direction->y*cross.y + direction->z*cross.z) / det;
+
+	if (v < 0 || u+v > 1)
+		return -1;
+
+	return (edge1.x*cross.x + edge1.y*cross.y + edge1.z*cross.z) / det;
+}
+
+/* Cast a ray through the sample a cell is drawn from and report the tris, its OBJ line and nearest vertex */
+int pick_cell(int col, int row)
+{
+	mesh_t* mesh = &lod_chain[0];
+	float (*matrix)[4] = transform;
+	int is_ortho = ortho, image_width = buffer_width, image_height = buffer_height;
+	int x, y, tris, vertex, nearest = 0;
+	float rateo = screen_rateo, inverse[3][3];
+	float screen_x, screen_y, distance, nearest_distance = 0;
+	vertex_t origin, direction, view_origin, view_direction, hit;
+	char line_text[32] = "";
+
+	if (mesh->tris_count == 0 || scene.instance_count > 0)
+	{
+		sprintf(pick_text, "[Pick: a single mesh is needed]");
+		return 1;
+	}
+
+	if (col < 0 || row < 0 || col >= output_width || row >= output_height)
+	{
+		sprintf(pick_text, "[Pick: cell %d,%d out of the frame]", col, row);
+		return 1;
+	}
+
+	/* Sample point of the cell, the one the frame shows */
+	x = col*buffer_width/output_width;
+	y = row*buffer_height/output_height;
+
+	/* In a split screen, the viewport holding the cell and its own view */
+	if (split_count > 0)
+	{
+		int index;
+
+		keep_viewport(&split_view[split_focus]);
+
+		for (index = 0; index < split_count; index++)
+		{
+			viewport_t* viewport = &split_view[index];
+
+			if (x >= viewport->x && x < viewport->x+viewport->width && y >= viewport->y &&
+				y < viewport->y+viewport->height)
+				break;
+		}
+
+		if (index == split_count)
+		{
+			sprintf(pick_text, "[Pick: cell %d,%d on a border]", col, row);
+			return 1;
+		}
+
+		x -= split_view[index].x;
+		y -= split_view[index].y;
+		image_width = split_view[index].width;
+		image_height = split_view[index].height;
+		rateo = (float)image_width/image_height*FONT_RATEO;
+		matrix = split_view[index].transform;
+		is_ortho = split_view[index].ortho;
+	}
+
+	if (mesh->bvh_node == NULL && build_bvh(mesh))
+	{
+		sprintf(pick_text, "[Pick: not enough memory for the BVH]");
+		return 1;
+	}
+
+	/* Undo the projection of the raster: a ray from the eye, or along z in orthographic */
+	screen_x = (float)(x - image_width/2) / image_width;
+	screen_y = (float)(y - image_height/2) / (image_height*rateo);
+
+	if (is_ortho)
+	{
+		view_origin.x = screen_x * -matrix[3][2];
+		view_origin.y = screen_y * -matrix[3][2];
+		view_direction.x = 0;
+		view_direction.y = 0;
+	}
+	else
+	{
+		view_origin.x = 0;
+		view_origin.y = 0;
+		view_direction.x = -screen_x;
+		view_direction.y = -screen_y;
+	}
+
+	view_origin.z = 0;
+	view_direction.z = 1;
+
+	/* To model space, the ray keeps its parameter so the distance stays the view depth */
+	if (invert_view(matrix, inverse))
+	{
+		sprintf(pick_text, "[Pick: the view is flat]");
+		return 1;
+	}
+
+	view_origin.x -= matrix[3][0];
+	view_origin.y -= matrix[3][1];
+	view_origin.z -= matrix[3][2];
+	origin.x = inverse[0][0]*view_origin.x + inverse[0][1]*view_origin.y + inverse[0][2]*view_origin.z;
+	origin.y = inverse[1][0]*view_origin.x + inverse[1][1]*view_origin.y + inverse[1][2]*view_origin.z;
+	origin.z = inverse[2][0]*view_origin.x + inverse[2][1]*view_origin.y + inverse[2][2]*view_origin.z;
+	direction.x = inverse[0][0]*view_direction.x + inverse[0][1]*view_direction.y + inverse[0][2]*view_direction.z;
+	direction.y = inverse[1][0]*view_direction.x + inverse[1][1]*view_direction.y + inverse[1][2]*view_direction.z;
+	direction.z = inverse[2][0]*view_direction.x + inverse[2][1]*view_direction.y + inverse[2][2]*view_direction.z;
+
+	tris = intersect_bvh(mesh, &origin, &direction, NEAR_PLANE, &distance);
+
+	if (tris < 0)
+	{
+		sprintf(pick_text, "[Pick: cell %d,%d, no tris]", col, row);
+		return 0;
+	}
+
+	/* Vertex of the tris nearest to the hit */
+	hit.x = origin.x + direction.x*distance;
+	hit.y = origin.y + direction.y*distance;
+	hit.z = origin.z + direction.z*distance;
+
+	for (vertex = 0; vertex < 3; vertex++)
+	{
+		vertex_t corner;
+		float corner_distance;
+
+		mesh_vertex(mesh, mesh_index(mesh, tris*3+vertex), &corner);
+		corner_distance = (corner.x-hit.x)*(corner.x-hit.x) + (corner.y-hit.y)*(corner.y-hit.y) +
+				(corner.z-hit.z)*(corner.z-hit.z);
+
+		if (vertex == 0 || corner_distance < nearest_distance)
+		{
+			nearest = mesh_index(mesh, tris*3+vertex);
+			nearest_distance = corner_distance;
+		}
+	}
+
+	mesh_vertex(mesh, nearest, &hit);
+
+	if (mesh->tris_line)
+		sprintf(line_text, " on line %d", mesh->tris_line[tris]);
+
+	sprintf(pick_text, "[Pick: cell %d,%d, tris %d%s, vertex %d (%g, %g, %g), depth %.3f]", col, row, tris,
+		line_text, nearest, hit.x, hit.y, hit.z, distance);
+
+	return 0;
+}
+
+/* Inverse of the rotation and scale of a view matrix, the matrix applies its rows to x, y and z */
+int invert_view(float matrix[4][4], float inverse[3][3])
+{
+	int row, col;
+	float det = matrix[0][0]*(matrix[1][1]*matrix[2][2] - matrix[2][1]*matrix[1][2]) -
+			matrix[1][0]*(matrix[0][1]*matrix[2][2] - matrix[2][1]*matrix[0][2]) +
+			matrix[2][0]*(matrix[0][1]*matrix[1][2] - matrix[1][1]*matrix[0][2]);
+
+	if (det == 0)
+		return 1;
+
+	/* The adjugate over the determinant, on the transposed layout so it applies to x, y and z as rows */
+	for (row = 0; row < 3; row++)
+	{
+		for (col = 0; col < 3; col++)
+		{
+			int row0 = (row+1)%3, row1 = (row+2)%3;
+			int col0 = (col+1)%3, col1 = (col+2)%3;
+
+			inverse[row][col] = (matrix[row0][col0]*matrix[row1][col1] - matrix[row0][col1]*matrix[row1][col0]) / det;
+		}
+	}
+
+	return 0;
+}
+
+/* Move the view so the mesh fills the frame at the current rotation and scale */
+void fit_view()
+{
+	mesh_t* mesh = &lod_chain[0];
+	vertex_t min, max;
+	float width = output_width > 0 ? output_width : SCRIPT_WIDTH;
+	float height = output_height > 0 ? output_height : SCRIPT_HEIGHT;
+	float half_x, half_y, half_z, front;
+
+	if (mesh->tris_count == 0)
+		return;
+
+	/* Box in the rotated view, with no translation */
+	transform[3][0] = 0;
+	transform[3][1] = 0;
+	transform[3][2] = 0;
+	view_bounds(mesh, transform, &min, &max);
+
+	half_x = (max.x - min.x)/2;
+	half_y = (max.y - min.y)/2;
+	half_z = (max.z - min.z)/2;
+
+	/* Distance of the box front: x within half the width, y within half the height over the cell rateo */
+	front = 2*half_x > 2*half_y*width/height*FONT_RATEO ? 2*half_x : 2*half_y*width/height*FONT_RATEO;
+	front = front*FIT_MARGIN > NEAR_PLANE ? front*FIT_MARGIN : NEAR_PLANE;
+
+	/* Box center on the view axis, its front at that distance */
+	transform[3][0] = -(min.x + max.x)/2;
+	transform[3][1] = -(min.y + max.y)/2;
+	transform[3][2] = front + half_z - (min.z + max.z)/2;
+
+	return;
+}
+
+/* Box of the mesh in view space, from the node boxes a few levels down the BVH, or from every vertex */
+void view_bounds(mesh_t* mesh, float matrix[4][4], vertex_t* min, vertex_t* max)
+{
+	int stack[BVH_STACK], depth[BVH_STACK];
+	int top = 0, index, corner, first = 1;
+	vertex_t point, view;
+
+	/* Built once, then fitting costs the corners of a few boxes */
+	if (mesh->bvh_node == NULL && build_bvh(mesh))
+	{
+		for (index = 0; index < mesh->vertex_count; index++)
+		{
+			mesh_vertex(mesh, index, &point);
+			transform_point(matrix, &point, &view);
+
+			if (index == 0)
+				*min = *max = view;
+			else
+				grow_box(min, max, &view);
+		}
+
+		return;
+	}
+
+	stack[top] = 0;
+	depth[top++] = 0;
+
+	while (top > 0)
+	{
+		const bvh_node_t* node = &mesh->bvh_node[stack[--top]];
+		int level = depth[top];
+
+		if (node->count == 0 && level < FIT_DEPTH)
+		{
+			stack[top] = node->first;
+			depth[top++] = level+1;
+			stack[top] = node->first+1;
+			depth[top++] = level+1;
+			continue;
+		}
+
+		/* Every corner of the node box */
+		for (corner = 0; corner < 8; corner++)
+		{
+			point.x = corner & 1 ? node->max.x : node->min.x;
+			point.y = corner & 2 ? node->max.y : node->min.y;
+			point.z = corner & 4 ? node->max.z : node->min.z;
+			transform_point(matrix, &point, &view);
+
+			if (first)
+				*min = *max = view;
+			else
+				grow_box(min, max, &view);
+
+			first = 0;
+		}
+	}
+
+	return;
+}
+
+/* Apply a view matrix to a point */
+void transform_point(float matrix[4][4], const vertex_t* point, vertex_t* view)
+{
+	view->x = matrix[0][0]*point->x + matrix[1][0]*point->y + matrix[2][0]*point->z + matrix[3][0];
+	view->y = matrix[0][1]*point->x + matrix[1][1]*point->y + matrix[2][1]*point->z + matrix[3][1];
+	view->z = matrix[0][2]*point->x + matrix[1][2]*point->y + matrix[2][2]*point->z + matrix[3][2];
+
+	return;
+}
+
+/* Grow a box to hold a point */
+void grow_box(vertex_t* min, vertex_t* max, const vertex_t* point)
+{
+	if (point->x < min->x) min->x = point->x;
+	if (point->y < min->y) min->y = point->y;
+	if (point->z < min->z) min->z = point->z;
+	if (point->x > max->x) max->x = point->x;
+	if (point->y > max->y) max->y = point->y;
+	if (point->z > max->z) max->z = point->z;
+
+	return;
+}
+
+/* Grow a box to hold another box */
+void merge_box(vertex_t* min, vertex_t* max, const vertex_t* other_min, const vertex_t* other_max)
+{
+	if (other_min->x < min->x) min->x = other_min->x;
+	if (other_min->y < min->y) min->y = other_min->y;
+	if (other_min->z < min->z) min->z = other_min->z;
+	if (other_max->x > max->x) max->x = other_max->x;
+	if (other_max->y > max->y) max->y = other_max->y;
+	if (other_max->z > max->z) max->z = other_max->z;
+
+	return;
+}
+
+/* Half the surface of a box, the SAH needs only the ratios */
+float box_area(const vertex_t* min, const vertex_t* max)
+{
+	float x = max->x - min->x, y = max->y - min->y, z = max->z - min->z;
+
+	return x*y + y*z + z*x;
+}
+
+/* Coordinate of a vertex on an axis */
+float axis_value(const vertex_t* vertex, int axis)
+{
+	return axis == 0 ? vertex->x : axis == 1 ? vertex->y : vertex->z;
+}
+
+#ifdef POSIX
+/* Grid cell of a tris centroid */
+int centroid_cell(const vertex_t* vertex_map, const int* tris, const vertex_t* min, float cell_size, int grid)
+{
+	const vertex_t* vertex0 = &vertex_map[tris[0]];
+	const vertex_t* vertex1 = &vertex_map[tris[1]];
+	const vertex_t* vertex2 = &vertex_map[tris[2]];
+	int cell_x = (int)(((vertex0->x+vertex1->x+vertex2->x)/3 - min->x)/cell_size);
+	int cell_y = (int)(((vertex0->y+vertex1->y+vertex2->y)/3 - min->y)/cell_size);
+	int cell_z = (int)(((vertex0->z+vertex1->z+vertex2->z)/3 - min->z)/cell_size);
+
+	/* Clamp, the max bound fall in the last cell */
+	cell_x = (cell_x < 0) ? 0 : (cell_x < grid) ? cell_x : grid-1;
+	cell_y = (cell_y < 0) ? 0 : (cell_y < grid) ? cell_y : grid-1;
+	cell_z = (cell_z < 0) ? 0 : (cell_z < grid) ? cell_z : grid-1;
+
+	return cell_x + grid*(cell_y + grid*cell_z);
+}
+
+/* Add a tris to the chunk being built, remapping its vertex to local 16 bit indices */
+void add_chunk_tris(chunk_builder_t* builder, const vertex_t* vertex_map, const int* tris)
+{
+	int vertex;
+
+	for (vertex = 0; vertex < 3; vertex++)
+	{
+		int slot = (int)(((unsigned int)tris[vertex]*2654435761u) & (REMAP_SIZE-1));
+
+		/* Find the vertex or add it */
+		while (builder->remap_key[slot] != -1 && builder->remap_key[slot] != tris[vertex])
+			slot = (slot+1) & (REMAP_SIZE-1);
+
+		if (builder->remap_key[slot] == -1)
+		{
+			builder->remap_key[slot] = tris[vertex];
+			builder->remap_value[slot] = builder->vertex_count;
+			builder->vertex_buffer[builder->vertex_count++] = vertex_map[tris[vertex]];
+		}
+
+		builder->tris_buffer[builder->tris_count*3+vertex] = (unsigned short) builder->remap_value[slot];
+	}
+
+	builder->tris_count++;
+
+	/* Chunk full */
+	if (builder->tris_count == CHUNK_TRIS)
+		flush_chunk(builder);
+
+	return;
+}
+
+/* Write the chunk being built and add it to the table */
+void flush_chunk(chunk_builder_t* builder)
+{
+	int index;
+	chunk_info_t* info;
+	mesh_t bounds;
+
+	/* Nothing to write */
+	if (builder->tris_count == 0)
+		return;
+
+	/* Grow the table */
+	if (builder->chunk_count == builder->chunk_capacity)
+	{
+		builder->chunk_capacity *= 2;
+		builder->table = (chunk_info_t*) realloc(builder->table, builder->chunk_capacity * sizeof(chunk_info_t));
+	}
+
+	/* Chunk bounds */
+	bounds.vertex_buffer = builder->vertex_buffer;
+	bounds.vertex_count = builder->vertex_count;
+	compute_bounds(&bounds);
+
+	info = &builder->table[builder->chunk_count++];
+	info->bound_min = bounds.bound_min;
+	info->bound_max = bounds.bound_max;
+	info->vertex_count = builder->vertex_count;
+	info->tris_count = builder->tris_count;
+	info->offset = ftell(builder->out_file);
+
+	/* Vertex then indices */
+	fwrite(builder->vertex_buffer, sizeof(vertex_t), builder->vertex_count, builder->out_file);
+	fwrite(builder->tris_buffer, sizeof(unsigned short)*3, builder->tris_count, builder->out_file);
+
+	if (builder->vertex_count > builder->max_vertex)
+		builder->max_vertex = builder->vertex_count;
+
+	/* Restart with an empty chunk */
+	for (index = 0; index < REMAP_SIZE; index++)
+		builder->remap_key[index] = -1;
+
+	builder->vertex_count = 0;
+	builder->tris_count = 0;
+
+	return;
+}
+
+/* Convert an OBJ file to the chunked layout, without holding the mesh in memory */
+int convert_obj(char* path, char* out_path)
+{
+	int line_size = LINE_SIZE;
+	int face_capacity = FACE_SIZE;
+	char* line_buffer;
+	int* face;
+	int vertex_count = 0;
+	int tris_count = 0;
+	int grid = 1;
+	int index, cell, cell_count, first;
+	long long table_offset = 0;
+	vertex_t bound_min, bound_max;
+	float cell_size;
+	unsigned int* cell_start = NULL;
+	vertex_t* vertex_map = (vertex_t*) MAP_FAILED;
+	int* tris_map = (int*) MAP_FAILED;
+	unsigned int* sorted_map = (unsigned int*) MAP_FAILED;
+	FILE *vertex_file, *tris_file, *sorted_file;
+	mesh_reader_t reader;
+	chunk_builder_t builder;
+	int result = 1;
+
+	/* Check the read to be succefull */
+	if (open_reader(&reader, path))
+	{
+		printf("Error reading file %s\n", path);
+		return 1;
+	}
+
+	/* Temporary files for the vertex, the tris and the tris sorted by cell */
+	vertex_file = tmpfile();
+	tris_file = tmpfile();
+	sorted_file = tmpfile();
+
+	line_buffer = (char*) malloc(line_size);
+	face = (int*) malloc(face_capacity * sizeof(int));
+	memset(&builder, 0, sizeof(chunk_builder_t));
+
+	/* Stream the vertex and the tris out, keeping only the bounds */
+	while (vertex_file != NULL && tris_file != NULL && sorted_file != NULL && read_line(&reader, &line_buffer, &line_size))
+	{
+		int type = line_type(line_buffer);
+
+		if (type == 'v')
+		{
+			vertex_t vertex;
+
+			parse_vertex(line_buffer, &vertex);
+			fwrite(&vertex, sizeof(vertex_t), 1, vertex_file);
+
+			if (vertex_count == 0 || vertex.x < bound_min.x) bound_min.x = vertex.x;
+			if (vertex_count == 0 || vertex.y < bound_min.y) bound_min.y = vertex.y;
+			if (vertex_count == 0 || vertex.z < bound_min.z) bound_min.z = vertex.z;
+			if (vertex_count == 0 || vertex.x > bound_max.x) bound_max.x = vertex.x;
+			if (vertex_count == 0 || vertex.y > bound_max.y) bound_max.y = vertex.y;
+			if (vertex_count == 0 || vertex.z > bound_max.z) bound_max.z = vertex.z;
+
+			vertex_count++;
+		}
+		else if (type == 'f')
+		{
+			int vertex, count = parse_face(line_buffer, &face, &face_capacity, vertex_count);
+
+			/* Same split as parse_obj */
+			for (vertex = 2; vertex < count; vertex++)
+			{
+				int tris[3];
+
+				tris[0] = face[0];
+				tris[1] = face[vertex-1];
+				tris[2] = face[vertex];
+				fwrite(tris, sizeof(int), 3, tris_file);
+				tris_count++;
+			}
+		}
+	}
+
+	close_reader(&reader);
+	free(line_buffer);
+	free(face);
+
+	/* Map the vertex and the tris back, pages are brought in only when needed, and size the sorted tris file,
+	   one index per tris */
+	if (vertex_file != NULL && tris_file != NULL && sorted_file != NULL && vertex_count > 0 && tris_count > 0 &&
+		fflush(vertex_file) == 0 && fflush(tris_file) == 0)
+	{
+		vertex_map = (vertex_t*) mmap(NULL, vertex_count * sizeof(vertex_t), PROT_READ, MAP_SHARED, fileno(vertex_file), 0);
+		tris_map = (int*) mmap(NULL, tris_count * sizeof(int) * 3, PROT_READ, MAP_SHARED, fileno(tris_file), 0);
+
+		if (ftruncate(fileno(sorted_file), tris_count * sizeof(unsigned int)) == 0)
+			sorted_map = (unsigned int*) mmap(NULL, tris_count * sizeof(unsigned int), PROT_READ | PROT_WRITE, 
+							MAP_SHARED, fileno(sorted_file), 0);
+	}
+
+	/* Check the temporary files, vertex and tris count and the maps, every failure falls to the same cleanup */
+	if (vertex_file == NULL || tris_file == NULL || sorted_file == NULL)
+		printf("Error creating the temporary files of %s\n", path);
+	else if (reader.error || vertex_count == 0 || tris_count == 0)
+		printf("Corrupted file %s\n", path);
+	else if (vertex_map == MAP_FAILED || tris_map == MAP_FAILED || sorted_map == MAP_FAILED)
+		printf("Error mapping the temporary files of %s\n", path);
+	else if ((builder.out_file = fopen(out_path, "wb")) == NULL)
+		printf("Error writing file %s\n", out_path);
+	else
+	{
+		/* Grid with about CHUNK_TRIS tris per cell on a surface */
+		while (grid < CHUNK_MAX_GRID && grid*grid*CHUNK_TRIS < tris_count)
+			grid *= 2;
+
+		cell_size = bound_max.x - bound_min.x;
+		if (bound_max.y - bound_min.y > cell_size) cell_size = bound_max.y - bound_min.y;
+		if (bound_max.z - bound_min.z > cell_size) cell_size = bound_max.z - bound_min.z;
+		cell_size = (cell_size > 0) ? cell_size/grid : 1;
+		cell_count = grid*grid*grid;
+
+		/* Count the tris in every cell, skipping the ones with invalid vertex */
+		cell_start = (unsigned int*) calloc(cell_count+1, sizeof(unsigned int));
+
+		for (index = 0; index < tris_count; index++)
+		{
+			const int* tris = &tris_map[index*3];
+
+			if (tris[0] < 0 || tris[1] < 0 || tris[2] < 0 || 
+				tris[0] >= vertex_count || tris[1] >= vertex_count || tris[2] >= vertex_count)
+				continue;
+
+			cell_start[centroid_cell(vertex_map, tris, &bound_min, cell_size, grid)+1]++;
+		}
+
+		for (cell = 0; cell < cell_count; cell++)
+			cell_start[cell+1] += cell_start[cell];
+
+		/* Scatter them in cell order, leaving cell_start on the end of each cell */
+		for (index = 0; index < tris_count; index++)
+		{
+			const int* tris = &tris_map[index*3];
+
+			if (tris[0] < 0 || tris[1] < 0 || tris[2] < 0 || 
+				tris[0] >= vertex_count || tris[1] >= vertex_count || tris[2] >= vertex_count)
+				continue;
+
+			sorted_map[cell_start[centroid_cell(vertex_map, tris, &bound_min, cell_size, grid)]++] = index;
+		}
+
+		/* Header, written again at the end */
+		fwrite(CHUNK_MAGIC, 1, 8, builder.out_file);
+		fwrite(&builder.chunk_count, sizeof(int), 1, builder.out_file);
+		fwrite(&builder.max_vertex, sizeof(int), 1, builder.out_file);
+		fwrite(&table_offset, sizeof(long long), 1, builder.out_file);
+		fwrite(&bound_min, sizeof(vertex_t), 1, builder.out_file);
+		fwrite(&bound_max, sizeof(vertex_t), 1, builder.out_file);
+
+		/* Chunk buffers */
+		builder.chunk_capacity = 64;
+		builder.table = (chunk_info_t*) malloc(builder.chunk_capacity * sizeof(chunk_info_t));
+		builder.remap_key = (int*) malloc(REMAP_SIZE * sizeof(int));
+		builder.remap_value = (int*) malloc(REMAP_SIZE * sizeof(int));
+		builder.vertex_buffer = (vertex_t*) malloc(CHUNK_TRIS * 3 * sizeof(vertex_t));
+		builder.tris_buffer = (unsigned short*) malloc(CHUNK_TRIS * 3 * sizeof(unsigned short));
+
+		for (index = 0; index < REMAP_SIZE; index++)
+			builder.remap_key[index] = -1;
+
+		/* One or more chunk per cell */
+		for (cell = 0, first = 0; cell < cell_count; cell++)
+		{
+			for (index = first; index < (int)cell_start[cell]; index++)
+				add_chunk_tris(&builder, vertex_map, &tris_map[sorted_map[index]*3]);
+
+			flush_chunk(&builder);
+			first = cell_start[cell];
+		}
+
+		/* Table at the end, then the final header */
+		table_offset = ftell(builder.out_file);
+		fwrite(builder.table, sizeof(chunk_info_t), builder.chunk_count, builder.out_file);
+		fseek(builder.out_file, 8, SEEK_SET);
+		fwrite(&builder.chunk_count, sizeof(int), 1, builder.out_file);
+		fwrite(&builder.max_vertex, sizeof(int), 1, builder.out_file);
+		fwrite(&table_offset, sizeof(long long), 1, builder.out_file);
+		fclose(builder.out_file);
+
+		printf("Converted %s: %d vertex, %d tris, %d chunks\n", path, vertex_count, tris_count, builder.chunk_count);
+		result = 0;
+	}
+
+	/* Free everything */
+	if (vertex_map != MAP_FAILED)
+		munmap(vertex_map, vertex_count * sizeof(vertex_t));
+	if (tris_map != MAP_FAILED)
+		munmap(tris_map, tris_count * sizeof(int) * 3);
+	if (sorted_map != MAP_FAILED)
+		munmap(sorted_map, tris_count * sizeof(unsigned int));
+	if (vertex_file != NULL)
+		fclose(vertex_file);
+	if (tris_file != NULL)
+		fclose(tris_file);
+	if (sorted_file != NULL)
+		fclose(sorted_file);
+	free(cell_start);
+	free(builder.table);
+	free(builder.remap_key);
+	free(builder.remap_value);
+	free(builder.vertex_buffer);
+	free(builder.tris_buffer);
+
+	return result;
+}
+
+/* Open a chunked mesh, return -1 if the file is not one */
+int open_stream(char* path, unsigned long budget)
+{
+	char header[48];
+	chunk_info_t* table;
+	long long table_offset;
+	int index;
+
+	stream.file = open(path, O_RDONLY);
+
+	/* Check the magic */
+	if (stream.file < 0 || pread(stream.file, header, sizeof(header), 0) != sizeof(header) ||
+		memcmp(header, CHUNK_MAGIC, 8) != 0)
+	{
+		if (stream.file >= 0)
+			close(stream.file);
+
+		return -1;
+	}
+
+	/* Header */
+	memcpy(&stream.chunk_count, header+8, sizeof(int));
+	memcpy(&stream.max_vertex, header+12, sizeof(int));
+	memcpy(&table_offset, header+16, sizeof(long long));
+	memcpy(&stream.bounds.bound_min, header+24, sizeof(vertex_t));
+	memcpy(&stream.bounds.bound_max, header+36, sizeof(vertex_t));
+
+	/* Chunk table */
+	table = (chunk_info_t*) malloc(stream.chunk_count * sizeof(chunk_info_t));
+
+	if (pread(stream.file, table, stream.chunk_count * sizeof(chunk_info_t), table_offset) != 
+		(long)(stream.chunk_count * sizeof(chunk_info_t)))
+	{
+		printf("Corrupted file %s\n", path);
+		free(table);
+		close(stream.file);
+		return 1;
+	}
+
+	stream.chunk = (chunk_t*) calloc(stream.chunk_count, sizeof(chunk_t));
+	stream.draw_list = (int*) malloc(stream.chunk_count * sizeof(int));
+	stream.load_queue = (int*) malloc(stream.chunk_count * sizeof(int));
+	stream.budget = budget;
+
+	for (index = 0; index < stream.chunk_count; index++)
+		stream.chunk[index].info = table[index];
+
+	free(table);
+
+	/* Start the loader */
+	#ifdef THREADS
+	pthread_mutex_init(&stream.lock, NULL);
+	pthread_cond_init(&stream.wake, NULL);
+	pthread_cond_init(&stream.loaded, NULL);
+	pthread_create(&stream.loader, NULL, stream_loader, NULL);
+	#endif
+
+	return 0;
+}
+
+/* Stop the loader and free every chunk */
+void close_stream()
+{
+	int index;
+
+	#ifdef THREADS
+	pthread_mutex_lock(&stream.lock);
+	stream.quit = 1;
+	pthread_cond_signal(&stream.wake);
+	pthread_mutex_unlock(&stream.lock);
+	pthread_join(stream.loader, NULL);
+	pthread_mutex_destroy(&stream.lock);
+	pthread_cond_destroy(&stream.wake);
+	pthread_cond_destroy(&stream.loaded);
+	#endif
+
+	for (index = 0; index < stream.chunk_count; index++)
+		free_mesh(&stream.chunk[index].mesh);
+
+	free(stream.chunk);
+	free(stream.draw_list);
+	free(stream.load_queue);
+	close(stream.file);
+	memset(&stream, 0, sizeof(stream_t));
+
+	return;
+}
+
+/* Read a chunk from the file */
+int load_chunk(chunk_t* chunk)
+{
+	long vertex_size = chunk->info.vertex_count * sizeof(vertex_t);
+	long tris_size = chunk->info.tris_count * sizeof(unsigned short) * 3;
+	mesh_t* mesh = &chunk->mesh;
+
+	mesh->vertex_buffer = (vertex_t*) malloc(vertex_size);
+	mesh->tris_buffer16 = (unsigned short*) malloc(tris_size);
+	mesh->vertex_count = chunk->info.vertex_count;
+	mesh->bound_min = chunk->info.bound_min;
+	mesh->bound_max = chunk->info.bound_max;
+
+	if (pread(stream.file, mesh->vertex_buffer, vertex_size, chunk->info.offset) != vertex_size ||
+		pread(stream.file, mesh->tris_buffer16, tris_size, chunk->info.offset + vertex_size) != tris_size)
+	{
+		/* Keep it resident and empty, so it is not read again */
+		mesh->tris_count = 0;
+		return 1;
+	}
+
+	mesh->tris_count = chunk->info.tris_count;
+
+	return 0;
+}
+
+/* Resident size of a chunk */
+unsigned long chunk_size(const chunk_info_t* info)
+{
+	return info->vertex_count * sizeof(vertex_t) + info->tris_count * sizeof(unsigned short) * 3;
+}
+
+/* Free the least recently used chunks not needed by this frame, until size more bytes fit in the budget */
+int evict_chunk(unsigned long size)
+{
+	while (stream.resident + size > stream.budget)
+	{
+		int index, victim = -1;
+
+		for (index = 0; index < stream.chunk_count; index++)
+		{
+			chunk_t* chunk = &stream.chunk[index];
+
+			if (chunk->state == CHUNK_READY && chunk->last_used < stream.frame &&
+				(victim < 0 || chunk->last_used < stream.chunk[victim].last_used))
+				victim = index;
+		}
+
+		/* Everything resident is in use */
+		if (victim < 0)
+			return 1;
+
+		stream.resident -= chunk_size(&stream.chunk[victim].info);
+		free_mesh(&stream.chunk[victim].mesh);
+		stream.chunk[victim].state = CHUNK_EMPTY;
+	}
+
+	return 0;
+}
+
+#ifdef THREADS
+/* Background loader, bring in the queued chunks within the budget */
+void* stream_loader(void* arg)
+{
+	(void) arg;
+
+	pthread_mutex_lock(&stream.lock);
+
+	while (!stream.quit)
+	{
+		int index;
+		chunk_t* chunk = NULL;
+
+		/* First queued chunk still missing */
+		for (index = 0; index < stream.load_count && chunk == NULL; index++)
+		{
+			if (stream.chunk[stream.load_queue[index]].state == CHUNK_EMPTY)
+				chunk = &stream.chunk[stream.load_queue[index]];
+		}
+
+		/* Idle until the next frame if there is nothing to do or no room */
+		if (chunk == NULL || evict_chunk(chunk_size(&chunk->info)))
+		{
+			stream.idle_frame = stream.frame;
+			pthread_cond_broadcast(&stream.loaded);
+			pthread_cond_wait(&stream.wake, &stream.lock);
+			continue;
+		}
+
+		/* Reserve the memory and read it without the lock */
+		chunk->state = CHUNK_LOADING;
+		stream.resident += chunk_size(&chunk->info);
+
+		pthread_mutex_unlock(&stream.lock);
+		load_chunk(chunk);
+		pthread_mutex_lock(&stream.lock);
+
+		/* Queued for this frame, do not evict it before it is drawn */
+		chunk->state = CHUNK_READY;
+		chunk->last_used = stream.frame;
+		pthread_cond_broadcast(&stream.loaded);
+	}
+
+	pthread_mutex_unlock(&stream.lock);
+
+	return NULL;
+}
+#endif
+
+/* Render the resident chunks, queue the missing ones */
+void render_stream()
+{
+	int index;
+	int prefetch_count = 0;
+	double start;
+	raster_kernel_t raster = forward_kernel(0);
+
+	/* Reset the frame stats */
+	stream.hits = 0;
+	stream.misses = 0;
+	stream.stall_ms = 0;
+	stream.drawn_tris = 0;
+	stream.resident_count = 0;
+	stream.draw_count = 0;
+	stream.load_count = 0;
+
+	#ifdef THREADS
+	pthread_mutex_lock(&stream.lock);
+	#endif
+
+	stream.frame++;
+
+	/* Draw the resident visible chunks, queue the missing ones with the visible first */
+	for (index = 0; index < stream.chunk_count; index++)
+	{
+		chunk_t* chunk = &stream.chunk[index];
+		int visible;
+
+		/* Out of the prefetch area */
+		if (!box_visible(&chunk->info.bound_min, &chunk->info.bound_max, transform, STREAM_PREFETCH_MARGIN))
+			continue;
+
+		visible = box_visible(&chunk->info.bound_min, &chunk->info.bound_max, transform, 0);
+
+		if (chunk->state == CHUNK_READY)
+		{
+			/* Keep it for this frame */
+			chunk->last_used = stream.frame;
+
+			if (visible)
+			{
+				stream.draw_list[stream.draw_count++] = index;
+				stream.hits++;
+			}
+		}
+		else if (visible)
+		{
+			stream.load_queue[stream.load_count++] = index;
+			stream.misses++;
+		}
+		else
+			stream.load_queue[stream.chunk_count - ++prefetch_count] = index;
+	}
+
+	/* Prefetch after the visible ones */
+	for (index = 0; index < prefetch_count; index++)
+		stream.load_queue[stream.load_count++] = stream.load_queue[stream.chunk_count-1-index];
+
+	start = clock_ms();
+
+	#ifdef THREADS
+	/* Wake the loader */
+	pthread_cond_signal(&stream.wake);
+
+	/* Commands are drawn only once, wait for the visible chunks or for the loader to give up */
+	#ifndef NCURSES
+	for (index = 0; index < stream.misses && stream.idle_frame != stream.frame; )
+	{
+		if (stream.chunk[stream.load_queue[index]].state == CHUNK_READY)
+			index++;
+		else
+			pthread_cond_wait(&stream.loaded, &stream.lock);
+	}
+	#endif
+
+	#else
+	/* No loader, read the visible missing chunks now */
+	for (index = 0; index < stream.misses; index++)
+	{
+		chunk_t* chunk = &stream.chunk[stream.load_queue[index]];
+
+		if (evict_chunk(chunk_size(&chunk->info)))
+			break;
+
+		load_chunk(chunk);
+		chunk->state = CHUNK_READY;
+		stream.resident += chunk_size(&chunk->info);
+	}
+	#endif
+
+	stream.stall_ms = clock_ms() - start;
+
+	/* Add the visible chunks that came in */
+	for (index = 0; index < stream.misses; index++)
+	{
+		chunk_t* chunk = &stream.chunk[stream.load_queue[index]];
+
+		if (chunk->state == CHUNK_READY)
+		{
+			chunk->last_used = stream.frame;
+			stream.draw_list[stream.draw_count++] = stream.load_queue[index];
+		}
+	}
+
+	for (index = 0; index < stream.chunk_count; index++)
+		stream.resident_count += (stream.chunk[index].state == CHUNK_READY);
+
+	/* Chunks used by this frame can not be evicted, draw them without the lock */
+	#ifdef THREADS
+	pthread_mutex_unlock(&stream.lock);
+	#endif
+
+	for (index = 0; index < stream.draw_count; index++)
+	{
+		mesh_t* mesh = &stream.chunk[stream.draw_list[index]].mesh;
+
+		transform_vertices(mesh, transform, view_buffer);
+		raster(mesh);
+		stream.drawn_tris += mesh->tris_count;
+	}
+
+	return;
+}
+
+/* Open a numbered pattern like frame_%04d.obj or a glob, decode the first frame and start the decoder */
+int open_sequence(char* pattern, float fps)
+{
+	int index, capacity = 0;
+	char* format = strchr(pattern, '%');
+	sequence_slot_t* first = &sequence.slot[0];
+
+	memset(&sequence, 0, sizeof(sequence_t));
+
+	/* Numbered pattern: a single integer field, counted from 0 or 1 until a frame is missing */
+	if (format != NULL)
+	{
+		char path[SEQUENCE_PATH];
+		int start;
+
+		format += strspn(format+1, "0123456789") + 1;
+		if (*format != 'd' || strchr(format, '%') != NULL)
+		{
+			printf("Bad sequence pattern %s\n", pattern);
+			return 1;
+		}
+
+		for (start = 0; start < 2 && sequence.frame_count == 0; start++)
+		{
+			for (index = start; ; index++)
+			{
+				snprintf(path, sizeof(path), pattern, index);
+				if (access(path, R_OK))
+					break;
+
+				if (sequence.frame_count == capacity)
+				{
+					capacity = capacity ? capacity*2 : 64;
+					sequence.path = (char**) realloc(sequence.path, capacity * sizeof(char*));
+				}
+
+				sequence.path[sequence.frame_count] = (char*) malloc(strlen(path)+1);
+				strcpy(sequence.path[sequence.frame_count], path);
+				sequence.frame_count++;
+			}
+		}
+	}
+
+	/* Glob, frames in name order */
+	else
+	{
+		glob_t found;
+
+		if (glob(pattern, 0, NULL, &found) == 0)
+		{
+			sequence.path = (char**) malloc(found.gl_pathc * sizeof(char*));
+
+			for (index = 0; index < (int) found.gl_pathc; index++)
+			{
+				sequence.path[index] = (char*) malloc(strlen(found.gl_pathv[index])+1);
+				strcpy(sequence.path[index], found.gl_pathv[index]);
+			}
+
+			sequence.frame_count = found.gl_pathc;
+			globfree(&found);
+		}
+	}
+
+	if (sequence.frame_count == 0)
+	{
+		printf("No frame matches %s\n", pattern);
+		return 1;
+	}
+
+	/* Decode the first frame now, it is shown until the playback starts */
+	decode_frame(first);
+
+	if (first->mesh.tris_count == 0)
+	{
+		printf("Corrupted file %s\n", sequence.path[0]);
+		close_sequence();
+		return 1;
+	}
+
+	first->state = SLOT_READY;
+	first->same_topology = 1;
+	sequence.max_vertex = first->mesh.vertex_count;
+	sequence.fps = fps;
+
+	/* Its tris are the shared index buffer, narrowed to 16 bit if every vertex can be addressed */
+	sequence.topology_count = first->mesh.tris_count;
+	sequence.topology = (int*) malloc(sequence.topology_count * sizeof(int) * 3);
+	memcpy(sequence.topology, first->mesh.tris_buffer, sequence.topology_count * sizeof(int) * 3);
+
+	if (first->mesh.vertex_count <= 65536)
+	{
+		sequence.topology16 = (unsigned short*) malloc(sequence.topology_count * sizeof(unsigned short) * 3);
+
+		for (index = 0; index < sequence.topology_count*3; index++)
+			sequence.topology16[index] = (unsigned short) sequence.topology[index];
+	}
+
+	/* Start the decoder */
+	#ifdef THREADS
+	pthread_mutex_init(&sequence.lock, NULL);
+	pthread_cond_init(&sequence.wake, NULL);
+	pthread_create(&sequence.decoder, NULL, sequence_decoder, NULL);
+	#endif
+
+	return 0;
+}
+
+/* Stop the decoder and free the frames */
+void close_sequence()
+{
+	int index;
+
+	#ifdef THREADS
+	if (sequence.topology != NULL)
+	{
+		pthread_mutex_lock(&sequence.lock);
+		sequence.quit = 1;
+		pthread_cond_signal(&sequence.wake);
+		pthread_mutex_unlock(&sequence.lock);
+		pthread_join(sequence.decoder, NULL);
+		pthread_mutex_destroy(&sequence.lock);
+		pthread_cond_destroy(&sequence.wake);
+	}
+	#endif
+
+	for (index = 0; index < SEQUENCE_SLOTS; index++)
+		free_mesh(&sequence.slot[index].mesh);
+
+	for (index = 0; index < sequence.frame_count; index++)
+		free(sequence.path[index]);
+
+	free(sequence.path);
+	free(sequence.topology);
+	free(sequence.topology16);
+	memset(&sequence, 0, sizeof(sequence_t));
+
+	return;
+}
+
+/* Decode the frame at the slot position in the slot buffers, a frame that does not read is left empty */
+void decode_frame(sequence_slot_t* slot)
+{
+	mesh_reader_t reader;
+	mesh_t* mesh = &slot->mesh;
+	double start = clock_ms();
+
+	mesh->vertex_count = 0;
+	mesh->tris_count = 0;
+
+	if (open_reader(&reader, sequence.path[slot->position % sequence.frame_count]) == 0)
+	{
+		if (read_obj(&reader, mesh, &slot->vertex_capacity, &slot->tris_capacity) || validate_tris(mesh))
+		{
+			mesh->vertex_count = 0;
+			mesh->tris_count = 0;
+		}
+
+		close_reader(&reader);
+	}
+
+	if (mesh->tris_count > 0)
+		compute_bounds(mesh);
+
+	/* Same tris as the first frame, the index buffer is not needed */
+	slot->same_topology = sequence.topology != NULL && mesh->tris_count == sequence.topology_count &&
+		memcmp(mesh->tris_buffer, sequence.topology, mesh->tris_count * sizeof(int) * 3) == 0;
+
+	slot->decode_ms = clock_ms() - start;
+
+	return;
+}
+
+/* Slot for the next frame to decode, late frames are skipped, NULL if every slot holds an upcoming frame */
+sequence_slot_t* next_slot()
+{
+	int index;
+	long position = sequence.decode_position+1;
+
+	/* Jump to the due frame if the decoder fell behind */
+	if (position < sequence.due_position)
+		position = sequence.due_position;
+
+	/* Reuse a free slot or a frame already passed, never the one on screen */
+	for (index = 0; index < SEQUENCE_SLOTS; index++)
+	{
+		sequence_slot_t* slot = &sequence.slot[index];
+
+		if (index != sequence.shown && (slot->state == SLOT_FREE ||
+			(slot->state == SLOT_READY && slot->position < sequence.shown_position)))
+		{
+			sequence.decode_position = position;
+			slot->position = position;
+			return slot;
+		}
+	}
+
+	return NULL;
+}
+
+#ifdef THREADS
+/* Decoder thread, keeps the ring filled with the upcoming frames */
+void* sequence_decoder(void* arg)
+{
+	(void) arg;
+
+	pthread_mutex_lock(&sequence.lock);
+
+	while (!sequence.quit)
+	{
+		sequence_slot_t* slot = next_slot();
+
+		/* Ring full, wait for a frame to be shown */
+		if (slot == NULL)
+		{
+			pthread_cond_wait(&sequence.wake, &sequence.lock);
+			continue;
+		}
+
+		/* Decode without the lock, the renderer does not touch a decoding slot */
+		slot->state = SLOT_DECODING;
+
+		pthread_mutex_unlock(&sequence.lock);
+		decode_frame(slot);
+		pthread_mutex_lock(&sequence.lock);
+
+		slot->state = SLOT_READY;
+	}
+
+	pthread_mutex_unlock(&sequence.lock);
+
+	return NULL;
+}
+#endif
+
+/* Show the newest decoded frame due at the playback clock */
+void render_sequence()
+{
+	int index, newest = -1;
+	double start = clock_ms();
+	sequence_slot_t* slot;
+	mesh_t frame;
+
+	/* The clock starts with the first frame drawn */
+	if (sequence.start_ms == 0)
+		sequence.start_ms = start;
+
+	#ifdef THREADS
+	pthread_mutex_lock(&sequence.lock);
+	#endif
+
+	sequence.due_position = (long) ((start - sequence.start_ms) * sequence.fps / 1000);
+
+	/* No decoder thread, decode the due frame now */
+	#ifndef THREADS
+	if (sequence.due_position > sequence.shown_position)
+	{
+		slot = next_slot();
+		decode_frame(slot);
+		slot->state = SLOT_READY;
+	}
+	#endif
+
+	for (index = 0; index < SEQUENCE_SLOTS; index++)
+	{
+		slot = &sequence.slot[index];
+
+		if (slot->state == SLOT_READY && slot->position > sequence.shown_position &&
+			slot->position <= sequence.due_position && (newest < 0 || slot->position > sequence.slot[newest].position))
+			newest = index;
+	}
+
+	/* Every position passed over is dropped, skipped by the decoder or decoded and never shown */
+	if (newest >= 0)
+	{
+		sequence.dropped += sequence.slot[newest].position - sequence.shown_position - 1;
+		sequence.shown_position = sequence.slot[newest].position;
+		sequence.shown = newest;
+	}
+
+	/* Let the decoder move on to the new due frame */
+	#ifdef THREADS
+	pthread_cond_signal(&sequence.wake);
+	pthread_mutex_unlock(&sequence.lock);
+	#endif
+
+	/* The decoder never writes the slot on screen */
+	slot = &sequence.slot[sequence.shown];
+	frame = slot->mesh;
+
+	if (slot->same_topology)
+	{
+		frame.tris_buffer = sequence.topology16 != NULL ? NULL : sequence.topology;
+		frame.tris_buffer16 = sequence.topology16;
+	}
+
+	/* Grow the view buffer for a frame with more vertex, the frame is not drawn if it can not */
+	if (frame.vertex_count > sequence.max_vertex)
+	{
+		int previous = sequence.max_vertex;
+
+		sequence.max_vertex = frame.vertex_count;
+
+		if (create_buffer(output_width, output_height))
+		{
+			sequence.max_vertex = previous;
+			frame.tris_count = 0;
+		}
+	}
+
+	clear_buffer();
+
+	if (frame.tris_count > 0)
+		draw_mesh(&frame);
+
+	sequence.render_ms = clock_ms() - start;
+
+	return;
+}
+#endif
+
+/* Load a scene: "mesh name path" lines, then "instance name x y z [rx ry rz [scale]]" lines, angles in degree */
+int load_scene(char* path, int quantize)
+{
+	char line_buffer[1024];
+	char name[64][64];
+	int capacity = 16;
+	int index, corner;
+	FILE* scene_file = fopen(path, "r");
+
+	/* Check the read to be succefull */
+	if (scene_file == NULL)
+	{
+		printf("Error reading file %s\n", path);
+		return 1;
+	}
+
+	scene.mesh = (mesh_t*) calloc(64, sizeof(mesh_t));
+	scene.instance = (instance_t*) malloc(capacity * sizeof(instance_t));
+
+	while (fgets(line_buffer, 1024, scene_file))
+	{
+		char word[2][1024];
+		char full_path[2048];
+		float value[7] = {0, 0, 0, 0, 0, 0, 1};
+
+		if (sscanf(line_buffer, "mesh %63s %1023[^\r\n]", word[0], word[1]) == 2 && scene.mesh_count < 64)
+		{
+			char* mesh_path = word[1];
+			char* slash = strrchr(path, '/');
+
+			/* Relative to the scene file */
+			if (word[1][0] != '/' && slash != NULL && slash-path < 1024)
+			{
+				memcpy(full_path, path, slash-path+1);
+				strcpy(full_path + (slash-path+1), word[1]);
+				mesh_path = full_path;
+			}
+
+			/* Every mesh is loaded once */
+			if (load_mesh(mesh_path, &scene.mesh[scene.mesh_count]))
+			{
+				fclose(scene_file);
+				return 1;
+			}
+
+			compact_mesh(&scene.mesh[scene.mesh_count], quantize);
+
+			if (scene.mesh[scene.mesh_count].vertex_count > scene.max_vertex)
+				scene.max_vertex = scene.mesh[scene.mesh_count].vertex_count;
+
+			strcpy(name[scene.mesh_count++], word[0]);
+		}
+		else if (sscanf(line_buffer, "instance %63s %f %f %f %f %f %f %f", word[0], &value[0], &value[1], &value[2], 
+			&value[3], &value[4], &value[5], &value[6]) >= 4)
+		{
+			/* Find the mesh by name */
+			for (index = 0; index < scene.mesh_count && strcmp(name[index], word[0]) != 0; index++);
+
+			if (index == scene.mesh_count)
+			{
+				printf("Unknown mesh %s in %s\n", word[0], path);
+				continue;
+			}
+
+			if (scene.instance_count == capacity)
+			{
+				capacity *= 2;
+				scene.instance = (instance_t*) realloc(scene.instance, capacity * sizeof(instance_t));
+			}
+
+			scene.instance[scene.instance_count].mesh = index;
+			instance_matrix(scene.instance[scene.instance_count].matrix, value);
+			scene.instance_count++;
+		}
+	}
+
+	fclose(scene_file);
+
+	if (scene.instance_count == 0)
+	{
+		printf("Corrupted file %s\n", path);
+		return 1;
+	}
+
+	/* Instances of the same mesh next to each other, drawn in batches */
+	qsort(scene.instance, scene.instance_count, sizeof(instance_t), compare_instance);
+
+	/* World bounds of the transformed boxes */
+	for (index = 0; index < scene.instance_count; index++)
+	{
+		const mesh_t* mesh = &scene.mesh[scene.instance[index].mesh];
+		float (*matrix)[4] = scene.instance[index].matrix;
+
+		for (corner = 0; corner < 8; corner++)
+		{
+			vertex_t world;
+			float x = (corner & 1) ? mesh->bound_max.x : mesh->bound_min.x;
+			float y = (corner & 2) ? mesh->bound_max.y : mesh->bound_min.y;
+			float z = (corner & 4) ? mesh->bound_max.z : mesh->bound_min.z;
+
+			world.x = matrix[0][0]*x + matrix[1][0]*y + matrix[2][0]*z + matrix[3][0];
+			world.y = matrix[0][1]*x + matrix[1][1]*y + matrix[2][1]*z + matrix[3][1];
+			world.z = matrix[0][2]*x + matrix[1][2]*y + matrix[2][2]*z + matrix[3][2];
+
+			if ((index == 0 && corner == 0) || world.x < scene.bounds.bound_min.x) scene.bounds.bound_min.x = world.x;
+			if ((index == 0 && corner == 0) || world.y < scene.bounds.bound_min.y) scene.bounds.bound_min.y = world.y;
+			if ((index == 0 && corner == 0) || world.z < scene.bounds.bound_min.z) scene.bounds.bound_min.z = world.z;
+			if ((index == 0 && corner == 0) || world.x > scene.bounds.bound_max.x) scene.bounds.bound_max.x = world.x;
+			if ((index == 0 && corner == 0) || world.y > scene.bounds.bound_max.y) scene.bounds.bound_max.y = world.y;
+			if ((index == 0 && corner == 0) || world.z > scene.bounds.bound_max.z) scene.bounds.bound_max.z = world.z;
+		}
+	}
+
+	return 0;
+}
+
+/* Order the instances by mesh */
+int compare_instance(const void* first, const void* second)
+{
+	return ((const instance_t*)first)->mesh - ((const instance_t*)second)->mesh;
+}
+
+/* Model matrix from translation, rotation in degree on x, y and z, and uniform scale */
+void instance_matrix(float matrix[4][4], const float* value)
+{
+	int row, col, dot_index;
+	float rotation[3][3][3];
+	float result[3][3];
+	float sin_rot, cos_rot;
+
+	/* Single axis rotations, the same elements as rotate_x, rotate_y and rotate_z */
+	memset(rotation, 0, sizeof(rotation));
+
+	sin_rot = sine(value[3]*PI/180);
+	cos_rot = cosine(value[3]*PI/180);
+	rotation[0][1][1] = cos_rot;
+	rotation[0][1][2] = sin_rot;
+	rotation[0][2][2] = cos_rot;
+	rotation[0][2][1] = -sin_rot;
+	rotation[0][0][0] = 1.f;
+
+	sin_rot = sine(value[4]*PI/180);
+	cos_rot = cosine(value[4]*PI/180);
+	rotation[1][0][0] = cos_rot;
+	rotation[1][2][0] = -sin_rot;
+	rotation[1][0][2] = sin_rot;
+	rotation[1][2][2] = cos_rot;
+	rotation[1][1][1] = 1.f;
+
+	sin_rot = sine(-value[5]*PI/180);
+	cos_rot = cosine(-value[5]*PI/180);
+	rotation[2][0][0] = cos_rot;
+	rotation[2][0][1] = sin_rot;
+	rotation[2][1][0] = -sin_rot;
+	rotation[2][1][1] = cos_rot;
+	rotation[2][2][2] = 1.f;
+
+	/* X, then Y, then Z */
+	for (row = 0; row < 3; row++)
+	{
+		for (col = 0; col < 3; col++)
+		{
+			result[row][col] = 0;
+
+			for (dot_index = 0; dot_index < 3; dot_index++)
+				result[row][col] += rotation[0][row][dot_index]*rotation[1][dot_index][col];
+		}
+	}
+
+	for (row = 0; row < 3; row++)
+	{
+		for (col = 0; col < 3; col++)
+		{
+			matrix[row][col] = 0;
+
+			for (dot_index = 0; dot_index < 3; dot_index++)
+				matrix[row][col] += result[row][dot_index]*rotation[2][dot_index][col];
+
+			matrix[row][col] *= value[6];
+		}
+
+		matrix[row][3] = 0;
+	}
+
+	/* Translation */
+	matrix[3][0] = value[0];
+	matrix[3][1] = value[1];
+	matrix[3][2] = value[2];
+	matrix[3][3] = 1;
+
+	return;
+}
+
+/* Free the scene meshes and instances */
+void free_scene()
+{
+	int index;
+
+	for (index = 0; index < scene.mesh_count; index++)
+		free_mesh(&scene.mesh[index]);
+
+	free(scene.mesh);
+	free(scene.instance);
+	memset(&scene, 0, sizeof(scene_t));
+
+	return;
+}
+
+/* Render the visible instances: the kernel is picked once per mesh, then every batch of its instances is transformed
+   in one pass over the mesh vertex and rastered */
+void render_scene()
+{
+	vertex_t* frame_view = view_buffer;
+	int first, next, end, index, row, col, dot_index;
+
+	scene.drawn_instances = 0;
+	scene.drawn_tris = 0;
+
+	/* Instances are sorted by mesh, a run of them shares the mesh and the kernel */
+	for (first = 0; first < scene.instance_count; first = end)
+	{
+		const mesh_t* mesh = &scene.mesh[scene.instance[first].mesh];
+		raster_kernel_t raster = forward_kernel(mesh->tris_buffer != NULL);
+
+		for (end = first; end < scene.instance_count && scene.instance[end].mesh == scene.instance[first].mesh; end++);
+
+		for (next = first; next < end;)
+		{
+			int batch_count = 0;
+
+			/* Visible instances up to a batch, each in its own slice of the view buffer */
+			for (; next < end && batch_count < SCENE_BATCH; next++)
+			{
+				const instance_t* instance = &scene.instance[next];
+				float model_view[4][4];
+
+				/* Model then view */
+				for (row = 0; row < 4; row++)
+				{
+					for (col = 0; col < 4; col++)
+					{
+						model_view[row][col] = 0;
+
+						for (dot_index = 0; dot_index < 4; dot_index++)
+							model_view[row][col] += instance->matrix[row][dot_index]*transform[dot_index][col];
+					}
+				}
+
+				/* Cull by the transformed bounds */
+				if (!box_visible(&mesh->bound_min, &mesh->bound_max, model_view, 0))
+					continue;
+
+				transform_vertices(mesh, model_view, frame_view + batch_count*mesh->vertex_count);
+				batch_count++;
+			}
+
+			/* The kernel reads the view buffer, pointed at every slice in turn */
+			for (index = 0; index < batch_count; index++)
+			{
+				view_buffer = frame_view + index*mesh->vertex_count;
+				raster(mesh);
+			}
+
+			view_buffer = frame_view;
+			scene.drawn_instances += batch_count;
+			scene.drawn_tris += batch_count*mesh->tris_count;
+		}
+	}
+
+	return;
+}
+
+/* Render to screen buffer */
+void render_to_buffer()
+{
+	const mesh_t* mesh;
+
+	/* Instanced scene */
+	if (scene.instance_count > 0)
+	{
+		clear_buffer();
+
+		update_depth_range(&scene.bounds);
+
+		render_scene();
+
+		return;
+	}
+
+	/* Streamed mesh, drawn chunk by chunk */
+	#ifdef POSIX
+	if (stream.chunk != NULL)
+	{
+		clear_buffer();
+
+		update_depth_range(&stream.bounds);
+
+		render_stream();
+
+		return;
+	}
+
+	/* Mesh sequence, the frame due now */
+	if (sequence.frame_count > 0)
+	{
+		render_sequence();
+
+		return;
+	}
+	#endif
+
+	/* Split screen, a view of the mesh in every viewport */
+	if (split_count > 0)
+	{
+		render_split();
+
+		return;
+	}
+
+	/* Pick the level of detail */
+	lod_active = select_lod();
+	mesh = &lod_chain[lod_active];
+
+	/* Clear before start */
+	clear_buffer();
+
+	/* Edges are built once per level, the first time it is drawn */
+	if (wire_mode != WIRE_OFF)
+	{
+		if (lod_chain[lod_active].edge_buffer == NULL && build_edges(&lod_chain[lod_active]))
+			wire_mode = WIRE_OFF;
+		else
+		{
+			draw_wireframe(mesh);
+			return;
+		}
+	}
+
+	draw_mesh(mesh);
+
+	return;
+}
+
+/* Transform and raster a single mesh, shading in the raster or in a resolve pass */
+void draw_mesh(const mesh_t* mesh)
+{
+	/* Pick the kernel once per frame */
+	int wide_index = mesh->tris_buffer != NULL;
+	raster_kernel_t raster = deferred ? visibility_table[wide_index][ortho][depth_mode] : forward_kernel(wide_index);
+
+	/* Transform every vertex once */
+	transform_vertices(mesh, transform, view_buffer);
+
+	/* Fit the depth range on the mesh, the benchmark shows the precision of every format */
+	update_depth_range(mesh);
+
+	/* Raster the tris */
+	raster(mesh);
+
+	/* Shade the cells left visible */
+	if (deferred)
+	{
+		#ifdef BENCHMARK
+		double start = clock_ms();
+		#endif
+
+		resolve_visibility(mesh);
+
+		#ifdef BENCHMARK
+		resolve_ms = clock_ms() - start;
+		#endif
+	}
+
+	return;
+}
+
+/* Shade every covered cell once, from the tris its id points to */
+void resolve_visibility(const mesh_t* mesh)
+{
+	int cell;
+	unsigned int id, last_id = ID_EMPTY;
+	char shade = ' ';
+
+	#ifdef BENCHMARK
+	resolved_cells = 0;
+	#endif
+
+	for (cell = 0; cell < buffer_width*buffer_height; cell++)
+	{
+		id = id_buffer[cell];
+
+		if (id == ID_EMPTY)
+			continue;
+
+		/* Neighbour cells mostly see the same tris, shade it once per run */
+		if (id != last_id)
+		{
+			shade = shade_tris(mesh, id);
+			last_id = id;
+		}
+
+		/* Sample bit in its cell, set when lit or in material mode */
+		if (glyph_mode != GLYPH_TEXT)
+		{
+			int x = cell % buffer_width, y = cell / buffer_width;
+			int shift_x = glyph_shift_x[glyph_mode], shift_y = glyph_shift_y[glyph_mode];
+			unsigned char bit = 1 << (((y & ((1 << shift_y)-1)) << shift_x) + (x & ((1 << shift_x)-1)));
+
+			if (shade != SHADOW_CHAR)
+				coverage_buffer[(x >> shift_x) + (y >> shift_y)*output_width] |= bit;
+		}
+		else
+			screen_buffer[cell] = shade;
+
+		#ifdef BENCHMARK
+		resolved_cells++;
+		#endif
+	}
+
+	return;
+}
+
+/* Shade of a tris, the same the raster kernel gives it */
+char shade_tris(const mesh_t* mesh, unsigned int tris)
+{
+	const vertex_t* vertex0 = &view_buffer[mesh_index(mesh, tris*3)];
+	const vertex_t* vertex1 = &view_buffer[mesh_index(mesh, tris*3+1)];
+	const vertex_t* vertex2 = &view_buffer[mesh_index(mesh, tris*3+2)];
+	vertex_t normal, edge0, edge1;
+	float light;
+
+	/* Material cycle, the first tris takes the second material */
+	if (!do_light)
+		return material_array[(tris+1) % (sizeof(material_array)/sizeof(material_array[0]))];
+
+	/* Face normal as cross product */
+	edge0.x = vertex0->x-vertex2->x;
+	edge0.y = vertex0->y-vertex2->y;
+	edge0.z = vertex0->z-vertex2->z;
+	edge1.x = vertex1->x-vertex2->x;
+	edge1.y = vertex1->y-vertex2->y;
+	edge1.z = vertex1->z-vertex2->z;
+
+	normal.x = edge0.y*edge1.z - edge0.z*edge1.y;
+	normal.y = edge0.z*edge1.x - edge0.x*edge1.z;
+	normal.z = edge0.x*edge1.y - edge0.y*edge1.x;
+
+	/* Light factor, flipped on a backward normal */
+	light = normal.x*-LIGHT_POS_X+normal.y*LIGHT_POS_Y+normal.z*LIGHT_POS_Z;
+
+	if (normal.z > 0)
+		light *= -1;
+
+	return light < 0 ? SHADOW_CHAR : LIGHT_CHAR;
+}
+
+/* Draw the mesh edges, the hidden line modes test them against a filled pass */
+void draw_wireframe(const mesh_t* mesh)
+{
+	int edge;
+	int depth_test = wire_mode != WIRE_EDGES;
+
+	/* Fill the depth buffer, then drop the shading */
+	if (depth_test)
+	{
+		draw_mesh(mesh);
+		memset(screen_buffer, ' ', buffer_width * buffer_height);
+
+		if (glyph_mode != GLYPH_TEXT)
+			memset(coverage_buffer, 0, output_width * output_height);
+	}
+	else
+		transform_vertices(mesh, transform, view_buffer);
+
+	#ifdef BENCHMARK
+	wire_drawn = 0;
+	#endif
+
+	for (edge = 0; edge < mesh->edge_count; edge++)
+	{
+		const int* face = &mesh->edge_face[edge*2];
+
+		/* Silhouette, a border or faces on both sides of the view */
+		if (wire_mode == WIRE_SILHOUETTE && face[1] >= 0 && front_face(mesh, face[0]) == front_face(mesh, face[1]))
+			continue;
+
+		draw_edge(&view_buffer[mesh->edge_buffer[edge*2]], &view_buffer[mesh->edge_buffer[edge*2+1]], depth_test);
+	}
+
+	return;
+}
+
+/* Check if a tris faces the view */
+int front_face(const mesh_t* mesh, int tris)
+{
+	const vertex_t* vertex0 = &view_buffer[mesh_index(mesh, tris*3)];
+	const vertex_t* vertex1 = &view_buffer[mesh_index(mesh, tris*3+1)];
+	const vertex_t* vertex2 = &view_buffer[mesh_index(mesh, tris*3+2)];
+	vertex_t normal, edge0, edge1;
+
+	edge0.x = vertex0->x-vertex2->x;
+	edge0.y = vertex0->y-vertex2->y;
+	edge0.z = vertex0->z-vertex2->z;
+	edge1.x = vertex1->x-vertex2->x;
+	edge1.y = vertex1->y-vertex2->y;
+	edge1.z = vertex1->z-vertex2->z;
+
+	normal.x = edge0.y*edge1.z - edge0.z*edge1.y;
+	normal.y = edge0.z*edge1.x - edge0.x*edge1.z;
+	normal.z = edge0.x*edge1.y - edge0.y*edge1.x;
+
+	/* Along the view axis, or toward the eye at the origin */
+	if (ortho)
+		return normal.z > 0;
+
+	return normal.x*vertex0->x + normal.y*vertex0->y + normal.z*vertex0->z < 0;
+}
+
+/* Raster an edge with Bresenham, clipped on the near plane and on the buffer */
+void draw_edge(const vertex_t* from, const vertex_t* to, int depth_test)
+{
+	vertex_t point[2];
+	float x[2], y[2], depth[2];
+	float enter = 0, leave = 1;
+	float clip_delta[4], clip_room[4], span;
+	int fixed_x[2], fixed_y[2];
+	int side, delta_x, delta_y, step_x, step_y, error, twice_error, steps, step;
+	char line_char;
+
+	point[0] = *from;
+	point[1] = *to;
+
+	/* Near plane */
+	if (point[0].z < NEAR_PLANE && point[1].z < NEAR_PLANE)
+		return;
+
+	for (side = 0; side < 2; side++)
+	{
+		if (point[side].z < NEAR_PLANE)
+		{
+			const vertex_t* other = &point[1-side];
+			float t = (NEAR_PLANE - point[side].z)/(other->z - point[side].z);
+
+			point[side].x += (other->x - point[side].x)*t;
+			point[side].y += (other->y - point[side].y)*t;
+			point[side].z = NEAR_PLANE;
+		}
+	}
+
+	/* Same projection as the raster kernel, depth kept linear on screen */
+	for (side = 0; side < 2; side++)
+	{
+		float divisor = ortho ? -transform[3][2] : -point[side].z;
+
+		x[side] = (point[side].x / divisor * buffer_width) + buffer_width/2;
+		y[side] = (point[side].y / divisor * buffer_height)*screen_rateo + buffer_height/2;
+		depth[side] = ortho ? point[side].z : 1.f/point[side].z;
+	}
+
+	/* Clip on the buffer edges, pixel centers are on whole coordinates */
+	clip_delta[0] = x[0]-x[1];
+	clip_delta[1] = x[1]-x[0];
+	clip_delta[2] = y[0]-y[1];
+	clip_delta[3] = y[1]-y[0];
+	clip_room[0] = x[0]+0.5f;
+	clip_room[1] = buffer_width-0.5f-x[0];
+	clip_room[2] = y[0]+0.5f;
+	clip_room[3] = buffer_height-0.5f-y[0];
+
+	for (side = 0; side < 4; side++)
+	{
+		if (clip_delta[side] == 0)
+		{
+			if (clip_room[side] < 0)
+				return;
+		}
+		else if (clip_delta[side] < 0)
+		{
+			float t = clip_room[side]/clip_delta[side];
+			enter = t > enter ? t : enter;
+		}
+		else
+		{
+			float t = clip_room[side]/clip_delta[side];
+			leave = t < leave ? t : leave;
+		}
+	}
+
+	if (enter > leave)
+		return;
+
+	/* Clipped end points snapped to pixels */
+	for (side = 0; side < 2; side++)
+	{
+		float t = side ? leave : enter;
+		float at_x = x[0] + (x[1]-x[0])*t;
+		float at_y = y[0] + (y[1]-y[0])*t;
+
+		fixed_x[side] = (int) (at_x + 0.5f);
+		fixed_y[side] = (int) (at_y + 0.5f);
+		fixed_x[side] = fixed_x[side] < buffer_width ? fixed_x[side] : buffer_width-1;
+		fixed_y[side] = fixed_y[side] < buffer_height ? fixed_y[side] : buffer_height-1;
+	}
+
+	span = depth[1]-depth[0];
+	depth[1] = depth[0] + span*leave;
+	depth[0] = depth[0] + span*enter;
+
+	delta_x = fixed_x[1] > fixed_x[0] ? fixed_x[1]-fixed_x[0] : fixed_x[0]-fixed_x[1];
+	delta_y = fixed_y[1] > fixed_y[0] ? fixed_y[0]-fixed_y[1] : fixed_y[1]-fixed_y[0];
+	step_x = fixed_x[1] > fixed_x[0] ? 1 : -1;
+	step_y = fixed_y[1] > fixed_y[0] ? 1 : -1;
+	error = delta_x + delta_y;
+	steps = delta_x > -delta_y ? delta_x : -delta_y;
+
+	/* Char on the slope, a cell is taller than wide */
+	if (-delta_y*2 < delta_x*FONT_RATEO)
+		line_char = '-';
+	else if (delta_x*FONT_RATEO*2 < -delta_y)
+		line_char = '|';
+	else
+		line_char = (step_x == step_y) ? '\\' : '/';
+
+	#ifdef BENCHMARK
+	wire_drawn++;
+	#endif
+
+	for (step = 0; ; step++)
+	{
+		int cell = fixed_x[0] + fixed_y[0]*buffer_width;
+		int visible = 1;
+
+		/* Keep the pixel unless a face is in front of the edge */
+		if (depth_test)
+		{
+			float pixel_depth = depth[0] + (depth[1]-depth[0])*(steps > 0 ? (float)step/steps : 0);
+			float stored;
+
+			if (ortho)
+				pixel_depth = 1.f/pixel_depth;
+
+			/* Compare in 1/z, the slack is relative to the depth */
+			if (depth_mode == DEPTH_FLOAT)
+				stored = depth_buffer[cell];
+			else
+			{
+				stored = (depth_buffer16[cell]-1.5f)/65534;
+				stored = (stored - depth_bias)/depth_scale;
+			}
+
+			visible = stored - pixel_depth <= stored*WIRE_DEPTH_BIAS;
+		}
+
+		if (visible)
+		{
+			if (glyph_mode != GLYPH_TEXT)
+			{
+				int shift_x = glyph_shift_x[glyph_mode], shift_y = glyph_shift_y[glyph_mode];
+
+				coverage_buffer[(fixed_x[0] >> shift_x) + (fixed_y[0] >> shift_y)*output_width] |=
+					1 << (((fixed_y[0] & ((1 << shift_y)-1)) << shift_x) + (fixed_x[0] & ((1 << shift_x)-1)));
+			}
+			else
+				screen_buffer[cell] = line_char;
+		}
+
+		if (fixed_x[0] == fixed_x[1] && fixed_y[0] == fixed_y[1])
+			break;
+
+		/* Step on one or both axis */
+		twice_error = error*2;
+
+		if (twice_error >= delta_y)
+		{
+			error += delta_y;
+			fixed_x[0] += step_x;
+		}
+		if (twice_error <= delta_x)
+		{
+			error += delta_x;
+			fixed_y[0] += step_y;
+		}
+	}
+
+	return;
+}
+
+/* Clear the console */
+void clear_screen()
+{	
+	#ifdef NCURSES
+	/* Just call ncurses clear */
+	clear();
+	
+	#else
+	/* Use CLI method */
+	int new_line;
+
+	/* Print 64 new line */
+	for (new_line = 0; new_line < 64; new_line++)
+		putchar('\n');
+	#endif
+
+	return;
+}
+
+/* Draw in the console */
+void draw_screen()
+{
+	#ifdef NCURSES
+	int col, row;
+	#endif
+
+	/* Frame benchmark */
+	#ifdef BENCHMARK
+	struct timeval start_frame, stop_frame, stop_render;
+	gettimeofday(&start_frame, NULL);
+	#endif
+
+	/* Render time, for the resolution scaling */
+	#ifdef REALTIME
+	double render_ms = clock_ms();
+	#endif
+
+	/* Render to buffer */
+	render_to_buffer();
+
+	#ifdef REALTIME
+	render_ms = clock_ms() - render_ms;
+	#endif
+
+	/* Benchmark rastering time */
+	#ifdef BENCHMARK
+	gettimeofday(&stop_render, NULL);
+	#endif
+	
+	/* Clear the console */
+	clear_screen();
+
+	#ifdef NCURSES
+	/* Print it, Ncurses color mode */
+	if (use_color && glyph_mode == GLYPH_TEXT)
+	{
+		/* Light mode */
+		if (do_light)
+		{
+			for (row = 0; row < output_height; row++)
+			{	
+				for (col = 0; col < output_width; col++)
+				{
+					/* Set color attribute */
+					if (screen_cell(col, row) == SHADOW_CHAR)
+						attron(COLOR_PAIR(3));
+					else if (screen_cell(col, row) == LIGHT_CHAR)
+						attron(COLOR_PAIR(2));
+					else
+						attron(COLOR_PAIR(1));
+
+					/* Print a blank space */
+					addch(' ');
+				}
+			}
+		}
+
+		/* No light */
+		else
+		{
+			for (row = 0; row < output_height; row++)
+			{	
+				for (col = 0; col < output_width; col++)
+				{
+					/* Set color attribute */
+					if (screen_cell(col, row) != ' ')
+						attron(COLOR_PAIR(screen_cell(col, row)%7+4));
+					else
+						attron(COLOR_PAIR(1));
+
+					/* Print a blank space */
+					addch(' ');
+				}
+			}
+		}
+
+		/* Restore black and white */
+		attron(COLOR_PAIR(1));
+	}
+
+	/* Ncurses, no color */
+	else
+	{
+		for (row = 0; row < output_height; row++)
+		{	
+			for (col = 0; col < output_width; col++)
+			{
+				/* Print the char in the buffer, or the glyph of the samples */
+				if (glyph_mode == GLYPH_TEXT)
+					addch(screen_cell(col, row));
+				else
+					addstr(glyph_table[glyph_mode][coverage_buffer[col+row*output_width]]);
+			}
+		}
+	}
+
+	/* Frame benchmark */
+	#ifdef BENCHMARK
+	gettimeofday(&stop_frame, NULL);
+
+	mvprintw(0, 0, "[Frame: %.1f ms (Render: %.1f ms), Tris: %d, Mesh: %lu KB]", 
+		(double)(stop_frame.tv_usec - start_frame.tv_usec)/1000+
+		(double)(stop_frame.tv_sec - start_frame.tv_sec)*1000,
+		(double)(stop_render.tv_usec - start_frame.tv_usec)/1000+
+		(double)(stop_render.tv_sec - start_frame.tv_sec)*1000,
+		lod_chain[lod_active].tris_count, mesh_size(&lod_chain[lod_active])/1024);
+
+	/* Quantization error bound */
+	if (lod_chain[0].quant_buffer)
+		printw("[Quant err: %g]", lod_chain[0].quant_error);
+
+	/* Level of detail */
+	if (lod_count > 1)
+		printw("[LOD: %d/%d%s]", lod_active, lod_count-1, lod_pin >= 0 ? " pinned" : "");
+
+	/* Depth format */
+	printw("[Depth: %s, %lu KB, Step: %.2g]", depth_mode_name[depth_mode], depth_size()/1024, depth_step());
+
+	/* Cells shaded by the resolve pass */
+	if (deferred)
+		printw("[Deferred: %d cells, Resolve: %.2f ms]", resolved_cells, resolve_ms);
+
+	/* Wireframe edges drawn */
+	if (wire_mode != WIRE_OFF)
+		printw("[Wire: %s, %d/%d edges]", wire_mode_name[wire_mode], wire_drawn, lod_chain[lod_active].edge_count);
+
+	/* Output glyphs and samples rastered per second */
+	printw("[Output: %s, %dx%d samples, %.1f M/s]", glyph_mode_name[glyph_mode], buffer_width, buffer_height,
+		(double)buffer_width*buffer_height/1000/((double)(stop_render.tv_usec - start_frame.tv_usec)/1000+
+		(double)(stop_render.tv_sec - start_frame.tv_sec)*1000 + 0.001));
+
+	/* Split viewports, the focused one and the time of the concurrent render */
+	if (split_count > 0)
+		printw("[Split: %d viewports, Focus: %d, Render: %.1f ms]", split_count, split_focus+1, split_ms);
+
+	/* Tris BVH of the full mesh, built on the first pick or fit */
+	if (lod_chain[0].bvh_node != NULL)
+		printw("[BVH: %d nodes, %lu KB, Build: %.1f ms]", lod_chain[0].bvh_count,
+			(unsigned long)(sizeof(bvh_node_t)*lod_chain[0].bvh_count + sizeof(int)*lod_chain[0].tris_count)/1024, bvh_ms);
+
+	/* Render arena */
+	printw("[Arena: %lu KB, Allocs: %lu]", render_arena.capacity/1024, render_arena.alloc_count);
+
+	/* Sustained frame rate against the target */
+	#ifdef REALTIME
+	if (measured_fps > 0)
+		printw("[Rate: %.1f fps, Target: %g]", measured_fps, loop_fps);
+
+	/* Render resolution against the screen */
+	if (frame_budget > 0)
+		printw("[Scale: %.2f, %dx%d]", resolution_scale[resolution_level], buffer_width, buffer_height);
+	#endif
+
+	/* Mesh load time and throughput of the decompressed data */
+	if (load_ms > 0)
+		printw("[Load: %.0f ms, %.1f MB/s]", load_ms, load_bytes/1048576.0/(load_ms/1000));
+
+	/* Scene meshes, drawn instances and tris */
+	if (scene.instance_count > 0)
+		printw("[Scene: %d meshes, Instances: %d/%d, Drawn: %d]", scene.mesh_count, scene.drawn_instances,
+			scene.instance_count, scene.drawn_tris);
+
+	/* Streaming residency, drawn tris and time spent waiting for the disk */
+	#ifdef POSIX
+	if (stream.chunk != NULL)
+		printw("[Stream: %.1f/%lu MB, Chunks: %d/%d, Drawn: %d, Hit: %d, Miss: %d, Stall: %.1f ms]",
+			(double)stream.resident/(1 << 20), stream.budget >> 20, stream.resident_count, stream.chunk_count,
+			stream.drawn_tris, stream.hits, stream.misses, stream.stall_ms);
+
+	/* Sequence frame, frames passed over as not decoded or drawn in time, decode and render time of the frame on screen */
+	if (sequence.frame_count > 0)
+		printw("[Sequence: %d/%d at %g fps, Dropped: %ld, Decode: %.1f ms, Render: %.1f ms%s]",
+			(int) (sequence.shown_position % sequence.frame_count)+1, sequence.frame_count, sequence.fps,
+			sequence.dropped, sequence.slot[sequence.shown].decode_ms, sequence.render_ms,
+			sequence.slot[sequence.shown].same_topology ? ", shared index" : "");
+	#endif
+	#endif
+
+	#else
+	/* Print it, CLI mode */
+	write_screen(stdout);
+
+	/* Result of the last pick, once */
+	if (pick_text[0])
+	{
+		puts(pick_text);
+		pick_text[0] = '\0';
+	}
+
+	/* Frame benchmark */
+	#ifdef BENCHMARK
+	gettimeofday(&stop_frame, NULL);
+
+	printf("[Frame: %.1f ms (Render: %.1f ms), Tris: %d, Mesh: %lu KB]", 
 		(double)(stop_frame.tv_usec - start_frame.tv_usec)/1000+
 		(double)(stop_frame.tv_sec - start_frame.tv_sec)*1000,
 		(double)(stop_render.tv_usec - start_frame.tv_usec)/1000+
 		(double)(stop_render.tv_sec - start_frame.tv_sec)*1000,
-		tris_count);
+		lod_chain[lod_active].tris_count, mesh_size(&lod_chain[lod_active])/1024);
+
+	/* Quantization error bound */
+	if (lod_chain[0].quant_buffer)
+		printf("[Quant err: %g]", lod_chain[0].quant_error);
+
+	/* Level of detail */
+	if (lod_count > 1)
+		printf("[LOD: %d/%d%s]", lod_active, lod_count-1, lod_pin >= 0 ? " pinned" : "");
+
+	/* Depth format */
+	printf("[Depth: %s, %lu KB, Step: %.2g]", depth_mode_name[depth_mode], depth_size()/1024, depth_step());
+
+	/* Cells shaded by the resolve pass */
+	if (deferred)
+		printf("[Deferred: %d cells, Resolve: %.2f ms]", resolved_cells, resolve_ms);
+
+	/* Wireframe edges drawn */
+	if (wire_mode != WIRE_OFF)
+		printf("[Wire: %s, %d/%d edges]", wire_mode_name[wire_mode], wire_drawn, lod_chain[lod_active].edge_count);
+
+	/* Output glyphs and samples rastered per second */
+	printf("[Output: %s, %dx%d samples, %.1f M/s]", glyph_mode_name[glyph_mode], buffer_width, buffer_height,
+		(double)buffer_width*buffer_height/1000/((double)(stop_render.tv_usec - start_frame.tv_usec)/1000+
+		(double)(stop_render.tv_sec - start_frame.tv_sec)*1000 + 0.001));
+
+	/* Color encoder, bytes and encode time of the frame */
+	if (ansi_mode != ANSI_OFF && glyph_mode == GLYPH_TEXT)
+		printf("[Color: %s, %lu bytes/frame, Encode: %.3f ms]", ansi_mode_name[ansi_mode], ansi_bytes, ansi_ms);
+
+	/* Split viewports, the focused one and the time of the concurrent render */
+	if (split_count > 0)
+		printf("[Split: %d viewports, Focus: %d, Render: %.1f ms]", split_count, split_focus+1, split_ms);
+
+	/* Tris BVH of the full mesh, built on the first pick or fit */
+	if (lod_chain[0].bvh_node != NULL)
+		printf("[BVH: %d nodes, %lu KB, Build: %.1f ms]", lod_chain[0].bvh_count,
+			(unsigned long)(sizeof(bvh_node_t)*lod_chain[0].bvh_count + sizeof(int)*lod_chain[0].tris_count)/1024, bvh_ms);
+
+	/* Render arena */
+	printf("[Arena: %lu KB, Allocs: %lu]", render_arena.capacity/1024, render_arena.alloc_count);
+
+	/* Sustained frame rate against the target */
+	#ifdef REALTIME
+	if (measured_fps > 0)
+		printf("[Rate: %.1f fps, Target: %g]", measured_fps, loop_fps);
+
+	/* Render resolution against the screen */
+	if (frame_budget > 0)
+		printf("[Scale: %.2f, %dx%d]", resolution_scale[resolution_level], buffer_width, buffer_height);
+	#endif
+
+	/* Mesh load time and throughput of the decompressed data */
+	if (load_ms > 0)
+		printf("[Load: %.0f ms, %.1f MB/s]", load_ms, load_bytes/1048576.0/(load_ms/1000));
+
+	/* Scene meshes, drawn instances and tris */
+	if (scene.instance_count > 0)
+		printf("[Scene: %d meshes, Instances: %d/%d, Drawn: %d]", scene.mesh_count, scene.drawn_instances,
+			scene.instance_count, scene.drawn_tris);
+
+	/* Streaming residency, drawn tris and time spent waiting for the disk */
+	#ifdef POSIX
+	if (stream.chunk != NULL)
+		printf("[Stream: %.1f/%lu MB, Chunks: %d/%d, Drawn: %d, Hit: %d, Miss: %d, Stall: %.1f ms]",
+			(double)stream.resident/(1 << 20), stream.budget >> 20, stream.resident_count, stream.chunk_count,
+			stream.drawn_tris, stream.hits, stream.misses, stream.stall_ms);
+
+	/* Sequence frame, frames passed over as not decoded or drawn in time, decode and render time of the frame on screen */
+	if (sequence.frame_count > 0)
+		printf("[Sequence: %d/%d at %g fps, Dropped: %ld, Decode: %.1f ms, Render: %.1f ms%s]",
+			(int) (sequence.shown_position % sequence.frame_count)+1, sequence.frame_count, sequence.fps,
+			sequence.dropped, sequence.slot[sequence.shown].decode_ms, sequence.render_ms,
+			sequence.slot[sequence.shown].same_topology ? ", shared index" : "");
+	#endif
+
+	printf(" > ");
+	#else
+	printf("> ");
+	#endif
+	#endif
+
+	/* Fit the next frames in the budget */
+	#ifdef REALTIME
+	if (frame_budget > 0)
+		adapt_resolution(render_ms);
+	#endif
+
+	return;
+}
+
+/* Buffer char shown at a screen cell, the buffer is upsampled if rendered at a lower resolution */
+char screen_cell(int col, int row)
+{
+	return screen_buffer[col*buffer_width/output_width + row*buffer_height/output_height*buffer_width];
+}
+
+/* Help message */
+void show_help()
+{
+	/* Clear the console */
+	clear_screen();
+
+	#ifdef NCURSES
+	/* Print usage instruction, Ncurses mode */
+	mvprintw(0, 0, "%s", HELP_MESSAGE);
+
+	/* Wait input, with no frame timeout */
+	timeout(-1);
+	getch();
+
+	#else
+	/* Print usage instruction, CLI mode */
+	puts(HELP_MESSAGE0);
+	puts(HELP_MESSAGE1);
+	
+	/* Wait input to proceed */
+	getchar();
+	#endif
+
+	return;
+}
+
+/* Create depth and screen buffer, return 1 keeping the buffers in use if the size can not be had */
+int create_buffer(int width, int height)
+{
+	unsigned long view_size, screen_size, depth_size, id_size, coverage_size, ansi_size, split_size;
+	int frame_width = output_width, frame_height = output_height;
+	int index;
+
+	/* Check width and height to be more than zero, and the samples to be indexed by an int */
+	if (width <= 0 || height <= 0 ||
+		(unsigned long)width*height > (unsigned long)INT_MAX >> (glyph_shift_x[glyph_mode] + glyph_shift_y[glyph_mode]))
+		return 1;
+
+	/* Screen size, the buffer may be rendered at a lower resolution and upsampled */
+	output_width = width;
+	output_height = height;
+
+	/* Glyph output rasters the samples of every cell, at full resolution */
+	if (glyph_mode != GLYPH_TEXT)
+	{
+		width <<= glyph_shift_x[glyph_mode];
+		height <<= glyph_shift_y[glyph_mode];
+	}
+	#ifdef REALTIME
+	else
+	{
+		width = (int) (width * resolution_scale[resolution_level]);
+		height = (int) (height * resolution_scale[resolution_level]);
+		width = width > 0 ? width : 1;
+		height = height > 0 ? height : 1;
+	}
+	#endif
+
+	/* Size of every buffer, only the depth format in use */
+	view_size = sizeof(vertex_t) * (scene.instance_count > 0 ? scene.max_vertex*SCENE_BATCH : lod_chain[0].vertex_count);
+	#ifdef POSIX
+	if (stream.chunk != NULL)
+		view_size = sizeof(vertex_t) * stream.max_vertex;
+	if (sequence.frame_count > 0)
+		view_size = sizeof(vertex_t) * sequence.max_vertex;
+	if (server.running)
+		view_size = sizeof(vertex_t) * server.max_vertex;
+	#endif
+	screen_size = sizeof(char) * width * height;
+	depth_size = (depth_mode == DEPTH_FIXED16 ? sizeof(unsigned short) : sizeof(float)) * width * height;
+	id_size = deferred ? sizeof(unsigned int) * width * height : 0;
+	coverage_size = glyph_mode != GLYPH_TEXT ? sizeof(unsigned char) * output_width * output_height : 0;
+	ansi_size = ansi_mode != ANSI_OFF ? (unsigned long)output_height * (output_width*ANSI_SGR_MAX + ANSI_SGR_MAX) : 0;
+
+	/* Every viewport has its own view, screen and depth, placed on the frame first */
+	split_size = 0;
+	if (split_count > 0)
+	{
+		layout_split(width, height);
+
+		for (index = 0; index < split_count; index++)
+		{
+			unsigned long cells = (unsigned long)split_view[index].width * split_view[index].height;
+
+			split_size += arena_align(view_size) + arena_align(sizeof(char) * cells) + arena_align(sizeof(float) * cells);
+		}
+	}
+
+	/* Grow the arena if needed, then carve the buffers again */
+	if (arena_reserve(&render_arena, arena_align(view_size) + arena_align(screen_size) + arena_align(depth_size) +
+			arena_align(id_size) + arena_align(coverage_size) + arena_align(ansi_size) + split_size))
+	{
+		output_width = frame_width;
+		output_height = frame_height;
+
+		if (split_count > 0)
+			layout_split(buffer_width, buffer_height);
+
+		return 1;
+	}
+
+	view_buffer = (vertex_t*) arena_alloc(&render_arena, view_size);
+	screen_buffer = (char*) arena_alloc(&render_arena, screen_size);
+	depth_buffer = NULL;
+	depth_buffer16 = NULL;
+
+	if (depth_mode == DEPTH_FIXED16)
+		depth_buffer16 = (unsigned short*) arena_alloc(&render_arena, depth_size);
+	else
+		depth_buffer = (float*) arena_alloc(&render_arena, depth_size);
+
+	id_buffer = deferred ? (unsigned int*) arena_alloc(&render_arena, id_size) : NULL;
+	coverage_buffer = glyph_mode != GLYPH_TEXT ? (unsigned char*) arena_alloc(&render_arena, coverage_size) : NULL;
+	ansi_buffer = ansi_mode != ANSI_OFF ? (char*) arena_alloc(&render_arena, ansi_size) : NULL;
+
+	for (index = 0; index < split_count; index++)
+	{
+		viewport_t* viewport = &split_view[index];
+
+		viewport->view = (vertex_t*) arena_alloc(&render_arena, view_size);
+		viewport->screen = (char*) arena_alloc(&render_arena, sizeof(char) * viewport->width*viewport->height);
+		viewport->depth = (float*) arena_alloc(&render_arena, sizeof(float) * viewport->width*viewport->height);
+	}
+
+	/* Set global buffer size */
+	buffer_width = width;
+	buffer_height = height;
+
+	/* Update screen rateo, a sample is a fraction of the cell */
+	screen_rateo = (float)buffer_width/buffer_height*FONT_RATEO*
+			(1 << glyph_shift_y[glyph_mode])/(1 << glyph_shift_x[glyph_mode]);
+
+	return 0;
+}
+
+/* Round a size to the arena alignment */
+unsigned long arena_align(unsigned long size)
+{
+	return (size + ARENA_ALIGN-1) & ~(unsigned long)(ARENA_ALIGN-1);
+}
+
+/* Make room for size bytes, the block only grows and its content is dropped, return 1 keeping the old block if it can not */
+int arena_reserve(arena_t* arena, unsigned long size)
+{
+	unsigned long grown = size;
+	char* block;
+
+	/* Fit in the current block, restart carving from the base */
+	if (size <= arena->capacity)
+	{
+		arena->used = 0;
+		return 0;
+	}
+
+	/* Grow by half at least, so a slow resize do not allocate every frame, else just the size asked */
+	if (grown < arena->capacity + arena->capacity/2)
+		grown = arena->capacity + arena->capacity/2;
+
+	block = (char*) malloc(grown + ARENA_ALIGN);
+
+	if (block == NULL && grown > size)
+	{
+		grown = size;
+		block = (char*) malloc(grown + ARENA_ALIGN);
+	}
+
+	if (block == NULL)
+		return 1;
+
+	free(arena->block);
+	arena->block = block;
+
+	/* Align the base */
+	arena->base = arena->block + (ARENA_ALIGN - (unsigned long)arena->block % ARENA_ALIGN) % ARENA_ALIGN;
+	arena->capacity = grown;
+	arena->used = 0;
+	arena->alloc_count++;
+
+	return 0;
+}
+
+/* Carve an aligned buffer from the arena, NULL past its capacity */
+void* arena_alloc(arena_t* arena, unsigned long size)
+{
+	char* buffer = arena->base + arena->used;
+
+	if (arena->used + arena_align(size) > arena->capacity)
+		return NULL;
+
+	arena->used += arena_align(size);
+
+	return buffer;
+}
+
+/* Release the arena block */
+void arena_free(arena_t* arena)
+{
+	free(arena->block);
+	memset(arena, 0, sizeof(arena_t));
+
+	return;
+}
+
+#ifdef REALTIME
+/* Start a frame: turn the turntable by the time since the last one, measure the frame rate every second */
+void advance_frame()
+{
+	double now = clock_ms();
+
+	if (turntable != 0 && frame_start != 0)
+		rotate_y(turntable*PI/180 * (float) (now - frame_start)/1000);
+
+	if (now - rate_start >= 1000)
+	{
+		measured_fps = rate_frames*1000/(now - rate_start);
+		rate_start = now;
+		rate_frames = 0;
+	}
+
+	rate_frames++;
+	frame_start = now;
+
+	return;
+}
+
+/* Check the view to change without input, so frames are drawn at the target rate */
+int animating()
+{
+	if (turntable != 0)
+		return 1;
+
+	#ifdef POSIX
+	if (sequence.frame_count > 0 || (stream.chunk != NULL && stream.misses > 0))
+		return 1;
+	#endif
+
+	return 0;
+}
+
+/* Step the render resolution to hold the frame budget, going back up only with headroom left */
+void adapt_resolution(double render_ms)
+{
+	double average, predicted;
+	int previous = resolution_level;
+
+	resolution_ms += render_ms;
+	resolution_frames++;
+
+	if (resolution_frames < RESOLUTION_FRAMES)
+		return;
+
+	average = resolution_ms / resolution_frames;
+	resolution_ms = 0;
+	resolution_frames = 0;
+
+	/* First frames after a step down, keep what it saved */
+	if (step_ms > 0)
+	{
+		level_gain[resolution_level-1] = step_ms / average;
+		step_ms = 0;
+	}
+
+	/* Over the budget, one level down */
+	if (average > frame_budget && resolution_level+1 < RESOLUTION_LEVELS)
+	{
+		step_ms = average;
+		resolution_level++;
+	}
+
+	/* Up only if the upper level is expected to fit, by the measured gain or else by the pixel count */
+	else if (resolution_level > 0)
+	{
+		double ratio = resolution_scale[resolution_level-1] / resolution_scale[resolution_level];
+
+		predicted = average * (level_gain[resolution_level-1] > 0 ? level_gain[resolution_level-1] : ratio * ratio);
+
+		if (predicted >= frame_budget * RESOLUTION_HEADROOM)
+			return;
+
+		resolution_level--;
+	}
+
+	else
+		return;
+
+	/* Stay on the level if its buffers can not be had */
+	if (create_buffer(output_width, output_height))
+	{
+		resolution_level = previous;
+		step_ms = 0;
+	}
+
+	return;
+}
+#endif
+
+/* Run a command of the CLI language, return its letter or 0 if it is not one */
+int run_command(const char* command, float* ammount)
+{
+	/* Viewport resize */
+	if (command[0] == 'v')
+	{
+		/* Try to parse width and height */
+		int width, height;
+
+		if (sscanf(command, "%*s %dx%d", &width, &height) != 2)
+			return 0;
+
+		/* Recreate a new buffer, the old one stays if it can not */
+		if (create_buffer(width, height))
+			printf("Can not resize to %dx%d\n", width, height);
+
+		return 'v';
+	}
+
+	/* Parse the ammount */
+	sscanf(command, "%*s %f", ammount);
+
+	/* Translation */
+	if (command[0] == 't')
+	{
+		/* Translate */
+		if (command[1] == 'x')
+		{
+			translate(*ammount, 0, 0);
+		}
+		else if (command[1] == 'y')
+		{
+			translate(0, *ammount, 0);
+		}
+		else if (command[1] == 'z')
+		{
+			translate(0, 0, *ammount);
+		}
+		else
+			return 0;
+	}
+
+	/* Rotation */
+	else if (command[0] == 'r')
+	{
+		/* Convert from degree to radian */
+		float angle = *ammount*PI/180;
+
+		/* Rotate */
+		if (command[1] == 'x')
+		{
+			rotate_x(angle);
+		}
+		else if (command[1] == 'y')
+		{
+			rotate_y(angle);
+		}
+		else if (command[1] == 'z')
+		{
+			rotate_z(angle);
+		}
+		else
+			return 0;
+	}
+
+	/* Scale */
+	else if (command[0] == 's')
+	{
+		/* Scale */
+		if (command[1] == 'x')
+		{
+			scale(*ammount, 1, 1);
+		}
+		else if (command[1] == 'y')
+		{
+			scale(1, *ammount, 1);
+		}
+		else if (command[1] == 'z')
+		{
+			scale(1, 1, *ammount);
+		}
+		else if (command[1] == 'a')
+		{
+			scale(*ammount, *ammount, *ammount);
+		}
+		else
+			return 0;
+	}
+
+	/* Reset */
+	else if (command[0] == 'm')
+		restore_mesh();
+
+	/* Orthogonal or perspective */
+	else if (command[0] == 'p')
+		ortho = !ortho;
+	
+	/* Light mode */
+	else if (command[0] == 'l')
+		do_light = !do_light;
+
+	/* Pin a level of detail, automatic if none or out of range */
+	else if (command[0] == 'n')
+	{
+		int level;
+
+		if (sscanf(command, "%*s %d", &level) == 1 && level >= 0 && level < lod_count)
+			lod_pin = level;
+		else
+			lod_pin = -1;
+	}
+
+	/* Turntable speed in degree per second, off if none */
+	#ifdef REALTIME
+	else if (command[0] == 'y')
+	{
+		if (sscanf(command, "%*s %f", &turntable) != 1)
+			turntable = 0;
+	}
 	#endif
 
-	#else
-	/* Print it, CLI mode */
-	for (row = 0; row < buffer_height; row++)
+	/* Split viewports draw text with float depth and forward shading, the other modes are kept as they are */
+	else if (split_count > 0 && command[0] != '\0' && strchr("defg", command[0]) != NULL)
+		puts("Split viewports draw text with float depth and forward shading, the mode is not changed");
+
+	/* Depth buffer format */
+	else if (command[0] == 'd')
+	{
+		int previous = depth_mode;
+
+		depth_mode = (depth_mode+1) % DEPTH_MODE_COUNT;
+
+		if (create_buffer(output_width, output_height))
+		{
+			depth_mode = previous;
+			puts("Not enough memory for the depth buffer");
+		}
+	}
+
+	/* Shade in the raster or from the visibility buffer */
+	else if (command[0] == 'g')
+	{
+		deferred = !deferred;
+
+		if (create_buffer(output_width, output_height))
+		{
+			deferred = !deferred;
+			puts("Not enough memory for the visibility buffer");
+		}
+	}
+
+	/* Output glyphs, the next mode if none is named */
+	else if (command[0] == 'e')
+	{
+		char name[16];
+		int previous = glyph_mode;
+
+		if (sscanf(command, "%*s %15s", name) != 1)
+			glyph_mode = (glyph_mode+1) % GLYPH_MODE_COUNT;
+		else if (strcmp(name, "half") == 0)
+			glyph_mode = GLYPH_HALF;
+		else if (strcmp(name, "braille") == 0)
+			glyph_mode = GLYPH_BRAILLE;
+		else
+			glyph_mode = GLYPH_TEXT;
+
+		if (create_buffer(output_width, output_height))
+		{
+			glyph_mode = previous;
+			puts("Not enough memory for the glyph samples");
+		}
+	}
+
+	/* ANSI color output, the next mode if none is named */
+	else if (command[0] == 'c')
+	{
+		char name[16];
+		int previous = ansi_mode;
+
+		if (sscanf(command, "%*s %15s", name) != 1)
+			ansi_mode = (ansi_mode+1) % ANSI_MODE_COUNT;
+		else if (strcmp(name, "256") == 0)
+			ansi_mode = ANSI_256;
+		else if (strcmp(name, "truecolor") == 0)
+			ansi_mode = ANSI_TRUECOLOR;
+		else
+			ansi_mode = ANSI_OFF;
+
+		if (create_buffer(output_width, output_height))
+		{
+			ansi_mode = previous;
+			puts("Not enough memory for the color output");
+		}
+	}
+
+	/* Focus a split viewport by its number, the next if none */
+	else if (command[0] == 'o' && split_count > 0)
+	{
+		int index;
+
+		if (sscanf(command, "%*s %d", &index) == 1 && index >= 1 && index <= split_count)
+			focus_viewport(index-1);
+		else
+			focus_viewport((split_focus+1) % split_count);
+	}
+
+	/* Pick the tris under a cell */
+	else if (command[0] == 'i')
+	{
+		int col, row;
+
+		if (sscanf(command, "%*s %d %d", &col, &row) != 2)
+			return 0;
+
+		pick_cell(col, row);
+	}
+
+	/* Wireframe, the next mode if none is named */
+	else if (command[0] == 'f')
+	{
+		char name[16];
+
+		if (sscanf(command, "%*s %15s", name) != 1)
+			wire_mode = (wire_mode+1) % WIRE_MODE_COUNT;
+		else if (strcmp(name, "edges") == 0)
+			wire_mode = WIRE_EDGES;
+		else if (strcmp(name, "hidden") == 0)
+			wire_mode = WIRE_HIDDEN;
+		else if (strcmp(name, "silhouette") == 0)
+			wire_mode = WIRE_SILHOUETTE;
+		else
+			wire_mode = WIRE_OFF;
+	}
+
+	else
+		return 0;
+
+	return command[0];
+}
+
+/* Run a command file: the CLI commands, "render" to print a frame and "dump path" to write it to a file.
+   Only the frames asked are rendered, and a run of moves is folded in a single update of the view */
+int run_script(char* path)
+{
+	char line[SCRIPT_LINE];
+	float ammount = 1;
+	float view[4][4];
+	int folding = 0;
+	int line_number = 0, command_count = 0, folded = 0, frames = 0, command;
+	clock_t start = clock();
+	FILE* script = fopen(path, "r");
+
+	if (script == NULL)
+	{
+		printf("Error reading file %s\n", path);
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), script) != NULL)
+	{
+		line_number++;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		/* Skip blank lines and comments */
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+
+		command_count++;
+
+		/* Moves run on an identity matrix, the run is applied to the view at its end */
+		if (line[0] != '\0' && strchr("trs", line[0]) != NULL && line[1] != '\0' && strchr("xyza", line[1]) != NULL)
+		{
+			if (folding)
+				folded++;
+			else
+			{
+				memcpy(view, transform, sizeof(view));
+				memset(transform, 0, sizeof(transform));
+				transform[0][0] = transform[1][1] = transform[2][2] = transform[3][3] = 1;
+				folding = 1;
+			}
+
+			if (run_command(line, &ammount))
+				continue;
+		}
+
+		else
+		{
+			if (folding)
+				fold_transform(view);
+			folding = 0;
+
+			/* Render and print the frame */
+			if (strcmp(line, "render") == 0)
+			{
+				render_to_buffer();
+				write_screen(stdout);
+				frames++;
+				continue;
+			}
+
+			/* Render and write the frame to a file */
+			if (strncmp(line, "dump ", 5) == 0)
+			{
+				FILE* output = fopen(line+5, "w");
+
+				if (output == NULL)
+				{
+					printf("Error writing file %s\n", line+5);
+					fclose(script);
+					return 1;
+				}
+
+				render_to_buffer();
+				write_screen(output);
+				fclose(output);
+				frames++;
+				continue;
+			}
+
+			/* Render a large frame in tiles and write it to a file */
+			if (strncmp(line, "poster ", 7) == 0)
+			{
+				int width, height, skip = 0;
+
+				if (sscanf(line+7, "%dx%d %n", &width, &height, &skip) != 2 || line[7+skip] == '\0' ||
+					render_poster(line+7+skip, width, height))
+				{
+					fclose(script);
+					return 1;
+				}
+
+				frames++;
+				continue;
+			}
+
+			/* End of the script */
+			if (line[0] == 'q')
+				break;
+
+			command = run_command(line, &ammount);
+
+			/* A pick is printed at once, the frame is not drawn */
+			if (command == 'i')
+				puts(pick_text);
+
+			if (command)
+				continue;
+		}
+
+		printf("Unknown command %s at line %d\n", line, line_number);
+		fclose(script);
+		return 1;
+	}
+
+	if (folding)
+		fold_transform(view);
+
+	fclose(script);
+
+	printf("[Script: %d commands, %d folded, %d frames, %.1f ms]\n", command_count, folded, frames,
+		(double) (clock() - start)*1000/CLOCKS_PER_SEC);
+
+	return 0;
+}
+
+/* Apply the moves run on the identity to the view: rotation and scale multiply it, the translations add */
+void fold_transform(float view[4][4])
+{
+	int row, col;
+	float update[3][3];
+	float move[3];
+
+	for (col = 0; col < 3; col++)
+	{
+		for (row = 0; row < 3; row++)
+			update[col][row] = transform[col][row];
+
+		move[col] = transform[3][col];
+	}
+
+	memcpy(transform, view, sizeof(transform));
+	update_transform(update);
+
+	for (col = 0; col < 3; col++)
+		transform[3][col] += move[col];
+
+	return;
+}
+
+/* Colored frame in one write, or the chars a cell at a time */
+void write_screen(FILE* output)
+{
+	int row, col;
+
+	if (ansi_mode != ANSI_OFF && glyph_mode == GLYPH_TEXT)
+	{
+		#ifdef BENCHMARK
+		double start = clock_ms();
+		ansi_bytes = encode_ansi();
+		ansi_ms = clock_ms() - start;
+		fwrite(ansi_buffer, 1, ansi_bytes, output);
+		#else
+		fwrite(ansi_buffer, 1, encode_ansi(), output);
+		#endif
+
+		return;
+	}
+
+	for (row = 0; row < output_height; row++)
+	{
+		for (col = 0; col < output_width; col++)
+			write_cell(col, row, output);
+
+		fputc('\n', output);
+	}
+
+	return;
+}
+
+/* Encode the frame as colored blank cells, with a SGR only where the color changes along a row */
+unsigned long encode_ansi()
+{
+	char* out = ansi_buffer;
+	int row, col;
+
+	for (row = 0; row < output_height; row++)
+	{
+		char* row_start = out;
+		int current = ANSI_DEFAULT;
+
+		for (col = 0; col < output_width; col++)
+		{
+			char cell = screen_cell(col, row);
+			int color = ansi_color[(unsigned char) cell];
+
+			if (color != current)
+			{
+				memcpy(out, ansi_sgr[ansi_mode][color], ansi_length[ansi_mode][color]);
+				out += ansi_length[ansi_mode][color];
+				current = color;
+			}
+
+			/* Shaded cells are drawn by their color, the others keep their char */
+			*out++ = color != ANSI_DEFAULT ? ' ' : cell;
+		}
+
+		/* Back to the default color, or drop the blanks the line ends with */
+		if (current != ANSI_DEFAULT)
+		{
+			memcpy(out, ansi_sgr[ansi_mode][ANSI_DEFAULT], ansi_length[ansi_mode][ANSI_DEFAULT]);
+			out += ansi_length[ansi_mode][ANSI_DEFAULT];
+		}
+		else
+		{
+			while (out > row_start && out[-1] == ' ')
+				out--;
+		}
+
+		*out++ = '\n';
+	}
+
+	return out - ansi_buffer;
+}
+
+/* SGR of every color in each mode, the 256 color one from the 6x6x6 cube, and the color of every cell char */
+void build_ansi_table()
+{
+	int mode, color, channel;
+	unsigned int material;
+
+	for (mode = ANSI_256; mode < ANSI_MODE_COUNT; mode++)
+	{
+		for (color = 0; color < ANSI_COLORS; color++)
+		{
+			const unsigned char* rgb = ansi_rgb[color];
+			int cube[3];
+
+			for (channel = 0; channel < 3; channel++)
+				cube[channel] = (rgb[channel]*5 + 127) / 255;
+
+			if (color == ANSI_DEFAULT)
+				strcpy(ansi_sgr[mode][color], "\033[m");
+			else if (mode == ANSI_256)
+				sprintf(ansi_sgr[mode][color], "\033[48;5;%dm", 16 + cube[0]*36 + cube[1]*6 + cube[2]);
+			else
+				sprintf(ansi_sgr[mode][color], "\033[48;2;%d;%d;%dm", rgb[0], rgb[1], rgb[2]);
+
+			ansi_length[mode][color] = strlen(ansi_sgr[mode][color]);
+		}
+	}
+
+	memset(ansi_color, ANSI_DEFAULT, sizeof(ansi_color));
+	ansi_color[(unsigned char) LIGHT_CHAR] = ANSI_LIGHT;
+	ansi_color[(unsigned char) SHADOW_CHAR] = ANSI_SHADOW;
+
+	for (material = 0; material < sizeof(material_array)/sizeof(material_array[0]); material++)
+		ansi_color[(unsigned char) material_array[material]] = ANSI_MATERIAL + material;
+
+	return;
+}
+
+/* Write a cell, its char or the glyph of its sample mask */
+void write_cell(int col, int row, FILE* output)
+{
+	if (glyph_mode == GLYPH_TEXT)
+		fputc(screen_cell(col, row), output);
+	else
+		fputs(glyph_table[glyph_mode][coverage_buffer[col+row*output_width]], output);
+
+	return;
+}
+
+/* Glyph of every sample mask, the mask holds the samples of a cell row by row */
+void build_glyph_table()
+{
+	/* Braille dot bit of each sample, the last row was added later to the pattern */
+	static const unsigned char braille_dot[8] = {0x01, 0x08, 0x02, 0x10, 0x04, 0x20, 0x40, 0x80};
+	static const char* const half_block[4] = {" ", "\xE2\x96\x80", "\xE2\x96\x84", "\xE2\x96\x88"};
+	int mask, sample, dots;
+
+	for (mask = 0; mask < 256; mask++)
+	{
+		strcpy(glyph_table[GLYPH_TEXT][mask], " ");
+		strcpy(glyph_table[GLYPH_HALF][mask], half_block[mask & 3]);
+
+		/* U+2800 plus the dots, empty cells stay blank */
+		for (sample = 0, dots = 0; sample < 8; sample++)
+		{
+			if (mask & (1 << sample))
+				dots |= braille_dot[sample];
+		}
+
+		if (dots == 0)
+			strcpy(glyph_table[GLYPH_BRAILLE][mask], " ");
+		else
+		{
+			glyph_table[GLYPH_BRAILLE][mask][0] = (char) 0xE2;
+			glyph_table[GLYPH_BRAILLE][mask][1] = (char) (0xA0 | (dots >> 6));
+			glyph_table[GLYPH_BRAILLE][mask][2] = (char) (0x80 | (dots & 0x3F));
+			glyph_table[GLYPH_BRAILLE][mask][3] = '\0';
+		}
+	}
+
+	return;
+}
+
+#ifdef NCURSES
+/* Ncurses input loop, the keys pending at a frame are folded in one transform update */
+void loop_input()
+{
+	/* Input variables */
+	int command;
+	int quit = 0;
+
+	while (!quit)
+	{
+		/* View before the motion keys of this frame, run on an identity matrix */
+		float view[4][4];
+		int folding = 0;
+		double wait;
+
+		/* Check screen to be the same size as before */
+		if (output_width != getmaxx(stdscr) || output_height != getmaxy(stdscr))
+		{
+			create_buffer(getmaxx(stdscr), getmaxy(stdscr));
+		}
+
+		/* Render */
+		advance_frame();
+		draw_screen();
+
+		/* Wait the first key, only up to the next frame if the view changes on its own */
+		wait = frame_start + 1000/loop_fps - clock_ms();
+		timeout(animating() ? (wait > 0 ? (int) wait : 0) : -1);
+		command = getch();
+
+		/* Then take every key until the next frame is due */
+		while (command != ERR && !quit)
+		{
+			/* Motion keys in the order pressed, folded into the view at the first other key as in a script */
+			if (command > 0 && command < 128 && strchr("wsadzx+-jlikuo", command) != NULL)
+			{
+				if (!folding)
+				{
+					memcpy(view, transform, sizeof(view));
+					memset(transform, 0, sizeof(transform));
+					transform[0][0] = transform[1][1] = transform[2][2] = transform[3][3] = 1;
+					folding = 1;
+				}
+			}
+			else if (folding)
+			{
+				fold_transform(view);
+				folding = 0;
+			}
+
+			/* Split viewports draw text with float depth and forward shading, the keys of other modes beep */
+			if (split_count > 0 && command > 0 && command < 128 && strchr("bgef", command) != NULL)
+			{
+				beep();
+				command = 0;
+			}
+
+			switch (command)
+			{
+				/* Quit */
+				case 'q':
+					quit = 1;
+					break;
+
+				/* Help */
+				case 'h':
+					show_help();
+					break;
+
+				/* Orthogonal or perspective */
+				case 'p':
+					ortho = !ortho;
+					break;
+
+				/* Light mode */
+				case 't':
+					do_light = !do_light;
+					break;
+
+				/* Pin the next level of detail, then back to automatic */
+				case 'n':
+					lod_pin = (lod_pin+1 < lod_count) ? lod_pin+1 : -1;
+					break;
+
+				/* Depth buffer format, the same one if the next can not be had */
+				case 'b':
+					depth_mode = (depth_mode+1) % DEPTH_MODE_COUNT;
+					if (create_buffer(output_width, output_height))
+						depth_mode = (depth_mode+DEPTH_MODE_COUNT-1) % DEPTH_MODE_COUNT;
+					break;
+
+				/* Deferred shading, kept off if its buffer can not be had */
+				case 'g':
+					deferred = !deferred;
+					if (create_buffer(output_width, output_height))
+						deferred = !deferred;
+					break;
+
+				/* Output glyphs */
+				case 'e':
+					glyph_mode = (glyph_mode+1) % GLYPH_MODE_COUNT;
+					if (create_buffer(output_width, output_height))
+						glyph_mode = (glyph_mode+GLYPH_MODE_COUNT-1) % GLYPH_MODE_COUNT;
+					break;
+
+				/* Wireframe */
+				case 'f':
+					wire_mode = (wire_mode+1) % WIRE_MODE_COUNT;
+					break;
+			
+				/* Color */
+				case 'c':
+			 		if (has_colors())
+						use_color = !use_color;
+					break;
+
+				/* Next split viewport */
+				case '\t':
+					if (split_count > 0)
+						focus_viewport((split_focus+1) % split_count);
+					break;
+
+				/* Turntable on and off */
+				case 'y':
+					turntable = turntable != 0 ? 0 : TURNTABLE_SPEED;
+					break;
+
+				/* Move up */
+				case 'w':
+					translate(0, TRANSLATE_STEP, 0);
+					break;
+
+				/* Move down */
+				case 's':
+					translate(0, -TRANSLATE_STEP, 0);
+					break;
+
+				/* Move left */
+				case 'a':
+					translate(-TRANSLATE_STEP, 0, 0);
+					break;
+				
+				/* Move right */
+				case 'd':
+					translate(TRANSLATE_STEP, 0, 0);
+					break;
+
+				/* Move forward */
+				case 'z':
+					translate(0, 0, -TRANSLATE_STEP);
+					break;
+
+				/* Move backward */
+				case 'x':
+					translate(0, 0, TRANSLATE_STEP);
+					break;
+
+				/* Scale up */
+				case '+':
+					scale(SCALE_STEP, SCALE_STEP, SCALE_STEP);
+					break;
+
+				/* Scale down */
+				case '-':
+					scale(1/SCALE_STEP, 1/SCALE_STEP, 1/SCALE_STEP);
+					break;
+
+				/* Rotate y */
+				case 'j':
+					rotate_y(ROTATE_STEP);
+					break;
+
+				case 'l':
+					rotate_y(-ROTATE_STEP);
+					break;
+
+				/* Rotate x */
+				case 'i':
+					rotate_x(ROTATE_STEP);
+					break;
+
+				case 'k':
+					rotate_x(-ROTATE_STEP);
+					break;
+
+				/* Rotate z */
+				case 'u':
+					rotate_z(ROTATE_STEP);
+					break;
+			
+				case 'o':
+					rotate_z(-ROTATE_STEP);
+					break;
+
+				/* Restore mesh, the motion read before is folded and then dropped */
+				case 'r':
+					restore_mesh();
+					break;
+			}
+
+			wait = frame_start + 1000/loop_fps - clock_ms();
+			timeout(wait > 0 ? (int) wait : 0);
+			command = getch();
+		}
+
+		/* One update of the view for the motion keys of the frame */
+		if (folding)
+			fold_transform(view);
+	}
+
+	return;
+}
+
+#else
+/* CLI input loop */
+void loop_input()
+{
+	/* Input variables */
+	char command[64];
+	char last[2] = "\0";
+	float ammount = 1;
+	int quit = 0;
+
+	/* Keep looping until user hit 'q' */
+	while(!quit)
 	{	
-		for (col = 0; col < buffer_width; col++)
+		/* Render it */
+		#ifdef REALTIME
+		advance_frame();
+		#endif
+		draw_screen();
+
+		/* Keep drawing at the target rate while the view changes on its own, until a command comes in */
+		#ifdef POSIX
+		if (animating())
 		{
-			putchar(screen_buffer[col+row*buffer_width]);
+			fd_set input;
+			struct timeval wait;
+			double left = frame_start + 1000/loop_fps - clock_ms();
+
+			if (left < 0)
+				left = 0;
+
+			wait.tv_sec = (long) (left/1000);
+			wait.tv_usec = (long) ((left - wait.tv_sec*1000.0)*1000);
+			FD_ZERO(&input);
+			FD_SET(0, &input);
+
+			if (select(1, &input, NULL, NULL, &wait) <= 0)
+				continue;
 		}
-		putchar('\n');
+		#endif
+
+		/* Get input, the end of it quits */
+		if (fgets(command, 64, stdin) == NULL)
+			strcpy(command, "q");
+
+		/* Quit */
+		if (command[0] == 'q')
+			quit = 1;
+
+		/* Print help */
+		else if (command[0] == 'h')
+			show_help();
+
+		/* If just enter, restore the previous one */
+		else if (command[0] == '\n')
+		{
+			command[0] = last[0];
+			command[1] = last[1];
+		}
+
+		/* Run it, a resize is not repeated */
+		if (run_command(command, &ammount) == 'v')
+			continue;
+
+		/* Save last command */
+		last[0] = command[0];
+		last[1] = command[1];
 	}
 
-	/* Frame benchmark */
-	#ifdef BENCHMARK
-	gettimeofday(&stop_frame, NULL);
+	return;
+}
+#endif
+
+#ifdef POSIX
+/* Listen on a Unix socket and serve sessions until killed: the sockets are watched here and every request is run
+   by a pool of workers if there are threads, so an idle session holds no worker */
+int serve(char* socket_path)
+{
+	struct sockaddr_un address;
+	int index;
+	#ifdef THREADS
+	int worker;
+	char wake[64];
+	#endif
+
+	memset(&server, 0, sizeof(server_t));
+
+	if (strlen(socket_path) >= sizeof(address.sun_path))
+	{
+		printf("Socket path too long %s\n", socket_path);
+		return 1;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+
+	/* Replace a socket left by a previous server */
+	unlink(socket_path);
+	server.socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (server.socket < 0 || bind(server.socket, (struct sockaddr*) &address, sizeof(address)) ||
+		listen(server.socket, SERVER_BACKLOG))
+	{
+		printf("Error opening socket %s\n", socket_path);
+		return 1;
+	}
+
+	/* A client closing early must not kill the server */
+	signal(SIGPIPE, SIG_IGN);
+	server.running = 1;
+
+	#ifdef THREADS
+	if (pipe(server.wake_pipe))
+	{
+		printf("Error opening socket %s\n", socket_path);
+		return 1;
+	}
+
+	pthread_mutex_init(&server.lock, NULL);
+	pthread_mutex_init(&server.load_lock, NULL);
+	pthread_mutex_init(&server.queue_lock, NULL);
+	pthread_cond_init(&server.queue_wake, NULL);
+
+	for (worker = 0; worker < SERVER_WORKERS; worker++)
+		pthread_create(&server.worker[worker], NULL, server_worker, NULL);
+	#endif
+
+	printf("Serving on %s\n", socket_path);
+	fflush(stdout);
+
+	while (server.running)
+	{
+		fd_set input;
+		int top = server.socket;
+
+		FD_ZERO(&input);
+		FD_SET(server.socket, &input);
+		#ifdef THREADS
+		FD_SET(server.wake_pipe[0], &input);
+		top = server.wake_pipe[0] > top ? server.wake_pipe[0] : top;
+		pthread_mutex_lock(&server.queue_lock);
+		#endif
+
+		/* Drop the sessions the clients closed, watch the others unless a worker has them */
+		for (index = 0; index < server.session_count; index++)
+		{
+			session_t* session = server.session[index];
+
+			if (session->busy)
+				continue;
+
+			if (session->closed)
+			{
+				close_session(session);
+				server.session[index--] = server.session[--server.session_count];
+				continue;
+			}
+
+			FD_SET(session->client, &input);
+			top = session->client > top ? session->client : top;
+		}
+
+		#ifdef THREADS
+		pthread_mutex_unlock(&server.queue_lock);
+		#endif
+
+		if (select(top+1, &input, NULL, NULL, NULL) <= 0)
+			continue;
+
+		/* A worker is done with a session */
+		#ifdef THREADS
+		if (FD_ISSET(server.wake_pipe[0], &input) && read(server.wake_pipe[0], wake, sizeof(wake)) < 0)
+			continue;
+		#endif
+
+		/* Requests of the sessions, run by the next free worker or here */
+		#ifdef THREADS
+		pthread_mutex_lock(&server.queue_lock);
+		#endif
+
+		for (index = 0; index < server.session_count; index++)
+		{
+			session_t* session = server.session[index];
+
+			if (session->busy || session->closed || !FD_ISSET(session->client, &input))
+				continue;
+
+			#ifdef THREADS
+			session->busy = 1;
+			server.ready[server.ready_count++] = session;
+			pthread_cond_signal(&server.queue_wake);
+			#else
+			serve_requests(session);
+			#endif
+		}
+
+		#ifdef THREADS
+		pthread_mutex_unlock(&server.queue_lock);
+		#endif
+
+		/* New client */
+		if (FD_ISSET(server.socket, &input))
+		{
+			int client = accept(server.socket, NULL, NULL);
+
+			if (client >= 0)
+				open_session(client);
+		}
+	}
+
+	return 0;
+}
+
+#ifdef THREADS
+/* Worker, takes the next session with a request and runs what it sent */
+void* server_worker(void* arg)
+{
+	session_t* session;
+
+	(void) arg;
+
+	pthread_mutex_lock(&server.queue_lock);
+
+	while (server.running)
+	{
+		if (server.ready_count == 0)
+		{
+			pthread_cond_wait(&server.queue_wake, &server.queue_lock);
+			continue;
+		}
+
+		/* Oldest request first */
+		session = server.ready[0];
+		memmove(server.ready, server.ready+1, --server.ready_count * sizeof(session_t*));
+		pthread_mutex_unlock(&server.queue_lock);
+
+		serve_requests(session);
+
+		/* Back to the watcher, woken without the lock so it is never waited on while full */
+		pthread_mutex_lock(&server.queue_lock);
+		session->busy = 0;
+		pthread_mutex_unlock(&server.queue_lock);
+
+		if (write(server.wake_pipe[1], "", 1) < 0)
+			puts("Error waking the server");
+
+		pthread_mutex_lock(&server.queue_lock);
+	}
+
+	pthread_mutex_unlock(&server.queue_lock);
+
+	return NULL;
+}
+#endif
+
+/* Start a session in the default view, a client past the session limit is turned away */
+void open_session(int client)
+{
+	session_t* session;
+	FILE* output;
+
+	if (server.session_count == SERVER_SESSIONS || client >= FD_SETSIZE)
+	{
+		if (write(client, "error too many sessions\n", 24) < 0)
+			puts("Client left before the reply");
+
+		close(client);
+		return;
+	}
+
+	session = (session_t*) calloc(1, sizeof(session_t));
+	output = fdopen(client, "w");
+
+	if (session == NULL || output == NULL)
+	{
+		free(session);
+
+		if (output != NULL)
+			fclose(output);
+		else
+			close(client);
+
+		return;
+	}
+
+	/* Default view, full mesh and no frame yet */
+	session->client = client;
+	session->output = output;
+	session->ammount = 1;
+	session->do_light = 1;
+	session->width = SERVER_WIDTH;
+	session->height = SERVER_HEIGHT;
+
+	lock_server();
+	use_session(session);
+	restore_mesh();
+	keep_session(session);
+	unlock_server();
+
+	server.session[server.session_count++] = session;
+
+	return;
+}
+
+/* End a session, its socket is closed with the output */
+void close_session(session_t* session)
+{
+	fclose(session->output);
+	free(session->frame);
+	free(session);
+
+	return;
+}
+
+/* Read what the client sent and run every complete request line, the end of the input or "q" closes the session */
+void serve_requests(session_t* session)
+{
+	long count = read(session->client, session->input + session->input_length, SERVER_LINE-1 - session->input_length);
+
+	if (count <= 0)
+	{
+		session->closed = 1;
+		return;
+	}
+
+	session->input_length += (int) count;
+
+	while (!session->closed)
+	{
+		char line[SERVER_LINE];
+		char* end = (char*) memchr(session->input, '\n', session->input_length);
+		int length;
+
+		/* A line filling the buffer is taken as it is */
+		if (end == NULL && session->input_length < SERVER_LINE-1)
+			break;
+
+		length = end != NULL ? (int) (end - session->input) : session->input_length;
+		memcpy(line, session->input, length);
+		line[length] = '\0';
+
+		/* Keep the rest for the next request */
+		length += end != NULL;
+		session->input_length -= length;
+		memmove(session->input, session->input + length, session->input_length);
+
+		serve_request(session, line);
+	}
+
+	fflush(session->output);
+
+	return;
+}
+
+/* Run a request: the CLI commands, "open path", "render", "stats" and "q" */
+void serve_request(session_t* session, char* line)
+{
+	FILE* output = session->output;
+	double start = clock_ms();
+	int rendered = 0;
+	int cache, width, height;
+
+	line[strcspn(line, "\r\n")] = '\0';
+
+	if (line[0] == 'q')
+	{
+		session->closed = 1;
+		return;
+	}
+
+	lock_server();
+
+	/* Bind a mesh, loaded once for every client while the file is unchanged */
+	if (strncmp(line, "open ", 5) == 0)
+	{
+		cache = find_mesh(line+5);
+
+		if (cache < 0)
+			fprintf(output, "error cannot load %s\n", line+5);
+		else
+		{
+			strcpy(session->path, line+5);
+			fprintf(output, "ok %d tris\n", server.cache[cache].mesh.tris_count);
+		}
+	}
+
+	/* Render the frame in the session view, the mesh is reloaded if the file changed */
+	else if (strcmp(line, "render") == 0)
+	{
+		if (session->path[0] == '\0' || (cache = find_mesh(session->path)) < 0)
+			fprintf(output, "error no mesh\n");
+		else if (render_session(session, &server.cache[cache].mesh))
+			fprintf(output, "error not enough memory for the frame\n");
+		else
+			rendered = 1;
+	}
+
+	/* Cache hit rate and request latency */
+	else if (strcmp(line, "stats") == 0)
+	{
+		fprintf(output, "ok meshes %d hits %lu misses %lu hit rate %.1f%% requests %lu latency %.2f ms max %.2f ms\n",
+			server.cache_count, server.hits, server.misses,
+			server.hits+server.misses > 0 ? 100.0*server.hits/(server.hits+server.misses) : 0,
+			server.requests, server.requests > 0 ? server.total_ms/server.requests : 0, server.max_ms);
+	}
+
+	/* Frame size, capped so a client can not take the memory of every other */
+	else if (line[0] == 'v' && sscanf(line, "%*s %dx%d", &width, &height) == 2)
+	{
+		if (width <= 0 || height <= 0 || (unsigned long)width*height > SERVER_MAX_CELLS)
+			fprintf(output, "error frame size %dx%d, at most %d cells\n", width, height, SERVER_MAX_CELLS);
+		else if (use_session(session) || create_buffer(width, height))
+			fprintf(output, "error not enough memory for %dx%d\n", width, height);
+		else
+		{
+			keep_session(session);
+			fprintf(output, "ok\n");
+		}
+	}
+
+	/* View commands, run on the session view */
+	else
+	{
+		int command;
+
+		/* Frames are sent as filled text, glyph, color and wireframe output stay in the terminal */
+		if (use_session(session))
+			fprintf(output, "error not enough memory for the frame\n");
+		else
+		{
+			command = line[0] != 'e' && line[0] != 'f' && line[0] != 'c' && line[0] != 'i' && line[0] != 'v' ?
+					run_command(line, &session->ammount) : 0;
+			keep_session(session);
+
+			if (command != 0)
+				fprintf(output, "ok\n");
+			else
+				fprintf(output, "error unknown command %s\n", line);
+		}
+	}
+
+	unlock_server();
+
+	/* The frame is sent without the lock, a slow client does not stop the others */
+	if (rendered)
+		write_frame(session, output);
+
+	fflush(output);
+
+	/* Request latency, to the reply sent */
+	start = clock_ms() - start;
+
+	lock_server();
+	server.requests++;
+	server.total_ms += start;
+	if (start > server.max_ms)
+		server.max_ms = start;
+	unlock_server();
+
+	return;
+}
 
-	printf("[Frame: %.1f ms (Render: %.1f ms), Tris: %d] > ", 
-		(double)(stop_frame.tv_usec - start_frame.tv_usec)/1000+
-		(double)(stop_frame.tv_sec - start_frame.tv_sec)*1000,
-		(double)(stop_render.tv_usec - start_frame.tv_usec)/1000+
-		(double)(stop_render.tv_sec - start_frame.tv_sec)*1000,
-		tris_count);
-	#else
-	printf("> ");
+/* Take the renderer, its buffers and view are global */
+void lock_server()
+{
+	#ifdef THREADS
+	pthread_mutex_lock(&server.lock);
 	#endif
+
+	return;
+}
+
+void unlock_server()
+{
+	#ifdef THREADS
+	pthread_mutex_unlock(&server.lock);
 	#endif
 
 	return;
 }
 
-/* Help message */
-void show_help()
+/* Load the view of a session in the renderer, return 1 if its buffers can not be had */
+int use_session(const session_t* session)
 {
-	/* Clear the console */
-	clear_screen();
+	memcpy(transform, session->transform, sizeof(transform));
+	ortho = session->ortho;
+	do_light = session->do_light;
 
-	#ifdef NCURSES
-	/* Print usage instruction, Ncurses mode */
-	mvprintw(0, 0, "%s", HELP_MESSAGE);
+	/* Buffers in the session size and depth format */
+	if (output_width != session->width || output_height != session->height || depth_mode != session->depth_mode)
+	{
+		depth_mode = session->depth_mode;
+		return create_buffer(session->width, session->height);
+	}
 
-	/* Wait input */
-	getch();
+	return 0;
+}
 
-	#else
-	/* Print usage instruction, CLI mode */
-	puts(HELP_MESSAGE0);
-	puts(HELP_MESSAGE1);
-	
-	/* Wait input to proceed */
-	getchar();
-	#endif
+/* Store the renderer view back in the session */
+void keep_session(session_t* session)
+{
+	memcpy(session->transform, transform, sizeof(transform));
+	session->ortho = ortho;
+	session->do_light = do_light;
+	session->depth_mode = depth_mode;
+	session->width = output_width;
+	session->height = output_height;
 
 	return;
 }
 
-/* Create depth and screen buffer */
-void create_buffer(int width, int height)
+/* Entry of a path in the mesh cache, -1 if there is none */
+int cache_slot(const char* path)
 {
-	/* Check width and height to be more than zero */
-	if (width <= 0 || height <= 0)
-		return;
+	int index;
 
-	/* Free old buffer */
-	free(screen_buffer);
-	free(depth_buffer);
+	for (index = 0; index < server.cache_count; index++)
+		if (strcmp(server.cache[index].path, path) == 0)
+			return index;
 
-	/* Allocate new one */
-	screen_buffer = (char*) malloc(sizeof(char) * width * height);
-	depth_buffer = (float*) malloc(sizeof(float) * width * height);
+	return -1;
+}
 
-	/* Set global buffer size */
-	buffer_width = width;
-	buffer_height = height;
+/* Cached mesh of a path, loaded if missing or changed on disk, -1 if it does not load. Called with the renderer
+   taken, it is let go while the file loads so the other sessions are served meanwhile */
+int find_mesh(const char* path)
+{
+	int index, slot, result;
+	struct stat info;
+	mesh_t mesh;
 
-	/* Update screen rateo */
-	screen_rateo = (float)buffer_width/buffer_height*FONT_RATEO;
+	if (strlen(path) >= SERVER_PATH || stat(path, &info))
+		return -1;
 
-	return;
-}
+	server.tick++;
+	slot = cache_slot(path);
 
-#ifdef NCURSES
-/* Ncurses input loop */
-void loop_input()
-{
-	/* Input variables */
-	int command;
-	int quit = 0;
+	/* Same file, still valid */
+	if (slot >= 0 && server.cache[slot].mtime == (long) info.st_mtime && server.cache[slot].size == (long) info.st_size)
+	{
+		server.cache[slot].last_used = server.tick;
+		server.hits++;
+		return slot;
+	}
 
-	while (!quit)
+	server.misses++;
+
+	/* Full mesh in compact storage, no level of detail for previews, a load at a time */
+	unlock_server();
+	#ifdef THREADS
+	pthread_mutex_lock(&server.load_lock);
+	#endif
+
+	memset(&mesh, 0, sizeof(mesh_t));
+	result = load_mesh((char*) path, &mesh);
+
+	if (!result)
+		compact_mesh(&mesh, 0);
+
+	#ifdef THREADS
+	pthread_mutex_unlock(&server.load_lock);
+	#endif
+	lock_server();
+
+	/* Grow the view buffer for it, the mesh is dropped if it can not */
+	if (!result && mesh.vertex_count > server.max_vertex)
 	{
-		/* Check screen to be the same size as before */
-		if (buffer_width != getmaxx(stdscr) || buffer_height != getmaxy(stdscr))
+		int previous = server.max_vertex;
+
+		server.max_vertex = mesh.vertex_count;
+
+		if (create_buffer(output_width, output_height))
 		{
-			create_buffer(getmaxx(stdscr), getmaxy(stdscr));
+			server.max_vertex = previous;
+			free_mesh(&mesh);
+			result = 1;
 		}
+	}
 
-		/* Render */
-		draw_screen();
+	/* The entry may have moved while the renderer was let go */
+	slot = cache_slot(path);
 
-		/* Get input */
-		command = getch();
-	
-		switch (command)
+	/* Drop a stale entry of a file that no longer loads, the last one takes its place */
+	if (result)
+	{
+		if (slot >= 0)
 		{
-			/* Quit */
-			case 'q':
-				quit = 1;
-				break;
+			free_mesh(&server.cache[slot].mesh);
+			server.cache[slot] = server.cache[--server.cache_count];
+			memset(&server.cache[server.cache_count], 0, sizeof(cached_mesh_t));
+		}
 
-			/* Help */
-			case 'h':
-				show_help();
-				break;
+		return -1;
+	}
 
-			/* Orthogonal or perspective */
-			case 'p':
-				ortho = !ortho;
-				break;
+	/* Reload in place, or a free entry, or the least recently used one */
+	if (slot < 0 && server.cache_count < SERVER_CACHE)
+		slot = server.cache_count++;
 
-			/* Light mode */
-			case 't':
-				do_light = !do_light;
-				break;
-		
-			/* Color */
-			case 'c':
-		 		if (has_colors())
-					use_color = !use_color;
-				break;
+	else if (slot < 0)
+	{
+		for (slot = 0, index = 1; index < SERVER_CACHE; index++)
+		{
+			if (server.cache[index].last_used < server.cache[slot].last_used)
+				slot = index;
+		}
+	}
 
-			/* Move up */
-			case 'w':
-				translate(0, TRANSLATE_STEP, 0);
-				break;
+	free_mesh(&server.cache[slot].mesh);
+	server.cache[slot].mesh = mesh;
+	strcpy(server.cache[slot].path, path);
+	server.cache[slot].mtime = (long) info.st_mtime;
+	server.cache[slot].size = (long) info.st_size;
+	server.cache[slot].last_used = server.tick;
 
-			/* Move down */
-			case 's':
-				translate(0, -TRANSLATE_STEP, 0);
-				break;
+	return slot;
+}
 
-			/* Move left */
-			case 'a':
-				translate(-TRANSLATE_STEP, 0, 0);
-				break;
-			
-			/* Move right */
-			case 'd':
-				translate(TRANSLATE_STEP, 0, 0);
-				break;
+/* Render a mesh in the session view, and keep the frame in the session, return 1 if there is no memory for it */
+int render_session(session_t* session, const mesh_t* mesh)
+{
+	int row, col;
+	char* frame;
 
-			/* Move forward */
-			case 'z':
-				translate(0, 0, -TRANSLATE_STEP);
-				break;
+	if (use_session(session))
+		return 1;
 
-			/* Move backward */
-			case 'x':
-				translate(0, 0, TRANSLATE_STEP);
-				break;
+	clear_buffer();
+	draw_mesh(mesh);
 
-			/* Scale up */
-			case '+':
-				scale(SCALE_STEP, SCALE_STEP, SCALE_STEP);
-				break;
+	/* Copy it out, it is sent without the lock */
+	frame = (char*) realloc(session->frame, (unsigned long)output_width * output_height);
 
-			/* Scale down */
-			case '-':
-				scale(1/SCALE_STEP, 1/SCALE_STEP, 1/SCALE_STEP);
-				break;
+	if (frame == NULL)
+		return 1;
 
-			/* Rotate y */
-			case 'j':
-				rotate_y(ROTATE_STEP);
-				break;
+	session->frame = frame;
 
-			case 'l':
-				rotate_y(-ROTATE_STEP);
-				break;
+	for (row = 0; row < output_height; row++)
+	{
+		for (col = 0; col < output_width; col++)
+			session->frame[col+row*output_width] = screen_cell(col, row);
+	}
 
-			/* Rotate x */
-			case 'i':
-				rotate_x(ROTATE_STEP);
-				break;
+	return 0;
+}
 
-			case 'k':
-				rotate_x(-ROTATE_STEP);
-				break;
+/* Send the last frame: a "frame width height" line, then a line for every row */
+void write_frame(const session_t* session, FILE* output)
+{
+	int row;
 
-			/* Rotate z */
-			case 'u':
-				rotate_z(ROTATE_STEP);
-				break;
-		
-			case 'o':
-				rotate_z(-ROTATE_STEP);
-				break;
+	fprintf(output, "frame %d %d\n", session->width, session->height);
 
-			/* Restore mesh */
-			case 'r':
-				restore_mesh();
-				break;
-		}
+	for (row = 0; row < session->height; row++)
+	{
+		fwrite(&session->frame[row*session->width], 1, session->width, output);
+		fputc('\n', output);
 	}
 
 	return;
 }
+#endif
 
-#else
-/* CLI input loop */
-void loop_input()
+/* Main */
+int main(int argc, char *argv[]) 
 {
-	/* Input variables */
-	char command[64];
-	char last[2] = "\0";
-	float ammount = 1;
-	int quit = 0;
-
-	/* Keep looping until user hit 'q' */
-	while(!quit)
-	{	
-		/* Render it */
-		draw_screen();
-
-		/* Get input */
-		fgets(command, 64, stdin);
+	int arg, level;
+	int result = 0;
+	char* path = NULL;
+	int quantize = 0;
+	int use_lod = 1;
+	int use_scene = 0;
+	char* script_path = NULL;
+	char* poster_path = NULL;
+	int poster_width = 0, poster_height = 0;
+	char* generate_kind = NULL;
+	long generate_tris = 0;
+	int split = 0;
+	#ifdef BENCHMARK
+	int raster_bench = 0;
+	int run_bench = 0;
+	char* check_path = NULL;
+	char* baseline_path = NULL;
+	int update_check = 0;
+	#endif
+	#ifdef POSIX
+	char* convert_path = NULL;
+	unsigned long budget = STREAM_BUDGET_MB;
+	int streaming = -1;
+	int use_sequence = 0;
+	char* socket_path = NULL;
+	#endif
+	#ifdef REALTIME
+	float fps = 0;
+	#endif
 
-		/* Quit */
-		if (command[0] == 'q')
-			quit = 1;
+	/* Read commands unbuffered, so the wait for input sees every line not read yet */
+	#if defined(POSIX) && !defined(NCURSES)
+	setvbuf(stdin, NULL, _IONBF, 0);
+	#endif
 
-		/* Viewport resize */
-		else if (command[0] == 'v')
+	/* Parse the options */
+	for (arg = 1; arg < argc; arg++)
+	{
+		if (strcmp(argv[arg], "--quantize") == 0)
+			quantize = 1;
+		else if (strcmp(argv[arg], "--no-lod") == 0)
+			use_lod = 0;
+		else if (strcmp(argv[arg], "--scene") == 0)
+			use_scene = 1;
+		else if (strcmp(argv[arg], "--deferred") == 0)
+			deferred = 1;
+		else if (strcmp(argv[arg], "--wire") == 0 && arg+1 < argc)
 		{
-			/* Try to parse width and height */
-			int width, height;
-
-			if (sscanf(command, "%*s %dx%d", &width, &height) == 2)
-			{
-				/* Recreate a new buffer */
-				create_buffer(width, height);
-				continue;
-			}
+			/* Wireframe mode */
+			arg++;
+			if (strcmp(argv[arg], "hidden") == 0)
+				wire_mode = WIRE_HIDDEN;
+			else if (strcmp(argv[arg], "silhouette") == 0)
+				wire_mode = WIRE_SILHOUETTE;
+			else
+				wire_mode = WIRE_EDGES;
 		}
-		
-		/* If just enter, restore the previous one */
-		else if (command[0] == '\n')
+		else if (strcmp(argv[arg], "--glyphs") == 0 && arg+1 < argc)
 		{
-			command[0] = last[0];
-			command[1] = last[1];
+			/* Output glyphs */
+			arg++;
+			if (strcmp(argv[arg], "half") == 0)
+				glyph_mode = GLYPH_HALF;
+			else if (strcmp(argv[arg], "braille") == 0)
+				glyph_mode = GLYPH_BRAILLE;
+			else
+				glyph_mode = GLYPH_TEXT;
 		}
-
-		/* Parse the ammount */
-		sscanf(command, "%*s %f", &ammount);
-
-		/* Translation */
-		if (command[0] == 't')
+		else if (strcmp(argv[arg], "--color") == 0 && arg+1 < argc)
 		{
-			/* Translate */
-			if (command[1] == 'x')
-			{
-				translate(ammount, 0, 0);
-			}
-			else if (command[1] == 'y')
-			{
-				translate(0, ammount, 0);
-			}
-			else if (command[1] == 'z')
-			{
-				translate(0, 0, ammount);
-			}
+			/* ANSI color output */
+			arg++;
+			if (strcmp(argv[arg], "256") == 0)
+				ansi_mode = ANSI_256;
+			else if (strcmp(argv[arg], "truecolor") == 0)
+				ansi_mode = ANSI_TRUECOLOR;
+			else
+				ansi_mode = ANSI_OFF;
 		}
-
-		/* Rotation */
-		else if (command[0] == 'r')
+		else if (strcmp(argv[arg], "--fit") == 0)
+			auto_fit = 1;
+		else if (strcmp(argv[arg], "--split") == 0 && arg+1 < argc)
+			split = atoi(argv[++arg]);
+		else if (strcmp(argv[arg], "--script") == 0 && arg+1 < argc)
+			script_path = argv[++arg];
+		else if (strcmp(argv[arg], "--poster") == 0 && arg+2 < argc)
 		{
-			/* Convert from degree to radian */
-			float angle = ammount*PI/180;
+			/* Output file and size as widthxheight */
+			poster_path = argv[++arg];
 
-			/* Rotate */
-			if (command[1] == 'x')
-			{
-				rotate_x(angle);
-			}
-			else if (command[1] == 'y')
-			{
-				rotate_y(angle);
-			}
-			else if (command[1] == 'z')
-			{
-				rotate_z(angle);
-			}
+			if (sscanf(argv[++arg], "%dx%d", &poster_width, &poster_height) != 2)
+				poster_width = poster_height = 0;
 		}
-
-		/* Scale */
-		else if (command[0] == 's')
+		else if (strcmp(argv[arg], "--generate") == 0 && arg+2 < argc)
 		{
-			/* Scale */
-			if (command[1] == 'x')
-			{
-				scale(ammount, 1, 1);
-			}
-			else if (command[1] == 'y')
-			{
-				scale(1, ammount, 1);
-			}
-			else if (command[1] == 'z')
-			{
-				scale(1, 1, ammount);
-			}
-			else if (command[1] == 'a')
-			{
-				scale(ammount, ammount, ammount);
-			}
+			/* Stress mesh kind and tris count */
+			generate_kind = argv[++arg];
+			generate_tris = parse_count(argv[++arg]);
 		}
+		#ifdef BENCHMARK
+		else if (strcmp(argv[arg], "--parse-bench") == 0 && arg+1 < argc)
+			return benchmark_parser(argv[arg+1]) ? 2 : 0;
+		else if (strcmp(argv[arg], "--raster-bench") == 0)
+			raster_bench = 1;
+		else if (strcmp(argv[arg], "--bench") == 0)
+			run_bench = 1;
+		else if (strcmp(argv[arg], "--check") == 0 && arg+1 < argc)
+			check_path = argv[++arg];
+		else if (strcmp(argv[arg], "--check-timing") == 0 && arg+1 < argc)
+			baseline_path = argv[++arg];
+		else if (strcmp(argv[arg], "--update") == 0)
+			update_check = 1;
+		#endif
+		else if (strcmp(argv[arg], "--depth") == 0 && arg+1 < argc)
+		{
+			/* Depth buffer format */
+			arg++;
+			if (strcmp(argv[arg], "16") == 0)
+				depth_mode = DEPTH_FIXED16;
+			else
+				depth_mode = DEPTH_FLOAT;
+		}
+		#ifdef POSIX
+		else if (strcmp(argv[arg], "--convert") == 0 && arg+1 < argc)
+			convert_path = argv[++arg];
+		else if (strcmp(argv[arg], "--budget") == 0 && arg+1 < argc)
+			budget = strtoul(argv[++arg], NULL, 10);
+		else if (strcmp(argv[arg], "--seq") == 0)
+			use_sequence = 1;
+		else if (strcmp(argv[arg], "--serve") == 0 && arg+1 < argc)
+			socket_path = argv[++arg];
+		#endif
+		#ifdef REALTIME
+		else if (strcmp(argv[arg], "--fps") == 0 && arg+1 < argc)
+		{
+			/* Frame and playback rate, at least a frame per second */
+			fps = atof(argv[++arg]);
+			if (fps < 1)
+				fps = 1;
+			loop_fps = fps;
+		}
+		else if (strcmp(argv[arg], "--turntable") == 0 && arg+1 < argc)
+			turntable = atof(argv[++arg]);
+		else if (strcmp(argv[arg], "--frame-budget") == 0 && arg+1 < argc)
+			frame_budget = atof(argv[++arg]);
+		#endif
+		else if (argv[arg][0] == '-')
+		{
+			printf("Unknown option %s\n", argv[arg]);
+			return 1;
+		}
+		else
+			path = argv[arg];
+	}
 
-		/* Reset */
-		else if (command[0] == 'm')
-			restore_mesh();
-
-		/* Print help */
-		else if (command[0] == 'h')
-			show_help();
-	
-		/* Orthogonal or perspective */
-		else if (command[0] == 'p')
-			ortho = !ortho;
-		
-		/* Light mode */
-		else if (command[0] == 'l')
-			do_light = !do_light;
-
-		/* Save last command */
-		last[0] = command[0];
-		last[1] = command[1];
+	/* Split viewports draw text with float depth and forward shading, with no wireframe */
+	if (split > 0 && (glyph_mode != GLYPH_TEXT || wire_mode != WIRE_OFF || deferred || depth_mode != DEPTH_FLOAT))
+	{
+		puts("Split viewports draw text with float depth and forward shading, the other modes are not used");
+		glyph_mode = GLYPH_TEXT;
+		wire_mode = WIRE_OFF;
+		deferred = 0;
+		depth_mode = DEPTH_FLOAT;
 	}
 
-	return;
-}
-#endif
+	/* Render server, meshes are opened by the clients */
+	#ifdef POSIX
+	if (socket_path != NULL)
+		return serve(socket_path) ? 2 : 0;
+	#endif
 
-/* Main */
-int main(int argc, char *argv[]) 
-{
-	/* Check argument number */
-	if (argc < 2) 
+	/* Microbenchmarks on generated meshes */
+	#ifdef BENCHMARK
+	if (run_bench)
+		return benchmark_suite(generate_kind != NULL ? generate_kind : "sphere",
+			generate_kind != NULL ? generate_tris : BENCH_TRIS) ? 2 : 0;
+	#endif
+
+	/* Check the model path, a generated mesh needs none */
+	if (path == NULL && generate_kind == NULL) 
 	{		
 		puts("Please provide the model path.\n");
 		return 1;	
 	}
 
-	/* Parse the model */
-	if (parse_obj(argv[1]))
-		return 2;
+	#ifdef POSIX
+	/* Generated mesh, none of the file paths below apply */
+	if (generate_kind != NULL)
+		streaming = -1;
 
-	/* Ncurses init */
-	#ifdef NCURSES
-	initscr();
-	cbreak();
-	noecho();
-	curs_set(0);
+	/* Write the chunked file and exit */
+	else if (convert_path != NULL)
+		return convert_obj(path, convert_path) ? 2 : 0;
 
-	/* Color init */
-	if (has_colors())
+	/* Mesh sequence, frames decoded while playing */
+	else if (use_sequence)
 	{
-		unsigned int material;
-		start_color();
-		
-		/* Material array color pair*/
-		for (material = 0; material < sizeof(material_array)/sizeof(material_array[0]); material++)
-		{
-			/* Color from 1 to 7 */
-			init_pair(material_array[material]%7+4, COLOR_WHITE, material%7+1);
-		}
+		if (open_sequence(path, fps > 0 ? fps : SEQUENCE_FPS))
+			return 2;
 
-		/* Black, white and albedo for background and light mode */
-		init_pair(1, COLOR_WHITE, COLOR_BLACK);
-		init_pair(2, COLOR_WHITE, COLOR_WHITE);
-		init_pair(3, COLOR_WHITE, COLOR_ALBEDO);
+		streaming = 0;
 	}
+
+	/* Chunked file, stream it instead of loading it */
+	else if (!use_scene)
+		streaming = open_stream(path, budget << 20);
+
+	if (streaming > 0)
+		return 2;
 	#endif
 
-	/* Print help message at start */
-	show_help();
+	/* Scene of instanced meshes, each mesh loaded once */
+	if (use_scene && generate_kind == NULL)
+	{
+		if (load_scene(path, quantize))
+			return 2;
+	}
+	#ifdef POSIX
+	else if (streaming < 0)
+	#else
+	else
+	#endif
+	{
+		/* Load the model */
+		#ifdef BENCHMARK
+		load_ms = clock_ms();
+		#endif
+
+		if (generate_kind != NULL ? generate_mesh(generate_kind, generate_tris, &lod_chain[0]) :
+			load_mesh(path, &lod_chain[0]))
+			return 2;
+
+		#ifdef BENCHMARK
+		load_ms = clock_ms() - load_ms;
+		#endif
+
+		/* Simplify it */
+		if (use_lod)
+			build_lod_chain();
+		else
+			lod_count = 1;
 
-	/* Restore the mesh */
-	restore_mesh();
+		/* Pick the storage used by the renderer */
+		for (level = 0; level < lod_count; level++)
+			compact_mesh(&lod_chain[level], quantize);
+	}
 
-	/* Allocate rendering buffer */
-	#ifdef NCURSES
-	create_buffer(getmaxx(stdscr), getmaxy(stdscr));
+	build_glyph_table();
+	build_ansi_table();
 
-	#else
-	create_buffer(SCREEN_WIDTH, SCREEN_HEIGHT);
+	/* Compare with the golden frames and the timing baseline */
+	#ifdef BENCHMARK
+	if (check_path != NULL || baseline_path != NULL)
+		result = (check_path != NULL && check_frames(check_path, update_check)) |
+			(baseline_path != NULL && check_timing(baseline_path, update_check));
+
+	/* Time the raster in every output mode */
+	else if (raster_bench)
+		benchmark_raster();
+	else
 	#endif
 
-	/* Start the input loop */
-	loop_input();
+	/* Render the poster instead of the input loop */
+	if (poster_path != NULL)
+	{
+		restore_mesh();
+		result = render_poster(poster_path, poster_width, poster_height) ? 2 : 0;
+	}
+
+	/* Run the script instead of the input loop */
+	else if (script_path != NULL)
+	{
+		restore_mesh();
+		if (split > 0)
+			init_split(split);
+		result = create_buffer(SCRIPT_WIDTH, SCRIPT_HEIGHT) || run_script(script_path) ? 2 : 0;
+	}
+
+	else
+	{
+		/* Ncurses init, in the terminal encoding for the glyphs */
+		#ifdef NCURSES
+		setlocale(LC_CTYPE, "");
+		initscr();
+		cbreak();
+		noecho();
+		curs_set(0);
+
+		/* Color init */
+		if (has_colors())
+		{
+			unsigned int material;
+			start_color();
+			
+			/* Material array color pair*/
+			for (material = 0; material < sizeof(material_array)/sizeof(material_array[0]); material++)
+			{
+				/* Color from 1 to 7 */
+				init_pair(material_array[material]%7+4, COLOR_WHITE, material%7+1);
+			}
+
+			/* Black, white and albedo for background and light mode */
+			init_pair(1, COLOR_WHITE, COLOR_BLACK);
+			init_pair(2, COLOR_WHITE, COLOR_WHITE);
+			init_pair(3, COLOR_WHITE, COLOR_ALBEDO);
+		}
+		#endif
+
+		/* Print help message at start */
+		show_help();
+
+		/* Restore the mesh, every viewport if split */
+		restore_mesh();
+		if (split > 0)
+			init_split(split);
+
+		/* Allocate rendering buffer */
+		#ifdef NCURSES
+		result = create_buffer(getmaxx(stdscr), getmaxy(stdscr)) ? 2 : 0;
+
+		#else
+		result = create_buffer(SCREEN_WIDTH, SCREEN_HEIGHT) ? 2 : 0;
+		#endif
+
+		/* Start the input loop */
+		if (!result)
+			loop_input();
+
+		/* Kill the windows */
+		#ifdef NCURSES
+		endwin();
+		#endif
+
+		if (result)
+			puts("Not enough memory for the frame buffers");
+	}
 
 	/* Free memory */
-	free(tris_buffer);
-	free(vertex_buffer);
-	free(screen_buffer);
-	free(depth_buffer);
-	
-	/* Kill the windows */
-	#ifdef NCURSES
-	endwin();
+	for (level = 0; level < lod_count; level++)
+		free_mesh(&lod_chain[level]);
+	arena_free(&render_arena);
+	arena_free(&poster_arena);
+	close_split();
+
+	free_scene();
+
+	#ifdef POSIX
+	if (stream.chunk != NULL)
+		close_stream();
+	if (sequence.frame_count > 0)
+		close_sequence();
 	#endif
-
+	
 	/* Exit */
-	return 0;
+	return result;
 }